@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/buffer_management/BufferPoolManager.hpp"
+#include "../include/buffer_management/SharedBufferPool.hpp"
+#include "../include/buffer_management/MappedBufferPool.hpp"
+#include "../include/storage-node/StorageLists.hpp"
+
+/**
+ * Synthetic micro-benchmark of the BufferPoolManager.
+ *
+ * Generates a lists file of NUM_LISTS lists with random vectors and a configurable size distribution,
+ * then drives FetchListPages() / UnPinListPages() with a Zipf access skew for every combination of
+ * thread count and pool size, and reports ops/s, hit ratio and fetch latency percentiles.
+ *
+ * Usage: bench_bpm [--key=value]...
+ *   --lists-file=tests/tmp/bench_lists.bin
+ *   --size-dist=uniform|zipf|pareto   distribution of the list lengths
+ *   --mean-entries=32                 mean number of vectors per list
+ *   --max-entries=12000               maximum number of vectors per list
+ *   --access-skew=0.99                Zipf exponent of the list accesses, 0 for uniform
+ *   --threads=1,2,4                   thread counts to run
+ *   --pool-sizes=64,256,1024          pool sizes in frames to run
+ *   --ops=20000                       fetches per thread
+ *   --max-read-kb=0                   merge the reads of neighbouring lists up to this size, 0 to disable
+ *   --max-gap-kb=64                   largest hole between merged reads
+ *   --max-batches=8                   largest number of merged batches read at the same time
+ *   --mapped=0                        also run the zero-copy MappedBufferPool with the same memory budget
+ *   --views=0                         also run the BufferPoolManager with contiguous list views
+ *   --processes=0                     also run this many processes sharing a SharedBufferPool, 0 to disable
+ *   --seed=1
+ */
+
+using namespace ann_dkvs;
+
+struct BenchConfig {
+    std::string lists_file = "tests/tmp/bench_lists.bin";
+    std::string size_dist = "uniform";
+    size_t mean_entries = 32;
+    size_t max_entries = 12000;
+    double access_skew = 0.99;
+    std::vector<size_t> threads = {1, 2, 4};
+    std::vector<size_t> pool_sizes = {64, 256, 1024};
+    size_t ops = 20000;
+    size_t max_read_kb = 0;
+    size_t max_gap_kb = 64;
+    size_t max_batches = 8;
+    bool mapped = false;
+    bool views = false;
+    size_t processes = 0;
+    unsigned seed = 1;
+};
+
+std::vector<size_t> parse_list(const std::string& value) {
+    std::vector<size_t> result;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        result.push_back(std::stoul(item));
+    }
+    return result;
+}
+
+BenchConfig parse_args(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+        std::string key = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (key == "lists-file") config.lists_file = value;
+        else if (key == "size-dist") config.size_dist = value;
+        else if (key == "mean-entries") config.mean_entries = std::stoul(value);
+        else if (key == "max-entries") config.max_entries = std::stoul(value);
+        else if (key == "access-skew") config.access_skew = std::stod(value);
+        else if (key == "threads") config.threads = parse_list(value);
+        else if (key == "pool-sizes") config.pool_sizes = parse_list(value);
+        else if (key == "ops") config.ops = std::stoul(value);
+        else if (key == "max-read-kb") config.max_read_kb = std::stoul(value);
+        else if (key == "max-gap-kb") config.max_gap_kb = std::stoul(value);
+        else if (key == "max-batches") config.max_batches = std::stoul(value);
+        else if (key == "mapped") config.mapped = std::stoul(value) != 0;
+        else if (key == "views") config.views = std::stoul(value) != 0;
+        else if (key == "processes") config.processes = std::stoul(value);
+        else if (key == "seed") config.seed = std::stoul(value);
+        else throw std::invalid_argument("Unknown argument " + arg);
+    }
+    if (config.size_dist != "uniform" && config.size_dist != "zipf" && config.size_dist != "pareto") {
+        throw std::invalid_argument("Unknown size distribution " + config.size_dist);
+    }
+    return config;
+}
+
+/** Number of vectors of every list following the configured size distribution. */
+std::vector<len_t> generate_list_lengths(const BenchConfig& config, std::mt19937_64& rng) {
+    std::vector<len_t> lengths(NUM_LISTS);
+    double mean = config.mean_entries;
+    if (config.size_dist == "uniform") {
+        std::uniform_int_distribution<len_t> dist(1, 2 * config.mean_entries - 1);
+        for (auto& length : lengths) {
+            length = dist(rng);
+        }
+    } else if (config.size_dist == "zipf") {
+        /** Length proportional to 1 / rank, scaled to the mean, ranks shuffled over the lists. */
+        double harmonic = 0;
+        for (size_t rank = 1; rank <= NUM_LISTS; rank++) {
+            harmonic += 1.0 / rank;
+        }
+        for (size_t rank = 1; rank <= NUM_LISTS; rank++) {
+            lengths[rank - 1] = (len_t) std::llround(mean * NUM_LISTS / harmonic / rank);
+        }
+        std::shuffle(lengths.begin(), lengths.end(), rng);
+    } else {
+        /** Pareto with shape 1.5, heavy-tailed but with a finite mean. */
+        const double alpha = 1.5;
+        double scale = mean * (alpha - 1) / alpha;
+        std::uniform_real_distribution<double> dist(0, 1);
+        for (auto& length : lengths) {
+            length = (len_t) std::llround(scale / std::pow(1 - dist(rng), 1 / alpha));
+        }
+    }
+    for (auto& length : lengths) {
+        length = std::min(std::max(length, (len_t) 1), (len_t) config.max_entries);
+    }
+    return lengths;
+}
+
+void generate_lists(StorageLists& lists, const std::vector<len_t>& lengths, std::mt19937_64& rng) {
+    std::uniform_real_distribution<float> dist(0, 255);
+    std::vector<vector_el_t> vectors;
+    std::vector<vector_id_t> ids;
+    vector_id_t next_id = 0;
+    for (list_id_t list_id = 0; list_id < NUM_LISTS; list_id++) {
+        len_t length = lengths[list_id];
+        vectors.resize(length * DATA_DIMENSION);
+        ids.resize(length);
+        for (auto& el : vectors) {
+            el = StorageLists::to_vector_el(dist(rng));
+        }
+        for (auto& id : ids) {
+            id = next_id++;
+        }
+        lists.insert_entries(list_id, vectors.data(), ids.data(), length);
+    }
+}
+
+/** Zipf sampler over the list ids, the hottest lists are spread over the file. */
+class ZipfSampler {
+    public:
+        ZipfSampler(double skew, std::mt19937_64& rng) : cdf_(NUM_LISTS), lists_(NUM_LISTS) {
+            double sum = 0;
+            for (size_t rank = 0; rank < NUM_LISTS; rank++) {
+                sum += 1.0 / std::pow(rank + 1, skew);
+                cdf_[rank] = sum;
+            }
+            for (auto& value : cdf_) {
+                value /= sum;
+            }
+            for (size_t i = 0; i < NUM_LISTS; i++) {
+                lists_[i] = i;
+            }
+            std::shuffle(lists_.begin(), lists_.end(), rng);
+        }
+
+        list_id_t Sample(std::mt19937_64& rng) const {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            size_t rank = std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+            return lists_[std::min(rank, (size_t) NUM_LISTS - 1)];
+        }
+
+    private:
+        std::vector<double> cdf_;
+        std::vector<list_id_t> lists_;
+};
+
+template <class BufferPool>
+void run_benchmark(const BenchConfig& config, const ZipfSampler& sampler, size_t thread_num, size_t pool_size, BufferPool& bpm, const std::string& backend) {
+
+    std::vector<std::thread> workers;
+    auto start_point = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_num; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(config.seed * 7919 + t);
+            for (size_t i = 0; i < config.ops; i++) {
+                list_id_t list_id = sampler.Sample(rng);
+                bpm.FetchListPages(list_id);
+                bpm.UnPinListPages(list_id);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start_point;
+
+    BufferPoolStatsSnapshot stats = bpm.GetStats();
+    std::cout << backend
+              << "\tthreads: " << thread_num
+              << "\tpool size: " << pool_size
+              << "\tops/s: " << (size_t) (thread_num * config.ops / duration.count())
+              << "\thit ratio: " << stats.HitRatio()
+              << "\tmiss waits: " << stats.miss_waits
+              << "\tread syscalls: " << stats.read_syscalls
+              << "\tfetch p50 (ns): " << stats.fetch_latency.Percentile(0.5)
+              << "\tp99: " << stats.fetch_latency.Percentile(0.99)
+              << "\tp999: " << stats.fetch_latency.Percentile(0.999) << std::endl;
+}
+
+/** Every process runs the fetches of a thread on the same shared pool, created by the parent. */
+void run_shared_benchmark(const BenchConfig& config, StorageLists& lists, const ZipfSampler& sampler, size_t process_num, size_t pool_size) {
+    const std::string name = "/bench_bpm_" + std::to_string(getpid());
+    SharedBufferPool::Remove(name);
+    SharedBufferPool pool(name, pool_size, &lists, lists.get_filename());
+
+    auto start_point = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    for (size_t p = 0; p < process_num; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            SharedBufferPool child_pool(name, pool_size, &lists, lists.get_filename());
+            std::mt19937_64 rng(config.seed * 7919 + p);
+            for (size_t i = 0; i < config.ops; i++) {
+                list_id_t list_id = sampler.Sample(rng);
+                child_pool.FetchListPages(list_id);
+                child_pool.UnPinListPages(list_id);
+            }
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+        waitpid(pid, nullptr, 0);
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start_point;
+
+    BufferPoolStatsSnapshot stats = pool.GetStats();
+    std::cout << "processes: " << process_num
+              << "\tshared pool size: " << pool_size
+              << "\tops/s: " << (size_t) (process_num * config.ops / duration.count())
+              << "\thit ratio: " << stats.HitRatio()
+              << "\tread syscalls: " << stats.read_syscalls << std::endl;
+    SharedBufferPool::Remove(name);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parse_args(argc, argv);
+    std::mt19937_64 rng(config.seed);
+
+    std::vector<len_t> lengths = generate_list_lengths(config, rng);
+    len_t largest_list = *std::max_element(lengths.begin(), lengths.end());
+    size_t largest_list_frames = (largest_list + FRAME_DATA_NUM - 1) / FRAME_DATA_NUM;
+
+    remove(config.lists_file.c_str());
+    StorageLists lists(DATA_DIMENSION, config.lists_file);
+    generate_lists(lists, lengths, rng);
+    std::cout << "Generated " << NUM_LISTS << " lists (" << config.size_dist << ", largest " << largest_list
+              << " vectors) in " << lists.get_total_size() << " bytes." << std::endl;
+
+    ZipfSampler sampler(config.access_skew, rng);
+    for (size_t pool_size : config.pool_sizes) {
+        if (pool_size < largest_list_frames) {
+            std::cout << "Skip pool size " << pool_size << ", the largest list needs " << largest_list_frames << " frames." << std::endl;
+            continue;
+        }
+        for (size_t thread_num : config.threads) {
+            BufferPoolManager bpm(pool_size, &lists, lists.get_filename());
+            if (config.max_read_kb > 0) {
+                bpm.EnableIoScheduler(config.max_read_kb * 1024, config.max_gap_kb * 1024, config.max_batches);
+            }
+            run_benchmark(config, sampler, thread_num, pool_size, bpm, "copy");
+            if (config.views) {
+                BufferPoolManager views_bpm(pool_size, &lists, lists.get_filename());
+                if (views_bpm.EnableListViews()) {
+                    run_benchmark(config, sampler, thread_num, pool_size, views_bpm, "views");
+                }
+            }
+            if (config.mapped) {
+                MappedBufferPool mapped_bpm(pool_size * BufferPoolManager::FrameBytes(), &lists, lists.get_filename());
+                run_benchmark(config, sampler, thread_num, pool_size, mapped_bpm, "mapped");
+            }
+        }
+        if (config.processes > 0) {
+            run_shared_benchmark(config, lists, sampler, config.processes, pool_size);
+        }
+    }
+
+    remove(config.lists_file.c_str());
+    return 0;
+}
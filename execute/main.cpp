@@ -124,6 +124,17 @@ auto alloc_query_as_vector_el = [](uint8_t *query_vector, len_t vector_dim)
     return query_vector_float;
 };
 
+/** The centroids file holds floats, converted to the components of the lists. */
+auto alloc_centroids_as_vector_el = [](float *centroids, len_t n_components)
+{
+    vector_el_t *centroids_el = (vector_el_t *)malloc(n_components * sizeof(vector_el_t));
+    for (len_t i = 0; i < n_components; i++)
+    {
+        centroids_el[i] = StorageLists::to_vector_el(centroids[i]);
+    }
+    return centroids_el;
+};
+
 auto prepare_query = [](uint8_t *query_vectors, 
                         len_t query_id, 
                         len_t vector_dim, 
@@ -208,7 +219,7 @@ int main() {
     len_t vectors_size = (len_t)N_ENTRIES * VECTOR_DIM * sizeof(vector_el_t);
     len_t vector_ids_size = (len_t)N_ENTRIES * sizeof(vector_id_t);
     len_t list_ids_size = (len_t)N_ENTRIES * sizeof(list_id_t);
-    len_t centroids_size = (len_t)N_LISTS * VECTOR_DIM * sizeof(vector_el_t);
+    len_t centroids_size = (len_t)N_LISTS * VECTOR_DIM * sizeof(float);
     len_t query_vectors_size = (len_t)1E4 * VECTOR_DIM * sizeof(vector_el_t);
     len_t groundtruth_size = (len_t)1E4 * N_RESULTS_GROUNDTRUTH * sizeof(vector_id_t); // ???
 
@@ -231,11 +242,13 @@ int main() {
     vector_el_t* vectors = (vector_el_t*) mmap_file(vectors_filepath, vectors_size);
     vector_id_t* vector_ids = (vector_id_t*) mmap_file(vector_ids_filepath, vector_ids_size);
     list_id_t* list_ids = (list_id_t*) mmap_file(list_ids_filepath, list_ids_size);
-    vector_el_t* centroids = (vector_el_t*) mmap_file(centroids_filepath, centroids_size);
+    float* centroids = (float*) mmap_file(centroids_filepath, centroids_size);
     uint8_t* query_vectors = (uint8_t*) mmap_file(query_vectors_filepath, query_vectors_size);
     uint32_t* groundtruth = (uint32_t*) mmap_file(groundtruth_filepath, groundtruth_size);
 
-    RootIndex root_index(VECTOR_DIM, centroids, N_LISTS);
+    vector_el_t* centroids_el = alloc_centroids_as_vector_el(centroids, (len_t)N_LISTS * VECTOR_DIM);
+    RootIndex root_index(VECTOR_DIM, centroids_el, N_LISTS);
+    free(centroids_el);
 
     /** Initialize lists. */
     StorageLists lists;
@@ -312,7 +325,7 @@ int main() {
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_point - start_point);
     std::cout << "duration: " << duration.count() << std::endl;
 
-    // std::cout << "cache hit: " << bpm->hit / (float) bpm->total << std::endl;
+    // std::cout << "cache hit: " << bpm->GetStats().HitRatio() << std::endl;
 
     free_queries(queries);
 
@@ -14,6 +14,7 @@
 // #include "../include/storage-node/StorageLists.hpp"
 #include "../include/buffer_management/BufferPoolManager.hpp"
 #include "../include/storage-node/StorageIndex.hpp"
+#include "../include/storage-node/PQIndex.hpp"
 #include "../include/root-node/RootIndex.hpp"
 #include "../include/Query.hpp"
 
@@ -38,6 +39,56 @@
 #define N_PROBES 32
 #define N_RESULTS_GROUNDTRUTH 1000
 
+/** Local-SSD secondary cache of the buffer pool, disabled when the size (in frames) is 0. */
+#define SECONDARY_CACHE_DIR "tests/tmp/ssd"
+#define SECONDARY_CACHE_SIZE 0
+
+/** Heat map of the buffer pool saved by the previous run, warm-up is disabled when the number of threads is 0. */
+#define HEAT_MAP_FILEPATH "output/heat_map_1B"
+#define WARM_UP_THREADS 0
+
+/** Access trace of the buffer pool for simulate_bpm, only recorded when RECORD_TRACE is 1. */
+#define TRACE_FILEPATH "output/trace_1B.bin"
+#define RECORD_TRACE 0
+
+/** Merge the reads of neighbouring lists up to this size, disabled when it is 0. */
+#define IO_SCHEDULER_MAX_READ_BYTES 0
+#define IO_SCHEDULER_MAX_GAP_BYTES (64 * 1024)
+#define IO_SCHEDULER_MAX_BATCHES 8
+
+/** Map every resident list into one virtually contiguous window, only when LIST_VIEWS is 1. */
+#define LIST_VIEWS 0
+
+/** Scan every list once for all queries which probe it, only when LIST_MAJOR is 1. */
+#define LIST_MAJOR 0
+
+/**
+ * Search the lists compressed with product quantization (4-bit codes, this number per vector) in memory
+ * instead of the lists on disk, only when it is not 0. The codebooks are trained on a sample of the lists.
+ */
+#define PQ_SUBQUANTIZERS 0
+#define PQ_TRAINING_VECTORS 65536
+#define PQ_ARCHIVE_FILEPATH "output/pq_lists_1B"
+
+/**
+ * Re-rank this number of candidates of the PQ search with their exact distances, only when it is not 0 and
+ * PQ_SUBQUANTIZERS is not 0. Lists cached in the buffer pool are read from it, the vectors of the candidates
+ * of other lists are read one by one from the lists file, without loading their lists.
+ */
+#define TWO_STAGE_SHORTLIST 0
+
+/**
+ * Prefilter the scans with 1-bit codes of the vectors relative to their centroid, keeping this number of candidates
+ * per result in every list, only when it is not 0.
+ */
+#define BINARY_PREFILTER_EXPANSION 0
+
+/**
+ * Prune the scans with the triangle inequality from the distances of the vectors to their centroid, only when it is not 0;
+ * when it is 2 the lists are also sorted by these distances, so whole ranges of the lists are skipped.
+ */
+#define CENTROID_DISTANCE_PRUNING 0
+
 
 using namespace ann_dkvs;
 
@@ -122,6 +173,17 @@ auto alloc_query_as_vector_el = [](uint8_t *query_vector, len_t vector_dim)
     return query_vector_float;
 };
 
+/** The centroids file holds floats, converted to the components of the lists. */
+auto alloc_centroids_as_vector_el = [](float *centroids, len_t n_components)
+{
+    vector_el_t *centroids_el = (vector_el_t *)malloc(n_components * sizeof(vector_el_t));
+    for (len_t i = 0; i < n_components; i++)
+    {
+        centroids_el[i] = StorageLists::to_vector_el(centroids[i]);
+    }
+    return centroids_el;
+};
+
 auto prepare_query = [](uint8_t *query_vectors, 
                         len_t query_id, 
                         len_t vector_dim, 
@@ -206,7 +268,7 @@ int main() {
     len_t vectors_size = (len_t)N_ENTRIES * VECTOR_DIM * sizeof(vector_el_t);
     len_t vector_ids_size = (len_t)N_ENTRIES * sizeof(vector_id_t);
     len_t list_ids_size = (len_t)N_ENTRIES * sizeof(list_id_t);
-    len_t centroids_size = (len_t)N_LISTS * VECTOR_DIM * sizeof(vector_el_t);
+    len_t centroids_size = (len_t)N_LISTS * VECTOR_DIM * sizeof(float);
     len_t query_vectors_size = (len_t)1E4 * VECTOR_DIM * sizeof(vector_el_t);
     len_t groundtruth_size = (len_t)1E4 * N_RESULTS_GROUNDTRUTH * sizeof(vector_id_t); // ???
 
@@ -229,12 +291,12 @@ int main() {
     // vector_el_t* vectors = (vector_el_t*) mmap_file(vectors_filepath, vectors_size);
     // vector_id_t* vector_ids = (vector_id_t*) mmap_file(vector_ids_filepath, vector_ids_size);
     // list_id_t* list_ids = (list_id_t*) mmap_file(list_ids_filepath, list_ids_size);
-    vector_el_t* centroids = (vector_el_t*) mmap_file(centroids_filepath, centroids_size);
+    float* centroids = (float*) mmap_file(centroids_filepath, centroids_size);
     uint8_t* query_vectors = (uint8_t*) mmap_file(query_vectors_filepath, query_vectors_size);
     // uint32_t* groundtruth = (uint32_t*) mmap_file(groundtruth_filepath, groundtruth_size);
 
-    RootIndex root_index(VECTOR_DIM, centroids, N_LISTS);
-    munmap(centroids, centroids_size);
+    vector_el_t* centroids_el = alloc_centroids_as_vector_el(centroids, (len_t)N_LISTS * VECTOR_DIM);
+    RootIndex root_index(VECTOR_DIM, centroids_el, N_LISTS);
 
     /** Initialize lists. */
     StorageLists lists;
@@ -274,21 +336,77 @@ int main() {
         fclose(f);
     }
     
+    /** Before the codes of the lists are built, as sorting the lists moves their entries. */
+    if (CENTROID_DISTANCE_PRUNING > 0) {
+        lists.set_centroid_distances(centroids_el, CENTROID_DISTANCE_PRUNING == 2);
+    }
+    free(centroids_el);
+
     StorageIndex storage_index(&lists);
 
+    BinaryLists binary_lists;
+    if (BINARY_PREFILTER_EXPANSION > 0) {
+        binary_lists = BinaryLists(VECTOR_DIM);
+        binary_lists.add_lists(lists, centroids);
+        storage_index.set_binary_prefilter(&binary_lists, BINARY_PREFILTER_EXPANSION);
+        std::cout << "Binary codes: " << binary_lists.get_total_size() << " bytes" << std::endl;
+    }
+    munmap(centroids, centroids_size);
+
+    PQLists pq_lists;
+    if (PQ_SUBQUANTIZERS > 0) {
+        if (!file_exists(PQ_ARCHIVE_FILEPATH)) {
+            std::cout << "train product quantizer" << std::endl;
+            pq_lists = PQLists(VECTOR_DIM, PQ_SUBQUANTIZERS);
+            pq_lists.train(lists, PQ_TRAINING_VECTORS, 25, 1234);
+            pq_lists.add_lists(lists);
+            std::ofstream ofs(PQ_ARCHIVE_FILEPATH);
+            boost::archive::text_oarchive oa(ofs);
+            oa << pq_lists;
+        } else {
+            std::ifstream ifs(PQ_ARCHIVE_FILEPATH);
+            boost::archive::text_iarchive ia(ifs);
+            ia >> pq_lists;
+        }
+        std::cout << "PQ lists: " << pq_lists.get_total_size() << " bytes" << std::endl;
+    }
+    PQIndex pq_index(&pq_lists);
+
 
     QueryBatch queries = prepare_queries(query_vectors, 1E2, VECTOR_DIM, N_RESULTS, N_PROBES);
     munmap(query_vectors, query_vectors_size);
     std::cout << "Finished preparing queries." << std::endl;
 
 
-    BufferPoolManager* bpm = new BufferPoolManager(100000, &lists, "tests/tmp/lists_1B.bin");
+    SecondaryCache* secondary_cache = nullptr;
+    if (SECONDARY_CACHE_SIZE > 0) {
+        secondary_cache = new SecondaryCache(SECONDARY_CACHE_DIR, SECONDARY_CACHE_SIZE);
+    }
+    BufferPoolManager* bpm = new BufferPoolManager(100000, &lists, "tests/tmp/lists_1B.bin", secondary_cache);
+    bpm->EnableMissRatioCurve(0.1, 1000);
+    if (IO_SCHEDULER_MAX_READ_BYTES > 0) {
+        bpm->EnableIoScheduler(IO_SCHEDULER_MAX_READ_BYTES, IO_SCHEDULER_MAX_GAP_BYTES, IO_SCHEDULER_MAX_BATCHES);
+    }
+    if (LIST_VIEWS) {
+        bpm->EnableListViews();
+    }
+    if (WARM_UP_THREADS > 0) {
+        bpm->StartWarmUp(HEAT_MAP_FILEPATH, WARM_UP_THREADS);
+    }
+    if (RECORD_TRACE) {
+        bpm->StartTrace(TRACE_FILEPATH);
+    }
     std::cout << "Finished preparing buffer pool." << std::endl;
+    std::cout << "Vector components: " << lists.get_vector_el_name() << std::endl;
+    std::cout << "L2 kernel: " << L2Space::get_simd_level_name(L2Space::get_simd_level()) << std::endl;
     root_index.batch_preassign_queries(queries);
 
     auto start_point = std::chrono::system_clock::now();
     // QueryResultsBatch results = storage_index.batch_search_preassigned(queries);
-    QueryResultsBatch results = storage_index.batch_search_preassigned_bpm(queries, bpm);
+    QueryResultsBatch results = PQ_SUBQUANTIZERS > 0 && TWO_STAGE_SHORTLIST > 0 ? storage_index.batch_search_two_stage_bpm(queries, &pq_index, TWO_STAGE_SHORTLIST, bpm)
+                                : PQ_SUBQUANTIZERS > 0 ? pq_index.batch_search_preassigned(queries)
+                                : LIST_MAJOR ? storage_index.batch_search_preassigned_by_list_bpm(queries, bpm)
+                                             : storage_index.batch_search_preassigned_bpm(queries, bpm);
 
     auto end_point = std::chrono::system_clock::now();
 
@@ -299,6 +417,23 @@ int main() {
     uint32_t* groundtruth = (uint32_t*) mmap_file(groundtruth_filepath, groundtruth_size);
     float recall_at_1 = get_recall_at_r(results, groundtruth, 1E2, N_RESULTS_GROUNDTRUTH, N_RESULTS, 1);
     std::cout << "Recall@1: " << recall_at_1 << std::endl;
+
+    /** Expected hit ratio for other pool sizes, estimated from this run. */
+    BufferPoolStatsSnapshot stats = bpm->GetStats();
+    std::cout << "cache hit: " << stats.HitRatio() << std::endl;
+    std::cout << "evictions: " << stats.evictions << ", bytes read: " << stats.bytes_read
+              << ", read syscalls: " << stats.read_syscalls
+              << ", contiguous allocation failures: " << stats.contiguous_alloc_failures
+              << ", miss waits: " << stats.miss_waits
+              << ", invalidations: " << stats.invalidations << std::endl;
+    std::cout << "fetch latency (ns) p50: " << stats.fetch_latency.Percentile(0.5)
+              << ", p99: " << stats.fetch_latency.Percentile(0.99)
+              << ", p999: " << stats.fetch_latency.Percentile(0.999) << std::endl;
+    for (size_t pool_size = 25000; pool_size <= 200000; pool_size *= 2) {
+        std::cout << "expected cache hit with " << pool_size << " frames: " << bpm->GetExpectedHitRatio(pool_size) << std::endl;
+    }
+    bpm->SaveHeatMap(HEAT_MAP_FILEPATH);
+    bpm->StopTrace();
     munmap(groundtruth, groundtruth_size);
 
 
@@ -0,0 +1,221 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+
+#include "../include/buffer_management/AccessTrace.hpp"
+#include "../include/buffer_management/BufferPoolManager.hpp"
+#include "../include/buffer_management/ClockReplacer.hpp"
+
+/**
+ * Offline cache-policy simulator.
+ *
+ * Replays an access trace recorded by BufferPoolManager::StartTrace() against replacement policies
+ * and pool sizes, without touching any list data.
+ *
+ * Usage: simulate_bpm <trace file> <clock|lru|all> <pool size in frames>...
+ */
+
+using namespace ann_dkvs;
+
+/** Bytes read from the lists file for a frame of a miss, assuming full frames. */
+#define FRAME_BYTES (FRAME_DATA_SIZE * sizeof(vector_el_t) + FRAME_DATA_NUM * sizeof(vector_id_t))
+/** Bytes of the squared norms read along with a full frame, if the lists file stores them. */
+#define FRAME_NORMS_BYTES (FRAME_DATA_NUM * sizeof(distance_t))
+
+struct SimulationResult {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes_read = 0;
+};
+
+/**
+ * Same allocation and replacement as BufferPoolManager: a list occupies continuous frames,
+ * free frames are looked up first and otherwise whole lists are evicted by the ClockReplacer.
+ * Lists are unpinned right after they are fetched.
+ */
+class ClockSimulator {
+    public:
+        ClockSimulator(size_t pool_size)
+            : pool_size_(pool_size), replacer_(pool_size), free_list_(pool_size, true),
+              list_ids_(pool_size, INVALID_LIST_ID), list_sizes_(pool_size, 0), access_times_(pool_size, 0) {}
+
+        void Access(list_id_t list_id, int page_num, size_t frame_bytes, SimulationResult& result) {
+            auto iter = hash_to_frame_.find(list_id);
+            if (iter != hash_to_frame_.end()) {
+                result.hits++;
+                AccessList(iter->second, page_num);
+                return;
+            }
+            result.misses++;
+            result.bytes_read += page_num * frame_bytes;
+            if ((size_t) page_num > pool_size_) {
+                return;
+            }
+
+            frame_id_t start_frame = LookUpFreeList(page_num);
+            while (start_frame == -1) {
+                frame_id_t frame_id;
+                if (!replacer_.EvictFrame(&frame_id)) {
+                    return;
+                }
+                result.evictions++;
+                int evict_size = list_sizes_[frame_id];
+                hash_to_frame_.erase(list_ids_[frame_id]);
+                ResetFrame(frame_id);
+                for (int i = 1; i < evict_size; i++) {
+                    replacer_.EvictNonFirstFrame();
+                    ResetFrame(frame_id + i);
+                }
+                start_frame = LookUpFreeList(page_num);
+            }
+
+            for (int i = 0; i < page_num; i++) {
+                free_list_[start_frame + i] = false;
+                list_ids_[start_frame + i] = list_id;
+                list_sizes_[start_frame + i] = page_num;
+                replacer_.SetFirstFrame(start_frame + i, i == 0);
+            }
+            hash_to_frame_[list_id] = start_frame;
+            AccessList(start_frame, page_num);
+        }
+
+    private:
+        size_t pool_size_;
+        ClockReplacer replacer_;
+        std::vector<bool> free_list_;
+        std::vector<list_id_t> list_ids_;
+        std::vector<int> list_sizes_;
+        std::vector<int> access_times_;
+        std::unordered_map<list_id_t, frame_id_t> hash_to_frame_;
+
+        frame_id_t LookUpFreeList(int size) {
+            int continuous_free_size = 0;
+            for (size_t i = 0; i < pool_size_; i++) {
+                continuous_free_size = free_list_[i] ? continuous_free_size + 1 : 0;
+                if (continuous_free_size >= size) {
+                    return i + 1 - size;
+                }
+            }
+            return -1;
+        }
+
+        void ResetFrame(frame_id_t frame_id) {
+            free_list_[frame_id] = true;
+            list_ids_[frame_id] = INVALID_LIST_ID;
+            list_sizes_[frame_id] = 0;
+            access_times_[frame_id] = 0;
+        }
+
+        /** Mirrors BufferPoolManager::AccessList() followed by UnPinListPages(). */
+        void AccessList(frame_id_t frame_id, int list_size) {
+            for (int i = 0; i < list_size; i++) {
+                access_times_[frame_id + i]++;
+                if (!replacer_.GetUsedFrame(frame_id + i)) {
+                    replacer_.AccessFrame(frame_id + i, false);
+                }
+                if (access_times_[frame_id + i] == list_sizes_[frame_id + i]) {
+                    replacer_.AccessFrame(frame_id + i, true);
+                    access_times_[frame_id + i] = 0;
+                }
+            }
+        }
+};
+
+/**
+ * LRU over whole lists with a capacity in frames and no fragmentation.
+ */
+class LruSimulator {
+    public:
+        LruSimulator(size_t pool_size) : pool_size_(pool_size), used_size_(0) {}
+
+        void Access(list_id_t list_id, int page_num, size_t frame_bytes, SimulationResult& result) {
+            auto iter = hash_to_lru_.find(list_id);
+            if (iter != hash_to_lru_.end()) {
+                result.hits++;
+                lru_list_.splice(lru_list_.begin(), lru_list_, iter->second);
+                return;
+            }
+            result.misses++;
+            result.bytes_read += page_num * frame_bytes;
+            if ((size_t) page_num > pool_size_) {
+                return;
+            }
+
+            while (used_size_ + page_num > pool_size_) {
+                result.evictions++;
+                used_size_ -= lru_list_.back().second;
+                hash_to_lru_.erase(lru_list_.back().first);
+                lru_list_.pop_back();
+            }
+            lru_list_.push_front(std::make_pair(list_id, page_num));
+            hash_to_lru_[list_id] = lru_list_.begin();
+            used_size_ += page_num;
+        }
+
+    private:
+        size_t pool_size_;
+        size_t used_size_;
+        std::list<std::pair<list_id_t, int> > lru_list_;
+        std::unordered_map<list_id_t, std::list<std::pair<list_id_t, int> >::iterator> hash_to_lru_;
+};
+
+template <class Simulator>
+SimulationResult simulate(const std::vector<TraceRecord>& trace, const TraceHeader& header, size_t pool_size) {
+    Simulator simulator(pool_size);
+    SimulationResult result;
+    for (const TraceRecord& record : trace) {
+        size_t frame_bytes = FRAME_BYTES;
+        if (header.HasNorms(record.list_id >> LIST_KEY_INDEX_SHIFT)) {
+            frame_bytes += FRAME_NORMS_BYTES;
+        }
+        simulator.Access((list_id_t) record.list_id, (int) record.page_num, frame_bytes, result);
+    }
+    return result;
+}
+
+void print_result(const std::string& policy, size_t pool_size, const SimulationResult& result, double seconds) {
+    size_t total = result.hits + result.misses;
+    std::cout << policy
+              << "\tpool size: " << pool_size
+              << "\thit ratio: " << (total == 0 ? 0 : result.hits / (double) total)
+              << "\tbytes read: " << result.bytes_read
+              << "\tevictions: " << result.evictions
+              << "\t(" << seconds << " s)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cout << "Usage: " << argv[0] << " <trace file> <clock|lru|all> <pool size in frames>..." << std::endl;
+        return 1;
+    }
+    std::string policy = argv[2];
+    if (policy != "clock" && policy != "lru" && policy != "all") {
+        std::cout << "Unknown policy: " << policy << std::endl;
+        return 1;
+    }
+
+    TraceHeader header;
+    std::vector<TraceRecord> trace = ReadTrace(argv[1], &header);
+    std::cout << "Replaying " << trace.size() << " accesses." << std::endl;
+
+    for (int i = 3; i < argc; i++) {
+        size_t pool_size = std::stoul(argv[i]);
+        if (policy == "clock" || policy == "all") {
+            auto start_point = std::chrono::steady_clock::now();
+            SimulationResult result = simulate<ClockSimulator>(trace, header, pool_size);
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start_point;
+            print_result("clock", pool_size, result, duration.count());
+        }
+        if (policy == "lru" || policy == "all") {
+            auto start_point = std::chrono::steady_clock::now();
+            SimulationResult result = simulate<LruSimulator>(trace, header, pool_size);
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start_point;
+            print_result("lru", pool_size, result, duration.count());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+
+#include "storage-node/types.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/** Maximum number of 64-bit words of a binary code, i.e. codes of vectors up to 4096 dimensions. */
+#define HAMMING_MAX_WORDS 64
+
+namespace ann_dkvs
+{
+  /**
+   * Hamming distance kernels of binary codes (see BinaryLists).
+   * They compute the distances from the code of a query to n consecutive codes of n_words 64-bit words each.
+   *
+   * The SIMD kernels XOR the codes of 4 (AVX2) or 8 (AVX-512) vectors at once against the code of the query
+   * repeated as many times, count the bits of every 64-bit word, and add up the words of every vector.
+   * They must only be called on CPUs which support their instruction set (see BinaryLists::get_hamming_func()).
+   *
+   * @param query_code The code of the query.
+   * @param codes n codes, stored consecutively.
+   * @param n_words The number of words of a code, at most HAMMING_MAX_WORDS.
+   * @param n The number of codes.
+   * @param distances The n distances.
+   */
+  inline void HammingKernelScalar(const uint64_t *query_code, const uint64_t *codes, size_t n_words, len_t n, uint16_t *distances)
+  {
+    for (len_t i = 0; i < n; i++)
+    {
+      uint16_t distance = 0;
+      for (size_t w = 0; w < n_words; w++)
+      {
+        distance += __builtin_popcountll(query_code[w] ^ codes[i * n_words + w]);
+      }
+      distances[i] = distance;
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  /** Same as HammingKernelScalar(), with the popcnt instruction. */
+  __attribute__((target("popcnt"))) inline void HammingKernelPopcnt(const uint64_t *query_code, const uint64_t *codes, size_t n_words, len_t n, uint16_t *distances)
+  {
+    for (len_t i = 0; i < n; i++)
+    {
+      uint16_t distance = 0;
+      for (size_t w = 0; w < n_words; w++)
+      {
+        distance += __builtin_popcountll(query_code[w] ^ codes[i * n_words + w]);
+      }
+      distances[i] = distance;
+    }
+  }
+
+  /** Bits of every 64-bit word: the bits of every nibble are looked up with pshufb, and the bytes summed with psadbw. */
+  __attribute__((target("avx2"))) inline __m256i PopcountEpi64AVX2(__m256i words)
+  {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(words, low_mask));
+    __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(words, 4), low_mask));
+    return _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256());
+  }
+
+  __attribute__((target("avx2,popcnt"))) inline void HammingKernelAVX2(const uint64_t *query_code, const uint64_t *codes, size_t n_words, len_t n, uint16_t *distances)
+  {
+    /** 4 codes are 4 * n_words words, i.e. n_words registers, and the query repeated 4 times lines up with them. */
+    uint64_t query_codes[4 * HAMMING_MAX_WORDS];
+    uint64_t counts[4 * HAMMING_MAX_WORDS];
+    for (size_t w = 0; w < 4 * n_words; w++)
+    {
+      query_codes[w] = query_code[w % n_words];
+    }
+    len_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      const uint64_t *group = codes + i * n_words;
+      for (size_t r = 0; r < n_words; r++)
+      {
+        __m256i words = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(group + r * 4)),
+                                         _mm256_loadu_si256((const __m256i *)(query_codes + r * 4)));
+        _mm256_storeu_si256((__m256i *)(counts + r * 4), PopcountEpi64AVX2(words));
+      }
+      for (size_t v = 0; v < 4; v++)
+      {
+        uint16_t distance = 0;
+        for (size_t w = 0; w < n_words; w++)
+        {
+          distance += counts[v * n_words + w];
+        }
+        distances[i + v] = distance;
+      }
+    }
+    HammingKernelPopcnt(query_code, codes + i * n_words, n_words, n - i, distances + i);
+  }
+
+  /** Same as HammingKernelAVX2() for 8 codes at once, with the popcount of AVX512_VPOPCNTDQ. */
+  __attribute__((target("avx512f,avx512vpopcntdq,popcnt"))) inline void HammingKernelAVX512(const uint64_t *query_code, const uint64_t *codes, size_t n_words, len_t n, uint16_t *distances)
+  {
+    uint64_t query_codes[8 * HAMMING_MAX_WORDS];
+    uint64_t counts[8 * HAMMING_MAX_WORDS];
+    for (size_t w = 0; w < 8 * n_words; w++)
+    {
+      query_codes[w] = query_code[w % n_words];
+    }
+    len_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      const uint64_t *group = codes + i * n_words;
+      for (size_t r = 0; r < n_words; r++)
+      {
+        __m512i words = _mm512_xor_si512(_mm512_loadu_si512(group + r * 8), _mm512_loadu_si512(query_codes + r * 8));
+        _mm512_storeu_si512(counts + r * 8, _mm512_popcnt_epi64(words));
+      }
+      for (size_t v = 0; v < 8; v++)
+      {
+        uint16_t distance = 0;
+        for (size_t w = 0; w < n_words; w++)
+        {
+          distance += counts[v * n_words + w];
+        }
+        distances[i + v] = distance;
+      }
+    }
+    HammingKernelPopcnt(query_code, codes + i * n_words, n_words, n - i, distances + i);
+  }
+#endif
+}
@@ -0,0 +1,858 @@
+#pragma once
+
+#include <type_traits>
+
+#include "storage-node/types.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/** The kernels of 1-byte vectors widen 32 bytes at once to 16 bits, which needs AVX512BW. */
+#if VECTOR_EL_UINT8 || VECTOR_EL_INT8
+#define L2_AVX512_TARGET "avx512f,avx512bw"
+#else
+#define L2_AVX512_TARGET "avx512f"
+#endif
+/** The AVX2 kernels of fp16 vectors widen them with F16C. */
+#if VECTOR_EL_FP16
+#define L2_AVX2_TARGET "avx2,fma,f16c"
+#else
+#define L2_AVX2_TARGET "avx2,fma"
+#endif
+
+namespace ann_dkvs
+{
+  /**
+   * L2 kernels for a dimension known at compile time.
+   * With DIM != 0 the loops have a constant trip count, so the compiler unrolls them and keeps the accumulators in registers.
+   * With DIM == 0 the dimension is read from dim at runtime, this is the generic fallback.
+   * The SIMD kernels are compiled for their instruction set regardless of the compiler flags,
+   * they must only be called on CPUs which support it (see L2Space::get_simd_level()).
+   */
+  template <size_t DIM>
+  inline float L2SqrKernelScalar(const float *pVect1, const float *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      float t = pVect1[i] - pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /**
+   * Kernels for vectors of 1-byte components (uint8 or int8, see vector_el_t), selected by overload.
+   * The differences are widened to 16 bits, then squared and summed pairwise into 32-bit lanes with madd,
+   * so the distance is exact until the final conversion to float. The block and matrix kernels use them
+   * directly on the vectors, the norms are not needed.
+   */
+  template <size_t DIM, class T>
+  inline std::enable_if_t<sizeof(T) == 1, float> L2SqrKernelScalar(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    int res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      int t = (int)pVect1[i] - (int)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /** Half precision components (see float16.hpp), selected by overload. They are widened to float, and summed as floats. */
+  template <class T>
+  struct is_half_float : std::integral_constant<bool, std::is_same<T, float16_t>::value || std::is_same<T, bfloat16_t>::value>
+  {
+  };
+
+  template <size_t DIM, class T>
+  inline std::enable_if_t<is_half_float<T>::value, float> L2SqrKernelScalar(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      float t = (float)pVect1[i] - (float)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  template <size_t DIM>
+  inline float InnerProductKernelScalar(const float *pVect1, const float *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+    {
+      res += pVect1[i] * pVect2[i];
+    }
+    return res;
+  }
+
+  /**
+   * Block kernels: the distances from one query to n contiguous vectors, written to distances.
+   * They use ||x||^2 - 2 x.q + ||q||^2 with the squared norms of the vectors precomputed,
+   * so only the inner product is computed per vector. Several vectors are processed together
+   * to share the loads of the query. Rounding may make the distance of equal vectors slightly negative,
+   * it is clamped to 0.
+   */
+  template <size_t DIM>
+  inline void L2SqrBlockKernelScalar(const float *query, float query_norm, const float *vectors, const float *norms,
+                                     size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    for (size_t i = 0; i < n; i++)
+    {
+      float distance = norms[i] - 2 * InnerProductKernelScalar<DIM>(vectors + i * qty, query, qty) + query_norm;
+      distances[i] = distance > 0 ? distance : 0;
+    }
+  }
+
+
+  /**
+   * Matrix kernels: the distances from n_queries queries to n contiguous vectors, written row by row
+   * to distances (the distance of query r to vector i at distances[r * n + i]).
+   * This is a small GEMM of the queries with the vectors plus the norms. The vectors are walked in tiles
+   * of about L2_MATRIX_TILE_BYTES which stay in cache while every query is applied to them, and the SIMD kernels
+   * compute a few queries times four vectors at once in registers, so each load is used for several products.
+   */
+  constexpr size_t L2_MATRIX_TILE_BYTES = 32 * 1024;
+
+  /** Number of vectors of a tile, a multiple of 4. */
+  inline size_t L2SqrMatrixTileLength(size_t dim, size_t el_size = sizeof(float))
+  {
+    size_t length = L2_MATRIX_TILE_BYTES / (dim * el_size) >> 2 << 2;
+    return length > 4 ? length : 4;
+  }
+
+  template <size_t DIM>
+  inline void L2SqrMatrixKernelScalar(const float *const *queries, const float *query_norms, size_t n_queries,
+                                      const float *vectors, const float *norms, size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t tile = L2SqrMatrixTileLength(qty);
+    for (size_t t = 0; t < n; t += tile)
+    {
+      size_t tile_n = n - t < tile ? n - t : tile;
+      for (size_t r = 0; r < n_queries; r++)
+      {
+        L2SqrBlockKernelScalar<DIM>(queries[r], query_norms[r], vectors + t * qty, norms + t, tile_n, qty, distances + r * n + t);
+      }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  template <size_t DIM>
+  __attribute__((target("sse4.1"))) inline float L2SqrKernelSSE4(const float *pVect1, const float *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty4 = qty >> 2 << 2;
+
+    __m128 sum = _mm_setzero_ps();
+    for (size_t i = 0; i < qty4; i += 4)
+    {
+      __m128 diff = _mm_sub_ps(_mm_loadu_ps(pVect1 + i), _mm_loadu_ps(pVect2 + i));
+      sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    float res = _mm_cvtss_f32(sum);
+
+    for (size_t i = qty4; i < qty; i++)
+    {
+      float t = pVect1[i] - pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  template <size_t DIM>
+  __attribute__((target("avx2,fma"))) inline float L2SqrKernelAVX2(const float *pVect1, const float *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty16 = qty >> 4 << 4;
+    const size_t qty8 = qty >> 3 << 3;
+
+    /** Two accumulators, so that consecutive FMAs do not wait for each other. */
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i < qty16; i += 16)
+    {
+      __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+      __m256 diff2 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8));
+      sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+      sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+    }
+    if (i < qty8)
+    {
+      __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+      sum1 = _mm256_fmadd_ps(diff, diff, sum1);
+    }
+    __m256 sum = _mm256_add_ps(sum1, sum2);
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    float res = _mm_cvtss_f32(sum128);
+
+    for (i = qty8; i < qty; i++)
+    {
+      float t = pVect1[i] - pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /**
+   * Sum of the upper and lower halves. The zero-masked extracts do the same as _mm512_reduce_add_ps() and the casts,
+   * which GCC builds from undefined vectors and then warns about in every caller.
+   */
+  __attribute__((target("avx512f"))) inline __m256 FoldHalvesAVX512(__m512 v)
+  {
+    __m512d halves = _mm512_castps_pd(v);
+    return _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, halves, 0)),
+                         _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, halves, 1)));
+  }
+
+  /** Sum of all lanes. */
+  __attribute__((target("avx512f"))) inline float HorizontalSumAVX512(__m512 v)
+  {
+    __m256 sum = FoldHalvesAVX512(v);
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    return _mm_cvtss_f32(sum128);
+  }
+
+  template <size_t DIM>
+  __attribute__((target("avx512f"))) inline float L2SqrKernelAVX512(const float *pVect1, const float *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty32 = qty >> 5 << 5;
+
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i < qty32; i += 32)
+    {
+      __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+      __m512 diff2 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+      sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+      sum2 = _mm512_fmadd_ps(diff2, diff2, sum2);
+    }
+    /** The rest is loaded with a mask, the masked out lanes are 0 in both vectors. */
+    for (; i < qty; i += 16)
+    {
+      size_t left = qty - i < 16 ? qty - i : 16;
+      __mmask16 mask = (__mmask16)((1U << left) - 1);
+      __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, pVect1 + i), _mm512_maskz_loadu_ps(mask, pVect2 + i));
+      sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+    }
+    return HorizontalSumAVX512(_mm512_add_ps(sum1, sum2));
+  }
+  template <size_t DIM>
+  __attribute__((target("sse4.1"))) inline void L2SqrBlockKernelSSE4(const float *query, float query_norm, const float *vectors, const float *norms,
+                                                                    size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty4 = qty >> 2 << 2;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      const float *pVect = vectors + i * qty;
+      __m128 sum[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+      for (size_t j = 0; j < qty4; j += 4)
+      {
+        __m128 q = _mm_loadu_ps(query + j);
+        for (size_t k = 0; k < 4; k++)
+        {
+          sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(_mm_loadu_ps(pVect + k * qty + j), q));
+        }
+      }
+      for (size_t k = 0; k < 4; k++)
+      {
+        __m128 total = _mm_hadd_ps(sum[k], sum[k]);
+        total = _mm_hadd_ps(total, total);
+        float dot = _mm_cvtss_f32(total);
+        for (size_t j = qty4; j < qty; j++)
+        {
+          dot += pVect[k * qty + j] * query[j];
+        }
+        float distance = norms[i + k] - 2 * dot + query_norm;
+        distances[i + k] = distance > 0 ? distance : 0;
+      }
+    }
+    L2SqrBlockKernelScalar<DIM>(query, query_norm, vectors + i * qty, norms + i, n - i, qty, distances + i);
+  }
+
+  template <size_t DIM>
+  __attribute__((target("avx2,fma"))) inline void L2SqrBlockKernelAVX2(const float *query, float query_norm, const float *vectors, const float *norms,
+                                                                      size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty8 = qty >> 3 << 3;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      const float *pVect = vectors + i * qty;
+      __m256 sum[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+      for (size_t j = 0; j < qty8; j += 8)
+      {
+        __m256 q = _mm256_loadu_ps(query + j);
+        for (size_t k = 0; k < 4; k++)
+        {
+          sum[k] = _mm256_fmadd_ps(_mm256_loadu_ps(pVect + k * qty + j), q, sum[k]);
+        }
+      }
+      for (size_t k = 0; k < 4; k++)
+      {
+        __m128 total = _mm_add_ps(_mm256_castps256_ps128(sum[k]), _mm256_extractf128_ps(sum[k], 1));
+        total = _mm_hadd_ps(total, total);
+        total = _mm_hadd_ps(total, total);
+        float dot = _mm_cvtss_f32(total);
+        for (size_t j = qty8; j < qty; j++)
+        {
+          dot += pVect[k * qty + j] * query[j];
+        }
+        float distance = norms[i + k] - 2 * dot + query_norm;
+        distances[i + k] = distance > 0 ? distance : 0;
+      }
+    }
+    L2SqrBlockKernelScalar<DIM>(query, query_norm, vectors + i * qty, norms + i, n - i, qty, distances + i);
+  }
+
+  template <size_t DIM>
+  __attribute__((target("avx512f"))) inline void L2SqrBlockKernelAVX512(const float *query, float query_norm, const float *vectors, const float *norms,
+                                                                       size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty16 = qty >> 4 << 4;
+    const __mmask16 tail_mask = (__mmask16)((1U << (qty - qty16)) - 1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      const float *pVect = vectors + i * qty;
+      __m512 sum[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+      for (size_t j = 0; j < qty16; j += 16)
+      {
+        __m512 q = _mm512_loadu_ps(query + j);
+        for (size_t k = 0; k < 4; k++)
+        {
+          sum[k] = _mm512_fmadd_ps(_mm512_loadu_ps(pVect + k * qty + j), q, sum[k]);
+        }
+      }
+      if (qty16 < qty)
+      {
+        __m512 q = _mm512_maskz_loadu_ps(tail_mask, query + qty16);
+        for (size_t k = 0; k < 4; k++)
+        {
+          sum[k] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, pVect + k * qty + qty16), q, sum[k]);
+        }
+      }
+      for (size_t k = 0; k < 4; k++)
+      {
+        float distance = norms[i + k] - 2 * HorizontalSumAVX512(sum[k]) + query_norm;
+        distances[i + k] = distance > 0 ? distance : 0;
+      }
+    }
+    L2SqrBlockKernelScalar<DIM>(query, query_norm, vectors + i * qty, norms + i, n - i, qty, distances + i);
+  }
+
+  /** Sums of four vectors of partial sums, as one vector. */
+  __attribute__((target("sse4.1"))) inline __m128 HorizontalSum4SSE(__m128 a, __m128 b, __m128 c, __m128 d)
+  {
+    return _mm_hadd_ps(_mm_hadd_ps(a, b), _mm_hadd_ps(c, d));
+  }
+
+  __attribute__((target("avx"))) inline __m128 HorizontalSum4AVX(__m256 a, __m256 b, __m256 c, __m256 d)
+  {
+    __m256 sum = _mm256_hadd_ps(_mm256_hadd_ps(a, b), _mm256_hadd_ps(c, d));
+    return _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+  }
+
+  /** Write the distances of a query to four vectors from their inner products. */
+  inline void L2SqrFromDots(const float *dots, float query_norm, const float *norms, float *distances)
+  {
+    for (size_t k = 0; k < 4; k++)
+    {
+      float distance = norms[k] - 2 * dots[k] + query_norm;
+      distances[k] = distance > 0 ? distance : 0;
+    }
+  }
+
+  /** 2 queries x 4 vectors per step. */
+  template <size_t DIM>
+  __attribute__((target("sse4.1"))) inline void L2SqrMatrixKernelSSE4(const float *const *queries, const float *query_norms, size_t n_queries,
+                                                                     const float *vectors, const float *norms, size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty4 = qty >> 2 << 2;
+    const size_t tile = L2SqrMatrixTileLength(qty);
+    for (size_t t = 0; t < n; t += tile)
+    {
+      size_t tile_end = n - t < tile ? n : t + tile;
+      size_t r = 0;
+      for (; r + 2 <= n_queries; r += 2)
+      {
+        size_t i = t;
+        for (; i + 4 <= tile_end; i += 4)
+        {
+          const float *pVect = vectors + i * qty;
+          __m128 sum[2][4];
+          for (size_t m = 0; m < 2; m++)
+          {
+            for (size_t k = 0; k < 4; k++)
+            {
+              sum[m][k] = _mm_setzero_ps();
+            }
+          }
+          for (size_t j = 0; j < qty4; j += 4)
+          {
+            __m128 x[4];
+            for (size_t k = 0; k < 4; k++)
+            {
+              x[k] = _mm_loadu_ps(pVect + k * qty + j);
+            }
+            for (size_t m = 0; m < 2; m++)
+            {
+              __m128 q = _mm_loadu_ps(queries[r + m] + j);
+              for (size_t k = 0; k < 4; k++)
+              {
+                sum[m][k] = _mm_add_ps(sum[m][k], _mm_mul_ps(x[k], q));
+              }
+            }
+          }
+          for (size_t m = 0; m < 2; m++)
+          {
+            float dots[4];
+            _mm_storeu_ps(dots, HorizontalSum4SSE(sum[m][0], sum[m][1], sum[m][2], sum[m][3]));
+            for (size_t k = 0; k < 4; k++)
+            {
+              for (size_t j = qty4; j < qty; j++)
+              {
+                dots[k] += pVect[k * qty + j] * queries[r + m][j];
+              }
+            }
+            L2SqrFromDots(dots, query_norms[r + m], norms + i, distances + (r + m) * n + i);
+          }
+        }
+        for (size_t m = 0; m < 2; m++)
+        {
+          L2SqrBlockKernelSSE4<DIM>(queries[r + m], query_norms[r + m], vectors + i * qty, norms + i, tile_end - i, qty, distances + (r + m) * n + i);
+        }
+      }
+      for (; r < n_queries; r++)
+      {
+        L2SqrBlockKernelSSE4<DIM>(queries[r], query_norms[r], vectors + t * qty, norms + t, tile_end - t, qty, distances + r * n + t);
+      }
+    }
+  }
+
+  /** 2 queries x 4 vectors per step, 8 accumulators out of the 16 registers. */
+  template <size_t DIM>
+  __attribute__((target("avx2,fma"))) inline void L2SqrMatrixKernelAVX2(const float *const *queries, const float *query_norms, size_t n_queries,
+                                                                       const float *vectors, const float *norms, size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty8 = qty >> 3 << 3;
+    const size_t tile = L2SqrMatrixTileLength(qty);
+    for (size_t t = 0; t < n; t += tile)
+    {
+      size_t tile_end = n - t < tile ? n : t + tile;
+      size_t r = 0;
+      for (; r + 2 <= n_queries; r += 2)
+      {
+        size_t i = t;
+        for (; i + 4 <= tile_end; i += 4)
+        {
+          const float *pVect = vectors + i * qty;
+          __m256 sum[2][4];
+          for (size_t m = 0; m < 2; m++)
+          {
+            for (size_t k = 0; k < 4; k++)
+            {
+              sum[m][k] = _mm256_setzero_ps();
+            }
+          }
+          for (size_t j = 0; j < qty8; j += 8)
+          {
+            __m256 x[4];
+            for (size_t k = 0; k < 4; k++)
+            {
+              x[k] = _mm256_loadu_ps(pVect + k * qty + j);
+            }
+            for (size_t m = 0; m < 2; m++)
+            {
+              __m256 q = _mm256_loadu_ps(queries[r + m] + j);
+              for (size_t k = 0; k < 4; k++)
+              {
+                sum[m][k] = _mm256_fmadd_ps(x[k], q, sum[m][k]);
+              }
+            }
+          }
+          for (size_t m = 0; m < 2; m++)
+          {
+            float dots[4];
+            _mm_storeu_ps(dots, HorizontalSum4AVX(sum[m][0], sum[m][1], sum[m][2], sum[m][3]));
+            for (size_t k = 0; k < 4; k++)
+            {
+              for (size_t j = qty8; j < qty; j++)
+              {
+                dots[k] += pVect[k * qty + j] * queries[r + m][j];
+              }
+            }
+            L2SqrFromDots(dots, query_norms[r + m], norms + i, distances + (r + m) * n + i);
+          }
+        }
+        for (size_t m = 0; m < 2; m++)
+        {
+          L2SqrBlockKernelAVX2<DIM>(queries[r + m], query_norms[r + m], vectors + i * qty, norms + i, tile_end - i, qty, distances + (r + m) * n + i);
+        }
+      }
+      for (; r < n_queries; r++)
+      {
+        L2SqrBlockKernelAVX2<DIM>(queries[r], query_norms[r], vectors + t * qty, norms + t, tile_end - t, qty, distances + r * n + t);
+      }
+    }
+  }
+
+  /** 4 queries x 4 vectors per step, 16 accumulators out of the 32 registers. */
+  template <size_t DIM>
+  __attribute__((target("avx512f"))) inline void L2SqrMatrixKernelAVX512(const float *const *queries, const float *query_norms, size_t n_queries,
+                                                                        const float *vectors, const float *norms, size_t n, size_t dim, float *distances)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty16 = qty >> 4 << 4;
+    const __mmask16 tail_mask = (__mmask16)((1U << (qty - qty16)) - 1);
+    const size_t tile = L2SqrMatrixTileLength(qty);
+    for (size_t t = 0; t < n; t += tile)
+    {
+      size_t tile_end = n - t < tile ? n : t + tile;
+      size_t r = 0;
+      for (; r + 4 <= n_queries; r += 4)
+      {
+        size_t i = t;
+        for (; i + 4 <= tile_end; i += 4)
+        {
+          const float *pVect = vectors + i * qty;
+          __m512 sum[4][4];
+          for (size_t m = 0; m < 4; m++)
+          {
+            for (size_t k = 0; k < 4; k++)
+            {
+              sum[m][k] = _mm512_setzero_ps();
+            }
+          }
+          for (size_t j = 0; j < qty16; j += 16)
+          {
+            __m512 x[4];
+            for (size_t k = 0; k < 4; k++)
+            {
+              x[k] = _mm512_loadu_ps(pVect + k * qty + j);
+            }
+            for (size_t m = 0; m < 4; m++)
+            {
+              __m512 q = _mm512_loadu_ps(queries[r + m] + j);
+              for (size_t k = 0; k < 4; k++)
+              {
+                sum[m][k] = _mm512_fmadd_ps(x[k], q, sum[m][k]);
+              }
+            }
+          }
+          if (qty16 < qty)
+          {
+            __m512 x[4];
+            for (size_t k = 0; k < 4; k++)
+            {
+              x[k] = _mm512_maskz_loadu_ps(tail_mask, pVect + k * qty + qty16);
+            }
+            for (size_t m = 0; m < 4; m++)
+            {
+              __m512 q = _mm512_maskz_loadu_ps(tail_mask, queries[r + m] + qty16);
+              for (size_t k = 0; k < 4; k++)
+              {
+                sum[m][k] = _mm512_fmadd_ps(x[k], q, sum[m][k]);
+              }
+            }
+          }
+          for (size_t m = 0; m < 4; m++)
+          {
+            /** Fold the halves first, then sum the four vectors together. */
+            __m256 half[4];
+            for (size_t k = 0; k < 4; k++)
+            {
+              half[k] = FoldHalvesAVX512(sum[m][k]);
+            }
+            float dots[4];
+            _mm_storeu_ps(dots, HorizontalSum4AVX(half[0], half[1], half[2], half[3]));
+            L2SqrFromDots(dots, query_norms[r + m], norms + i, distances + (r + m) * n + i);
+          }
+        }
+        for (size_t m = 0; m < 4; m++)
+        {
+          L2SqrBlockKernelAVX512<DIM>(queries[r + m], query_norms[r + m], vectors + i * qty, norms + i, tile_end - i, qty, distances + (r + m) * n + i);
+        }
+      }
+      for (; r < n_queries; r++)
+      {
+        L2SqrBlockKernelAVX512<DIM>(queries[r], query_norms[r], vectors + t * qty, norms + t, tile_end - t, qty, distances + r * n + t);
+      }
+    }
+  }
+
+  /** 16 components widened to 16 bits. */
+  template <class T>
+  __attribute__((target("avx2"))) inline __m256i WidenBytesAVX2(const T *p)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    if constexpr (std::is_signed<T>::value)
+    {
+      return _mm256_cvtepi8_epi16(bytes);
+    }
+    else
+    {
+      return _mm256_cvtepu8_epi16(bytes);
+    }
+  }
+
+  template <size_t DIM, class T>
+  __attribute__((target("sse4.1"))) inline std::enable_if_t<sizeof(T) == 1, float> L2SqrKernelSSE4(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty16 = qty >> 4 << 4;
+
+    __m128i sum = _mm_setzero_si128();
+    for (size_t i = 0; i < qty16; i += 16)
+    {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i *)(pVect1 + i));
+      __m128i bytes2 = _mm_loadu_si128((const __m128i *)(pVect2 + i));
+      __m128i diff_lo, diff_hi;
+      if constexpr (std::is_signed<T>::value)
+      {
+        diff_lo = _mm_sub_epi16(_mm_cvtepi8_epi16(bytes1), _mm_cvtepi8_epi16(bytes2));
+        diff_hi = _mm_sub_epi16(_mm_cvtepi8_epi16(_mm_srli_si128(bytes1, 8)), _mm_cvtepi8_epi16(_mm_srli_si128(bytes2, 8)));
+      }
+      else
+      {
+        diff_lo = _mm_sub_epi16(_mm_cvtepu8_epi16(bytes1), _mm_cvtepu8_epi16(bytes2));
+        diff_hi = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(bytes1, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(bytes2, 8)));
+      }
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_lo, diff_lo));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_hi, diff_hi));
+    }
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    int res = _mm_cvtsi128_si32(sum);
+
+    for (size_t i = qty16; i < qty; i++)
+    {
+      int t = (int)pVect1[i] - (int)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  template <size_t DIM, class T>
+  __attribute__((target("avx2"))) inline std::enable_if_t<sizeof(T) == 1, float> L2SqrKernelAVX2(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty32 = qty >> 5 << 5;
+    const size_t qty16 = qty >> 4 << 4;
+
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i < qty32; i += 32)
+    {
+      __m256i diff1 = _mm256_sub_epi16(WidenBytesAVX2(pVect1 + i), WidenBytesAVX2(pVect2 + i));
+      __m256i diff2 = _mm256_sub_epi16(WidenBytesAVX2(pVect1 + i + 16), WidenBytesAVX2(pVect2 + i + 16));
+      sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(diff1, diff1));
+      sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(diff2, diff2));
+    }
+    if (i < qty16)
+    {
+      __m256i diff = _mm256_sub_epi16(WidenBytesAVX2(pVect1 + i), WidenBytesAVX2(pVect2 + i));
+      sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(diff, diff));
+    }
+    __m256i sum = _mm256_add_epi32(sum1, sum2);
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_hadd_epi32(sum128, sum128);
+    sum128 = _mm_hadd_epi32(sum128, sum128);
+    int res = _mm_cvtsi128_si32(sum128);
+
+    for (i = qty16; i < qty; i++)
+    {
+      int t = (int)pVect1[i] - (int)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /** Sum of all lanes, see FoldHalvesAVX512(). */
+  __attribute__((target("avx512f"))) inline int HorizontalSumAVX512(__m512i v)
+  {
+    __m256i sum = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, v, 0), _mm512_maskz_extracti64x4_epi64(0xFF, v, 1));
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_hadd_epi32(sum128, sum128);
+    sum128 = _mm_hadd_epi32(sum128, sum128);
+    return _mm_cvtsi128_si32(sum128);
+  }
+
+  /** 32 components widened to 16 bits. */
+  template <class T>
+  __attribute__((target("avx512f,avx512bw"))) inline __m512i WidenBytesAVX512(const T *p)
+  {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)p);
+    if constexpr (std::is_signed<T>::value)
+    {
+      return _mm512_cvtepi8_epi16(bytes);
+    }
+    else
+    {
+      return _mm512_cvtepu8_epi16(bytes);
+    }
+  }
+
+  template <size_t DIM, class T>
+  __attribute__((target("avx512f,avx512bw"))) inline std::enable_if_t<sizeof(T) == 1, float> L2SqrKernelAVX512(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty64 = qty >> 6 << 6;
+    const size_t qty32 = qty >> 5 << 5;
+
+    __m512i sum1 = _mm512_setzero_si512();
+    __m512i sum2 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i < qty64; i += 64)
+    {
+      __m512i diff1 = _mm512_sub_epi16(WidenBytesAVX512(pVect1 + i), WidenBytesAVX512(pVect2 + i));
+      __m512i diff2 = _mm512_sub_epi16(WidenBytesAVX512(pVect1 + i + 32), WidenBytesAVX512(pVect2 + i + 32));
+      sum1 = _mm512_add_epi32(sum1, _mm512_madd_epi16(diff1, diff1));
+      sum2 = _mm512_add_epi32(sum2, _mm512_madd_epi16(diff2, diff2));
+    }
+    if (i < qty32)
+    {
+      __m512i diff = _mm512_sub_epi16(WidenBytesAVX512(pVect1 + i), WidenBytesAVX512(pVect2 + i));
+      sum1 = _mm512_add_epi32(sum1, _mm512_madd_epi16(diff, diff));
+    }
+    int res = HorizontalSumAVX512(_mm512_add_epi32(sum1, sum2));
+
+    for (i = qty32; i < qty; i++)
+    {
+      int t = (int)pVect1[i] - (int)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /** Without F16C, half precision is widened by the scalar kernel. */
+  template <size_t DIM, class T>
+  inline std::enable_if_t<is_half_float<T>::value, float> L2SqrKernelSSE4(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    return L2SqrKernelScalar<DIM>(pVect1, pVect2, dim);
+  }
+
+  /** 8 components widened to float: fp16 with F16C, bf16 by shifting it into the upper half. */
+  template <class T>
+  __attribute__((target("avx2,f16c"))) inline __m256 WidenHalfAVX2(const T *p)
+  {
+    __m128i halves = _mm_loadu_si128((const __m128i *)p);
+    if constexpr (std::is_same<T, float16_t>::value)
+    {
+      return _mm256_cvtph_ps(halves);
+    }
+    else
+    {
+      return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(halves), 16));
+    }
+  }
+
+  template <size_t DIM, class T>
+  __attribute__((target("avx2,fma,f16c"))) inline std::enable_if_t<is_half_float<T>::value, float> L2SqrKernelAVX2(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty16 = qty >> 4 << 4;
+    const size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i < qty16; i += 16)
+    {
+      __m256 diff1 = _mm256_sub_ps(WidenHalfAVX2(pVect1 + i), WidenHalfAVX2(pVect2 + i));
+      __m256 diff2 = _mm256_sub_ps(WidenHalfAVX2(pVect1 + i + 8), WidenHalfAVX2(pVect2 + i + 8));
+      sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+      sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+    }
+    if (i < qty8)
+    {
+      __m256 diff = _mm256_sub_ps(WidenHalfAVX2(pVect1 + i), WidenHalfAVX2(pVect2 + i));
+      sum1 = _mm256_fmadd_ps(diff, diff, sum1);
+    }
+    __m256 sum = _mm256_add_ps(sum1, sum2);
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    float res = _mm_cvtss_f32(sum128);
+
+    for (i = qty8; i < qty; i++)
+    {
+      float t = (float)pVect1[i] - (float)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+
+  /** 16 components widened to float. Zero-masked for the same reason as FoldHalvesAVX512(). */
+  template <class T>
+  __attribute__((target("avx512f"))) inline __m512 WidenHalfAVX512(const T *p)
+  {
+    __m256i halves = _mm256_loadu_si256((const __m256i *)p);
+    if constexpr (std::is_same<T, float16_t>::value)
+    {
+      return _mm512_maskz_cvtph_ps(0xFFFF, halves);
+    }
+    else
+    {
+      return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, halves), 16));
+    }
+  }
+
+  template <size_t DIM, class T>
+  __attribute__((target("avx512f"))) inline std::enable_if_t<is_half_float<T>::value, float> L2SqrKernelAVX512(const T *pVect1, const T *pVect2, size_t dim)
+  {
+    const size_t qty = DIM != 0 ? DIM : dim;
+    const size_t qty32 = qty >> 5 << 5;
+    const size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i < qty32; i += 32)
+    {
+      __m512 diff1 = _mm512_sub_ps(WidenHalfAVX512(pVect1 + i), WidenHalfAVX512(pVect2 + i));
+      __m512 diff2 = _mm512_sub_ps(WidenHalfAVX512(pVect1 + i + 16), WidenHalfAVX512(pVect2 + i + 16));
+      sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+      sum2 = _mm512_fmadd_ps(diff2, diff2, sum2);
+    }
+    if (i < qty16)
+    {
+      __m512 diff = _mm512_sub_ps(WidenHalfAVX512(pVect1 + i), WidenHalfAVX512(pVect2 + i));
+      sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+    }
+    float res = HorizontalSumAVX512(_mm512_add_ps(sum1, sum2));
+
+    for (i = qty16; i < qty; i++)
+    {
+      float t = (float)pVect1[i] - (float)pVect2[i];
+      res += t * t;
+    }
+    return res;
+  }
+#endif
+
+} // namespace ann_dkvs
@@ -1,10 +1,7 @@
 #pragma once
 
-#ifdef __AVX__
-#include <immintrin.h>
-#endif
-
 #include "storage-node/types.hpp"
+#include "L2Kernels.hpp"
 
 #define PORTABLE_ALIGN32 __attribute__((aligned(32)))
 
@@ -15,8 +12,8 @@ namespace ann_dkvs
       const void *pVect2v,
       const void *qty_ptr)
   {
-    float *pVect1 = (float *)pVect1v;
-    float *pVect2 = (float *)pVect2v;
+    vector_el_t *pVect1 = (vector_el_t *)pVect1v;
+    vector_el_t *pVect2 = (vector_el_t *)pVect2v;
     size_t qty = *((size_t *)qty_ptr);
 
     float res = 0;
@@ -30,67 +27,237 @@ namespace ann_dkvs
     return (res);
   }
 
-#ifdef __AVX__
-  static inline float L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
-  {
-    float *pVect1 = (float *)pVect1v;
-    float *pVect2 = (float *)pVect2v;
-    size_t qty = *((size_t *)qty_ptr);
-    float PORTABLE_ALIGN32 TmpRes[8];
-    size_t qty16 = qty >> 4;
-
-    const float *pEnd1 = pVect1 + (qty16 << 4);
-
-    __m256 diff, v1, v2;
-    __m256 sum = _mm256_set1_ps(0);
+#if defined(__x86_64__) || defined(__i386__)
+  /**
+   * SIMD kernels of L2Sqr for any dimension, compiled for their instruction set regardless of the compiler flags.
+   * They must only be called on CPUs which support it, L2Space selects the widest one at runtime.
+   */
+  float L2SqrSSE4(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float L2SqrAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+  float L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr);
+#endif
 
-    while (pVect1 < pEnd1)
+  /** Squared norms of n contiguous vectors, stored alongside the lists for the block kernels. */
+  static inline void L2SqrNorms(const vector_el_t *vectors, len_t n, size_t vector_dim, distance_t *norms)
+  {
+    for (len_t i = 0; i < n; i++)
     {
-      v1 = _mm256_loadu_ps(pVect1);
-      pVect1 += 8;
-      v2 = _mm256_loadu_ps(pVect2);
-      pVect2 += 8;
-      diff = _mm256_sub_ps(v1, v2);
-      sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
-
-      v1 = _mm256_loadu_ps(pVect1);
-      pVect1 += 8;
-      v2 = _mm256_loadu_ps(pVect2);
-      pVect2 += 8;
-      diff = _mm256_sub_ps(v1, v2);
-      sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+      /** Summed in double, the norms are computed once and every distance inherits their rounding. */
+      const vector_el_t *vector = vectors + i * vector_dim;
+      double norm = 0;
+      for (size_t j = 0; j < vector_dim; j++)
+      {
+        norm += (double)vector[j] * vector[j];
+      }
+      norms[i] = norm;
     }
-
-    _mm256_store_ps(TmpRes, sum);
-    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
   }
 
-  static inline float L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
-  {
-    size_t qty = *((size_t *)qty_ptr);
-    size_t qty16 = qty >> 4 << 4;
-    float res = L2SqrSIMD16ExtAVX(pVect1v, pVect2v, &qty16);
-    float *pVect1 = (float *)pVect1v + qty16;
-    float *pVect2 = (float *)pVect2v + qty16;
-
-    size_t qty_left = qty - qty16;
-    float res_tail = L2Sqr(pVect1, pVect2, &qty_left);
-    return (res + res_tail);
-  }
+  using distance_func_t = distance_t (*)(const void *, const void *, const void *);
 
-#endif
+  /**
+   * Computes the distances from a query to n contiguous vectors of dimension dim,
+   * given the squared norm of the query and of every vector (see L2SqrNorms()).
+   */
+  using distance_block_func_t = void (*)(const vector_el_t *query, distance_t query_norm, const vector_el_t *vectors,
+                                         const distance_t *norms, len_t n, size_t dim, distance_t *distances);
+
+  /** Instruction sets of the L2 kernels, from the narrowest to the widest. */
+  enum class SimdLevel
+  {
+    SCALAR,
+    SSE4,
+    AVX2,
+    AVX512
+  };
 
-  using distance_func_t = distance_t (*)(const void *, const void *, const void *);
   class L2Space
   {
   private:
     size_t vector_dim;
     distance_func_t distance_func;
+    distance_block_func_t distance_block_func;
 
   public:
     L2Space(size_t vector_dim);
     distance_func_t get_distance_func() const;
+    /** The block kernel of the SIMD level of this CPU. */
+    distance_block_func_t get_distance_block_func() const;
     size_t get_vector_dim() const;
+
+    /**
+     * The widest instruction set supported by this CPU, detected once.
+     * It can be capped with the environment variable ANN_DKVS_SIMD=scalar|sse4|avx2|avx512.
+     */
+    static SimdLevel get_simd_level();
+    static const char *get_simd_level_name(SimdLevel level);
+  };
+
+
+  /** Distance of a dimension known at compile time (DIM), or at runtime if DIM is 0, with the kernel of LEVEL. */
+  template <size_t DIM, SimdLevel LEVEL>
+  struct L2Distance
+  {
+    static constexpr size_t dimension = DIM;
+
+    static inline distance_t compute(const vector_el_t *pVect1, const vector_el_t *pVect2, size_t dim)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      if constexpr (LEVEL == SimdLevel::AVX512)
+      {
+        return L2SqrKernelAVX512<DIM>(pVect1, pVect2, dim);
+      }
+      else if constexpr (LEVEL == SimdLevel::AVX2)
+      {
+        return L2SqrKernelAVX2<DIM>(pVect1, pVect2, dim);
+      }
+      else if constexpr (LEVEL == SimdLevel::SSE4)
+      {
+        return L2SqrKernelSSE4<DIM>(pVect1, pVect2, dim);
+      }
+#endif
+      return L2SqrKernelScalar<DIM>(pVect1, pVect2, dim);
+    }
+
+    static inline void compute_block(const vector_el_t *query, distance_t query_norm, const vector_el_t *vectors,
+                                     const distance_t *norms, len_t n, size_t dim, distance_t *distances)
+    {
+      if constexpr (!std::is_same<vector_el_t, float>::value)
+      {
+        /** The norms are only stored for float components, the others are compared directly. */
+        const size_t qty = DIM != 0 ? DIM : dim;
+        for (len_t i = 0; i < n; i++)
+        {
+          distances[i] = compute(vectors + i * qty, query, qty);
+        }
+        return;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      else if constexpr (LEVEL == SimdLevel::AVX512)
+      {
+        return L2SqrBlockKernelAVX512<DIM>(query, query_norm, vectors, norms, n, dim, distances);
+      }
+      else if constexpr (LEVEL == SimdLevel::AVX2)
+      {
+        return L2SqrBlockKernelAVX2<DIM>(query, query_norm, vectors, norms, n, dim, distances);
+      }
+      else if constexpr (LEVEL == SimdLevel::SSE4)
+      {
+        return L2SqrBlockKernelSSE4<DIM>(query, query_norm, vectors, norms, n, dim, distances);
+      }
+#endif
+      else
+      {
+        return L2SqrBlockKernelScalar<DIM>(query, query_norm, vectors, norms, n, dim, distances);
+      }
+    }
+
+    /** Distances of n_queries queries to n vectors, row r of distances (n wide) for query r. */
+    static inline void compute_matrix(const vector_el_t *const *queries, const distance_t *query_norms, len_t n_queries,
+                                      const vector_el_t *vectors, const distance_t *norms, len_t n, size_t dim, distance_t *distances)
+    {
+      if constexpr (!std::is_same<vector_el_t, float>::value)
+      {
+        const size_t qty = DIM != 0 ? DIM : dim;
+        const size_t tile = L2SqrMatrixTileLength(qty, sizeof(vector_el_t));
+        for (len_t t = 0; t < n; t += tile)
+        {
+          len_t tile_n = n - t < tile ? n - t : tile;
+          for (len_t r = 0; r < n_queries; r++)
+          {
+            compute_block(queries[r], query_norms[r], vectors + t * qty, norms, tile_n, qty, distances + r * n + t);
+          }
+        }
+        return;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      else if constexpr (LEVEL == SimdLevel::AVX512)
+      {
+        return L2SqrMatrixKernelAVX512<DIM>(queries, query_norms, n_queries, vectors, norms, n, dim, distances);
+      }
+      else if constexpr (LEVEL == SimdLevel::AVX2)
+      {
+        return L2SqrMatrixKernelAVX2<DIM>(queries, query_norms, n_queries, vectors, norms, n, dim, distances);
+      }
+      else if constexpr (LEVEL == SimdLevel::SSE4)
+      {
+        return L2SqrMatrixKernelSSE4<DIM>(queries, query_norms, n_queries, vectors, norms, n, dim, distances);
+      }
+#endif
+      else
+      {
+        return L2SqrMatrixKernelScalar<DIM>(queries, query_norms, n_queries, vectors, norms, n, dim, distances);
+      }
+    }
   };
 
-} // namespace ann_dkvs
\ No newline at end of file
+  template <SimdLevel LEVEL, class Func>
+  inline void dispatch_l2_dimension(size_t vector_dim, Func &&func)
+  {
+    switch (vector_dim)
+    {
+    case 96:
+      return func(L2Distance<96, LEVEL>());
+    case 100:
+      return func(L2Distance<100, LEVEL>());
+    case 128:
+      return func(L2Distance<128, LEVEL>());
+    case 256:
+      return func(L2Distance<256, LEVEL>());
+    case 768:
+      return func(L2Distance<768, LEVEL>());
+    case 960:
+      return func(L2Distance<960, LEVEL>());
+    default:
+      return func(L2Distance<0, LEVEL>());
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  /**
+   * The loops of func are compiled for the instruction set of the kernels here, and everything they call is inlined
+   * (flatten), so the kernels are inlined into the loops and the accumulators stay in registers.
+   */
+  template <class Func>
+  __attribute__((target(L2_AVX512_TARGET), flatten)) inline void dispatch_l2_avx512(size_t vector_dim, Func &&func)
+  {
+    dispatch_l2_dimension<SimdLevel::AVX512>(vector_dim, func);
+  }
+
+  template <class Func>
+  __attribute__((target(L2_AVX2_TARGET), flatten)) inline void dispatch_l2_avx2(size_t vector_dim, Func &&func)
+  {
+    dispatch_l2_dimension<SimdLevel::AVX2>(vector_dim, func);
+  }
+
+  template <class Func>
+  __attribute__((target("sse4.1"), flatten)) inline void dispatch_l2_sse4(size_t vector_dim, Func &&func)
+  {
+    dispatch_l2_dimension<SimdLevel::SSE4>(vector_dim, func);
+  }
+#endif
+
+  /**
+   * Calls func with the L2Distance specialized for the dimension and the SIMD level of this CPU.
+   * The loop in func is instantiated for every specialization, so its distance calls are direct and
+   * see the dimension as a constant, instead of going through a distance_func_t.
+   */
+  template <class Func>
+  inline void dispatch_l2(size_t vector_dim, Func &&func)
+  {
+    switch (L2Space::get_simd_level())
+    {
+#if defined(__x86_64__) || defined(__i386__)
+    case SimdLevel::AVX512:
+      return dispatch_l2_avx512(vector_dim, func);
+    case SimdLevel::AVX2:
+      return dispatch_l2_avx2(vector_dim, func);
+    case SimdLevel::SSE4:
+      return dispatch_l2_sse4(vector_dim, func);
+#endif
+    default:
+      return dispatch_l2_dimension<SimdLevel::SCALAR>(vector_dim, func);
+    }
+  }
+
+} // namespace ann_dkvs
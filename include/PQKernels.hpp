@@ -0,0 +1,102 @@
+#pragma once
+
+#include "storage-node/types.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/** Number of vectors whose 4-bit codes are interleaved into one block of the fast-scan layout. */
+#define PQ_FAST_SCAN_BLOCK_SIZE 32
+
+namespace ann_dkvs
+{
+  /**
+   * Fast-scan kernels of 4-bit product quantization codes (see PQLists).
+   *
+   * A block holds the codes of PQ_FAST_SCAN_BLOCK_SIZE vectors, 16 bytes per subquantizer m:
+   * byte j holds the code of vector j in its low nibble and the code of vector j + 16 in its high nibble.
+   * The distance table of a query is quantized to one byte per entry, so the 16 entries of a subquantizer fit into
+   * one 128-bit register and pshufb looks up the entries of 16 vectors at once. The entries are summed in saturating
+   * 16-bit lanes, which cannot overflow for up to 257 subquantizers.
+   *
+   * @param codes A block, 16 * n_subquantizers bytes.
+   * @param table The quantized distance table, 16 bytes per subquantizer.
+   * @param n_subquantizers The number of subquantizers, even.
+   * @param distances The quantized distances of the PQ_FAST_SCAN_BLOCK_SIZE vectors of the block.
+   */
+  inline void PQFastScanKernelScalar(const uint8_t *codes, const uint8_t *table, size_t n_subquantizers, uint16_t *distances)
+  {
+    for (size_t j = 0; j < PQ_FAST_SCAN_BLOCK_SIZE; j++)
+    {
+      distances[j] = 0;
+    }
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      const uint8_t *block = codes + m * 16;
+      const uint8_t *entries = table + m * 16;
+      for (size_t j = 0; j < 16; j++)
+      {
+        distances[j] += entries[block[j] & 0x0f];
+        distances[j + 16] += entries[block[j] >> 4];
+      }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  /** One subquantizer per pshufb. */
+  __attribute__((target("ssse3"))) inline void PQFastScanKernelSSSE3(const uint8_t *codes, const uint8_t *table, size_t n_subquantizers, uint16_t *distances)
+  {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = _mm_setzero_si128();
+    __m128i sum1 = _mm_setzero_si128();
+    __m128i sum2 = _mm_setzero_si128();
+    __m128i sum3 = _mm_setzero_si128();
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)(codes + m * 16));
+      __m128i entries = _mm_loadu_si128((const __m128i *)(table + m * 16));
+      __m128i low = _mm_shuffle_epi8(entries, _mm_and_si128(block, low_mask));
+      __m128i high = _mm_shuffle_epi8(entries, _mm_and_si128(_mm_srli_epi16(block, 4), low_mask));
+      sum0 = _mm_adds_epu16(sum0, _mm_unpacklo_epi8(low, zero));
+      sum1 = _mm_adds_epu16(sum1, _mm_unpackhi_epi8(low, zero));
+      sum2 = _mm_adds_epu16(sum2, _mm_unpacklo_epi8(high, zero));
+      sum3 = _mm_adds_epu16(sum3, _mm_unpackhi_epi8(high, zero));
+    }
+    _mm_storeu_si128((__m128i *)distances, sum0);
+    _mm_storeu_si128((__m128i *)(distances + 8), sum1);
+    _mm_storeu_si128((__m128i *)(distances + 16), sum2);
+    _mm_storeu_si128((__m128i *)(distances + 24), sum3);
+  }
+
+  /**
+   * Two subquantizers per vpshufb: the 128-bit lanes hold subquantizers m and m + 1, whose codes and table entries
+   * are adjacent, so both are loaded at once. The lanes are added at the end.
+   */
+  __attribute__((target("avx2"))) inline void PQFastScanKernelAVX2(const uint8_t *codes, const uint8_t *table, size_t n_subquantizers, uint16_t *distances)
+  {
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    __m256i sum3 = _mm256_setzero_si256();
+    for (size_t m = 0; m < n_subquantizers; m += 2)
+    {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(codes + m * 16));
+      __m256i entries = _mm256_loadu_si256((const __m256i *)(table + m * 16));
+      __m256i low = _mm256_shuffle_epi8(entries, _mm256_and_si256(block, low_mask));
+      __m256i high = _mm256_shuffle_epi8(entries, _mm256_and_si256(_mm256_srli_epi16(block, 4), low_mask));
+      sum0 = _mm256_adds_epu16(sum0, _mm256_unpacklo_epi8(low, zero));
+      sum1 = _mm256_adds_epu16(sum1, _mm256_unpackhi_epi8(low, zero));
+      sum2 = _mm256_adds_epu16(sum2, _mm256_unpacklo_epi8(high, zero));
+      sum3 = _mm256_adds_epu16(sum3, _mm256_unpackhi_epi8(high, zero));
+    }
+    _mm_storeu_si128((__m128i *)distances, _mm_adds_epu16(_mm256_castsi256_si128(sum0), _mm256_extracti128_si256(sum0, 1)));
+    _mm_storeu_si128((__m128i *)(distances + 8), _mm_adds_epu16(_mm256_castsi256_si128(sum1), _mm256_extracti128_si256(sum1, 1)));
+    _mm_storeu_si128((__m128i *)(distances + 16), _mm_adds_epu16(_mm256_castsi256_si128(sum2), _mm256_extracti128_si256(sum2, 1)));
+    _mm_storeu_si128((__m128i *)(distances + 24), _mm_adds_epu16(_mm256_castsi256_si128(sum3), _mm256_extracti128_si256(sum3, 1)));
+  }
+#endif
+}
@@ -11,6 +11,8 @@ namespace ann_dkvs
   private:
     vector_el_t *query_vector;
     list_id_t *list_to_probe;
+    /** Squared distances of the query to the centroids of the lists to probe, negative if unknown. */
+    std::vector<distance_t> probe_distances;
     const len_t n_results;
     const len_t n_probes;
     bool free_list_to_probe = false;
@@ -23,6 +25,8 @@ namespace ann_dkvs
     len_t get_n_results() const;
     len_t get_n_probe() const;
     void set_list_to_probe(const len_t offset, const list_id_t list_id) const;
+    distance_t get_probe_distance(const len_t i) const;
+    void set_probe_distance(const len_t offset, const distance_t distance);
     ~Query();
   };
 
@@ -0,0 +1,77 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../storage-node/types.hpp"
+
+#define TRACE_BUFFER_SIZE 65536
+/** "BPMTRACE" in little endian. */
+#define TRACE_MAGIC 0x45434152544d5042ULL
+/** Number of indexes whose list keys fit into the 32-bit list id of a TraceRecord. */
+#define TRACE_MAX_INDEX_NUM 256
+
+namespace ann_dkvs {
+/**
+ * A single FetchListPages() call in an access trace, 16 bytes in the trace file.
+*/
+struct TraceRecord {
+    uint32_t list_id;
+    uint32_t page_num;
+    /** Nanoseconds since the trace was started. */
+    uint64_t timestamp_ns;
+};
+
+/**
+ * Header at the start of a trace file.
+*/
+struct TraceHeader {
+    uint64_t magic = TRACE_MAGIC;
+    /** One bit per index id, set if the lists file of the index stores the squared norms of the vectors. */
+    uint64_t norms_indexes[TRACE_MAX_INDEX_NUM / 64] = {};
+
+    auto HasNorms(size_t index_id) const -> bool { return (norms_indexes[index_id / 64] >> (index_id % 64)) & 1; }
+    void SetNorms(size_t index_id) { norms_indexes[index_id / 64] |= 1ULL << (index_id % 64); }
+};
+
+/**
+ * TraceRecorder logs list accesses of the buffer pool into a binary file of a TraceHeader followed by TraceRecords.
+ * Records are buffered in memory and written in chunks of TRACE_BUFFER_SIZE records.
+*/
+class TraceRecorder {
+    public:
+        /**
+         * Create a new TraceRecorder which truncates the file and writes the header to it.
+        */
+        TraceRecorder(const std::string& filename, const TraceHeader& header);
+        /** Flush the buffered records and close the file. */
+        ~TraceRecorder();
+
+        /** Append an access to the trace. */
+        void Record(list_id_t list_id, int page_num);
+
+        /** Write the buffered records to the file. */
+        void Flush();
+
+        auto IsOpen() -> bool { return trace_file_ != nullptr; }
+
+    private:
+        FILE* trace_file_;
+        std::vector<TraceRecord> buffer_;
+        std::chrono::steady_clock::time_point start_time_;
+        /** Latch */
+        std::mutex latch_;
+
+        void FlushInternal();
+};
+
+/**
+ * Read all records of a trace file written by TraceRecorder.
+ * @param header If not nullptr, receives the header of the trace.
+ * @throws std::runtime_error if the file cannot be opened or has no valid header.
+*/
+auto ReadTrace(const std::string& filename, TraceHeader* header = nullptr) -> std::vector<TraceRecord>;
+
+}
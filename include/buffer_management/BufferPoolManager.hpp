@@ -1,7 +1,14 @@
 #pragma once
 #include <list>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 // #include <fstream>
 #include <fcntl.h>
@@ -10,67 +17,383 @@
 
 #include "ClockReplacer.hpp"
 #include "Page.hpp"
+#include "SecondaryCache.hpp"
+#include "MissRatioCurve.hpp"
+#include "BufferPoolStats.hpp"
+#include "AccessTrace.hpp"
+#include "IoScheduler.hpp"
+#include "ListView.hpp"
 #include "../storage-node/types.hpp"
 #include "../storage-node/StorageLists.hpp"
 
+/**
+ * Lists of several indexes share the hash tables of the pool under a key which holds the index id
+ * above this bit and the list id below it. The keys of index 0 are the list ids themselves,
+ * and the keys of the first 256 indexes fit into the 32 bits of a TraceRecord.
+*/
+#define LIST_KEY_INDEX_SHIFT 24
+#define MAX_INDEX_NUM 256
+
 namespace ann_dkvs {
 class BufferPoolManager {
     public: 
-        int total = 0;
-        int hit = 0;
-        
-        BufferPoolManager(size_t pool_size, const StorageLists* list, std::string filename);
+        /**
+         * @param secondary_cache is an optional spill tier on a fast local device.
+         * Lists evicted from the pool are written into it and misses are served from it first.
+         * It is owned by the caller.
+        */
+        BufferPoolManager(size_t pool_size, const StorageLists* list, std::string filename, SecondaryCache* secondary_cache = nullptr);
         ~BufferPoolManager();
 
+        /**
+         * Serve the lists of another lists file from the same frames. The lists given to the constructor are index 0.
+         * Must be called before the pool is shared among threads.
+         * @param min_frames is the number of frames the index keeps against the other indexes:
+         * its lists are only evicted for another index below this number if no other list can be.
+         * @param max_frames is the number of frames above which a miss of the index evicts its own lists first.
+         * Both quotas are soft, they are not enforced while the lists they would evict are pinned.
+         * @return the id of the new index, or -1 if the minimum quotas of all indexes exceed the pool.
+        */
+        auto RegisterIndex(const StorageLists* lists, size_t min_frames = 0, size_t max_frames = SIZE_MAX) -> index_id_t;
+        /** Change the quotas of a registered index, see RegisterIndex(). */
+        auto SetIndexQuota(index_id_t index_id, size_t min_frames, size_t max_frames) -> bool;
+
         /**
          * Return the ids of frames / pages in the buffer pool, which store the content of the list.
+         * Safe to call from several threads: the I/O of a miss is done without holding the latch,
+         * and concurrent misses on the same list wait for the first one, so every list is read once.
+         * Lists modified in the StorageLists since they were cached are read again.
         */
-        auto FetchListPages(list_id_t list_id) -> std::vector<frame_id_t>;
+        auto FetchListPages(list_id_t list_id) -> std::vector<frame_id_t> { return FetchListPages(0, list_id); }
+        /** Same as FetchListPages() for a list of a registered index. */
+        auto FetchListPages(index_id_t index_id, list_id_t list_id) -> std::vector<frame_id_t>;
         /**
          * Unpin the page / frame.
         */
-        auto UnPinListPages(list_id_t list_id) -> bool;
+        auto UnPinListPages(list_id_t list_id) -> bool { return UnPinListPages(0, list_id); }
+        auto UnPinListPages(index_id_t index_id, list_id_t list_id) -> bool;
+
+        /**
+         * Return the statistics of the buffer pool aggregated over all threads
+         * (hits, misses, evictions, I/O, latency histograms, per-list hits and misses of index 0, per-index hits and quotas).
+        */
+        auto GetStats() -> BufferPoolStatsSnapshot;
+
+        /**
+         * Log every FetchListPages() call (list id, page count, timestamp) into a binary trace file,
+         * which can be replayed by simulate_bpm.
+        */
+        void StartTrace(const std::string& filename);
+        /** Flush and close the trace file. */
+        void StopTrace();
+
+        auto GetPageVectors(frame_id_t frame_id) -> vector_el_t* { return pages_[frame_id]->GetVectors(); }
+
+        auto GetPageIDs(frame_id_t frame_id) -> vector_id_t* { return pages_[frame_id]->GetIDs(); }
+
+        /**
+         * Change the number of frames in the buffer pool at runtime.
+         * Growing maps new frames at the end of the pool.
+         * Shrinking evicts the lists in the released frames and gives their memory back to the OS,
+         * it fails (and changes nothing) if any of these lists is pinned.
+         * @return true if the pool has the new size.
+        */
+        auto Resize(size_t pool_size) -> bool;
+
+        /**
+         * Set the memory budget of the buffer pool in bytes, rounded down to whole frames.
+         * @return true if the pool has been resized to the budget.
+        */
+        auto SetMemoryBudget(size_t budget_bytes) -> bool { return Resize(budget_bytes / FrameBytes()); }
+
+        /** Return the memory used by the frames of the buffer pool in bytes. */
+        auto GetMemoryBudget() -> size_t { return pool_size_ * FrameBytes(); }
+
+        auto GetPoolSize() -> size_t { return pool_size_; }
+
+        /**
+         * Start to estimate the miss ratio curve of the list accesses (see MissRatioCurve).
+         * @param sampling_rate is the fraction of lists which are tracked.
+         * @param bucket_size is the granularity of the curve in frames.
+        */
+        void EnableMissRatioCurve(double sampling_rate, size_t bucket_size);
+
+        /**
+         * Return the expected hit ratio if the pool held the given number of frames.
+         * Returns 0 if the miss ratio curve is not enabled.
+        */
+        auto GetExpectedHitRatio(size_t pool_size) -> double;
+
+        /**
+         * Resize the pool to the smallest size which is expected to reach the target hit ratio,
+         * but to at most max_pool_size frames.
+         * @return the new pool size, or the current one if the curve is not enabled or resizing failed.
+        */
+        auto ResizeForHitRatio(double hit_ratio, size_t max_pool_size) -> size_t;
+
+        /**
+         * Write the heat map, i.e. the lists resident in the pool with their access frequencies, to a file.
+        */
+        void SaveHeatMap(const std::string& filename);
+
+        /**
+         * Save the heat map to the file every interval_seconds in a background thread, until StopHeatMapSnapshots().
+        */
+        void StartHeatMapSnapshots(const std::string& filename, size_t interval_seconds);
+        void StopHeatMapSnapshots();
+
+        /**
+         * Load the hottest lists of a heat map saved by a previous run into the free frames, in the background.
+         * Lists are read in the order of their offsets in the lists file, split among thread_num threads,
+         * and queries can be served meanwhile.
+        */
+        void StartWarmUp(const std::string& filename, int thread_num);
+        /** Wait until the warm-up started by StartWarmUp() is finished. */
+        void WaitForWarmUp();
+
+        /**
+         * Load the list into free frames without pinning it. Never evicts other lists.
+         * The I/O is done without holding the latch.
+         * @return true if the list has been loaded by this call.
+        */
+        auto PrefetchList(list_id_t list_id) -> bool { return PrefetchList(0, list_id); }
+        /** Same as PrefetchList() for a list of a registered index. Never loads beyond the maximum quota of the index. */
+        auto PrefetchList(index_id_t index_id, list_id_t list_id) -> bool;
+
+        /**
+         * Read the lists files through an IoScheduler each, which merges the reads of concurrent misses
+         * (and of the warm-up threads) on neighbouring lists into large requests.
+         * Applies to all indexes, also to the ones registered later.
+         * Must be called before the pool is shared among threads.
+         * @param max_read_bytes is the largest size of a merged read.
+         * @param max_gap_bytes is the largest hole between two merged reads, which is read and dropped.
+         * @param max_batches is the largest number of merged batches read at the same time per lists file.
+        */
+        void EnableIoScheduler(size_t max_read_bytes, size_t max_gap_bytes, size_t max_batches);
 
-        auto GetPageVectors(frame_id_t frame_id) -> vector_el_t* { return pages_[frame_id].GetVectors(); }
+        /**
+         * Let the pool take appends to lists (see AppendEntries()) and write them back to the lists file.
+         * Must be called before the pool is shared among threads.
+         * @param lists is the StorageLists of an index of the pool, through which the new lengths are published.
+         * @param flush_interval_ms is the period of the background flusher, 0 to flush only on eviction and FlushDirtyFrames().
+        */
+        void EnableWriteBack(StorageLists* lists, size_t flush_interval_ms);
+
+        /**
+         * Append entries to a list. If the list is in the pool and the entries fit into its last frame
+         * and into the space allocated for the list in the file, they are written into the frame,
+         * which is written back to the file later. The new length is published in the StorageLists right away,
+         * so the file lags behind until the frame is flushed.
+         * Otherwise the unflushed appends of the list are written back, and the entries are inserted
+         * through StorageLists::insert_entries(), which may relocate the list.
+         * All mutations of a list must go through the pool while write-back is enabled.
+         * @return true if the entries have been appended in the pool.
+        */
+        auto AppendEntries(list_id_t list_id, const vector_el_t* vectors, const vector_id_t* ids, len_t n_entries) -> bool {
+            return AppendEntries(0, list_id, vectors, ids, n_entries);
+        }
+        auto AppendEntries(index_id_t index_id, list_id_t list_id, const vector_el_t* vectors, const vector_id_t* ids, len_t n_entries) -> bool;
+
+        /** Write all dirty frames back to the lists file, in file offset order. */
+        void FlushDirtyFrames();
+
+        /**
+         * Map every resident list of more than one frame into a window in which its vectors are virtually contiguous,
+         * so that FetchListView() returns them as one span. The frames live in a memfd arena and a window maps
+         * the vectors of each frame of the list from the arena, so nothing is copied.
+         * A window takes one memory mapping per frame (see vm.max_map_count).
+         * Must be called before the pool is shared among threads.
+         * @return false if the vectors of a frame are not a multiple of the system page size, then views stay disabled.
+        */
+        auto EnableListViews() -> bool;
+
+        /**
+         * Same as FetchListPages(), but return the list as a ListView, with all vectors in one span
+         * if list views are enabled. Unpin it with UnPinListPages().
+        */
+        auto FetchListView(list_id_t list_id) -> ListView { return FetchListView(0, list_id); }
+        auto FetchListView(index_id_t index_id, list_id_t list_id) -> ListView;
 
-        auto GetPageIDs(frame_id_t frame_id) -> vector_id_t* { return pages_[frame_id].GetIDs(); }
+        /**
+         * Same as FetchListView() if the list is resident in the pool (and not being loaded), counted as a hit.
+         * Otherwise nothing is read and the list stays out of the pool.
+         * @return false if the list is not resident.
+        */
+        auto FetchResidentListView(list_id_t list_id, ListView* view) -> bool { return FetchResidentListView(0, list_id, view); }
+        auto FetchResidentListView(index_id_t index_id, list_id_t list_id, ListView* view) -> bool;
+
+        /**
+         * Read the vector and the id of one entry of a list from the lists file with pread(), without loading the list,
+         * e.g. to re-rank a few candidates of a list which is not resident.
+         * @return false if the entry is beyond the end of the list or cannot be read.
+        */
+        auto ReadEntry(list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) -> bool { return ReadEntry(0, list_id, offset, vector, id); }
+        auto ReadEntry(index_id_t index_id, list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) -> bool;
+
+        /** Return the memory occupied by a single frame in bytes. */
+        static auto FrameBytes() -> size_t { return sizeof(Page); }
 
     private:
+        /** A lists file served by the pool. */
+        struct IndexInfo {
+            /** Directory of the lists file. */
+            const StorageLists* lists;
+            /** Version of the directory when all cached locations were last known to be up to date. */
+            uint64_t directory_version;
+            /** Base pointer of the file on disk. */
+            int db_io;
+            /** Scheduler of the reads of the lists file, nullptr if every frame is read on its own. */
+            IoScheduler* io_scheduler = nullptr;
+            /** Lists which take the new lengths of appended lists, nullptr if write-back is disabled. */
+            StorageLists* writable_lists = nullptr;
+            /** File descriptor to write dirty frames back to the lists file. */
+            int write_io = -1;
+            /** Quotas in frames, see RegisterIndex(). */
+            size_t min_frames = 0;
+            size_t max_frames = SIZE_MAX;
+            /** Frames held by the lists of the index, including the ones being loaded. */
+            size_t used_frames = 0;
+            /** Hits and misses of the index, counted under the latch. */
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+        };
+
         /** Number of pages in the buffer. */
-        const size_t pool_size_;
-        /** Array of pages in the buffer pool.  */
-        Page* pages_;
-        /** Hash from list id to the first frame id. */
+        size_t pool_size_;
+        /** Memory file holding the frames, frame i at offset i * page_stride_. */
+        int arena_fd_;
+        /** Size of a frame in the arena, rounded up to the system page size. */
+        size_t page_stride_;
+        size_t arena_size_ = 0;
+        /** Address of frame 0, the other frames are mapped behind it if possible. */
+        char* arena_base_ = nullptr;
+        /** Whether resident lists are mapped into windows, see EnableListViews(). */
+        bool list_views_ = false;
+        /** Hash from the first frame of a list of more than one frame to the window of its vectors. */
+        std::unordered_map<frame_id_t, vector_el_t*> hash_to_window_;
+        /**
+         * Array of pages in the buffer pool. Each page is mapped on its own, so it can be released when the pool shrinks.
+         * The array itself is replaced when the pool grows beyond its capacity.
+         */
+        std::atomic<Page**> pages_;
+        /** Number of entries of the pages_ array. */
+        size_t pages_capacity_;
+        /** Arrays replaced by a larger one, freed in the destructor. */
+        std::vector<Page**> retired_pages_;
+        /** Indexes served by the pool, indexed by index id. Only grows before the pool is shared. */
+        std::vector<IndexInfo> indexes_;
+        /** Parameters of the IoSchedulers, max_read_bytes is 0 if they are disabled. */
+        size_t io_max_read_bytes_ = 0;
+        size_t io_max_gap_bytes_ = 0;
+        size_t io_max_batches_ = 0;
+        /** Hash from list key to the version of the list whose location is cached. */
+        std::unordered_map<list_id_t, uint64_t> hash_to_list_version_;
+        /** Hash from list key (see ListKey()) to the first frame id. */
         std::unordered_map<list_id_t, frame_id_t> hash_to_buffer_pages_;
         /** Hash from list id to disk address (of vectors and ids). */
         std::unordered_map<list_id_t, std::pair<size_t, size_t> > hash_to_disk_vectors_;
+        /** Hash from list id to disk address of the norms, 0 if the lists file does not store them. */
+        std::unordered_map<list_id_t, size_t> hash_to_disk_norms_;
         /** Hash from list id to list length. (length represents how many vectors it contains) */
         std::unordered_map<list_id_t, int> hash_to_list_size_;
         /** Replacer to find unpinned pages to replace. */
         ClockReplacer* replacer_;
         /** Point out whether the frame is free or not. */
         std::vector<bool> free_list_;
-        /** Base pointer of the file on disk. */
-        // std::fstream db_io_;
-        int db_io_;
+        /**
+         * Lists which are being loaded, with a future that is ready when the load is finished.
+         * Only one thread reads a list, the others wait on the future (single-flight).
+         */
+        std::unordered_map<list_id_t, std::shared_future<void> > in_flight_;
+        /** Notified when frames become evictable (unpinned, prefetched) or free (pool grown). */
+        std::condition_variable unpin_cv_;
+        /** Hash from list id to how many times it has been fetched. */
+        std::unordered_map<list_id_t, size_t> hash_to_access_times_;
+        /** Background thread which saves heat map snapshots. */
+        std::thread snapshot_thread_;
+        /** Set to stop the snapshot thread. */
+        bool snapshot_stop_ = false;
+        std::mutex snapshot_latch_;
+        std::condition_variable snapshot_cv_;
+        /** Background thread of the warm-up loader. */
+        std::thread warmup_thread_;
+        /** Optional secondary cache tier, nullptr if disabled. */
+        SecondaryCache* secondary_cache_;
+        /** An evicted list copied out of its frames, whose slots in the secondary cache are reserved. */
+        struct SpilledList {
+            list_id_t list_id;
+            std::vector<size_t> slots;
+            std::vector<char> frames;
+        };
+        /** Evicted lists to be written to the secondary cache once the latch is released. */
+        std::vector<SpilledList> pending_spills_;
+        /** Per-thread statistics. */
+        BufferPoolStats stats_;
+        /** Recorder of the access trace, nullptr if disabled. */
+        TraceRecorder* trace_ = nullptr;
+        /** Online miss ratio curve of the list accesses, nullptr if disabled. */
+        MissRatioCurve* mrc_ = nullptr;
+        /** Background thread which flushes dirty frames. */
+        std::thread flush_thread_;
+        /** Set to stop the flusher thread. */
+        bool flush_stop_ = false;
+        std::mutex flush_latch_;
+        std::condition_variable flush_cv_;
+        /**
+         * Lists whose dirty frames are being written by FlushDirtyFrames() without the latch.
+         * Their dirty flags are already cleared, so they must not be appended to, flushed or relocated until then.
+         */
+        std::unordered_set<list_id_t> flushing_lists_;
+        /** Notified when the writes of FlushDirtyFrames() are finished, waited on with the latch. */
+        std::condition_variable_any flushed_cv_;
         /** Latch */
         std::mutex latch_;
         /** Number of unused pages / frames in the buffer pool. */
         int free_num_;
 
-        /** We need to reset the contents of a list frame in the buffer pool. */
-        void UpdateFrames(std::vector<frame_id_t> frame_ids, list_id_t list_id);
-        /** Update the data in a single frame. Offsets is calculated in UpdateFrames. 
+        /** Key of a list in the hash tables and in the pages. */
+        static auto ListKey(index_id_t index_id, list_id_t list_id) -> list_id_t { return (index_id << LIST_KEY_INDEX_SHIFT) | list_id; }
+        static auto KeyIndex(list_id_t list_key) -> index_id_t { return list_key >> LIST_KEY_INDEX_SHIFT; }
+        static auto KeyList(list_id_t list_key) -> list_id_t { return list_key & ((1L << LIST_KEY_INDEX_SHIFT) - 1); }
+
+        /** Open the lists file and cache the locations of all its lists. */
+        auto AddIndex(const StorageLists* lists, const std::string& filename, size_t min_frames, size_t max_frames) -> index_id_t;
+
+        /** Cache the location and length of the list in the lists file. */
+        void SetListLocation(list_id_t list_id, const StorageLists::InvertedList& list, uint64_t version);
+        /**
+         * Check that the cached location of the list is up to date. While the lists file has only been modified
+         * by the appends of this pool, this is one atomic load, otherwise see RevalidateListLocation().
+        */
+        void RevalidateList(list_id_t list_id);
+        /**
+         * Compare the cached version of the list with the directory of the lists file.
+         * A modified list is dropped from the pool and the secondary cache, and its new location is cached.
+         * A pinned list is kept (in its previous version) until it is unpinned, as is a list being loaded.
+        */
+        void RevalidateListLocation(list_id_t list_id);
+
+        /** Assign the frames to the list (page meta-data and first frame flags), without any I/O. */
+        void SetFramesList(const std::vector<frame_id_t>& frame_ids, list_id_t list_id);
+        /** Read the content of the list into the frames. Only does I/O, so it can run without holding the latch. */
+        void LoadFrames(const std::vector<frame_id_t>& frame_ids, list_id_t list_id);
+        /** Update the data in a single frame. Offsets is calculated in LoadFrames. 
          * Offset represents the offset to the beginning of the file.
-         * item_num represents the number of item to copy.
+         * item_num represents the number of item to copy. The norms are only read if norms_offset is not 0.
          */
-        void UpdateSingleFrame(frame_id_t frame_id, size_t vectors_offset, size_t ids_offset, size_t bytes_num);
+        void UpdateSingleFrame(int fd, frame_id_t frame_id, size_t vectors_offset, size_t ids_offset, size_t norms_offset, size_t bytes_num);
         
         /** Lookup the free_list to find the **BEST** continuous free space which is large enough to hold the list. */
         int LookUpFreeList(int size);
 
         void AllocateFreeFrames(std::vector<frame_id_t>& found_pages, int evict_frame, int fetch_size);
 
+        /**
+         * Evict an unpinned list whose first frame is accepted by the filter (nullptr accepts all), and free its frames.
+         * @return false if there is no such list.
+        */
+        auto EvictList(const std::function<bool(frame_id_t)>& filter) -> bool;
+
         /** Reset the content of the frame / page to the initial state. */
         void ResetFrame(frame_id_t frame_id);
 
@@ -78,6 +401,51 @@ class BufferPoolManager {
         void AccessList(frame_id_t frame_id, int list_size);
         /** Return how many pages the list occupies in buffer pool. */
         int ListPageSize(list_id_t list_id);
+
+        /** Wait until the list is not being loaded by another thread. */
+        void WaitForLoad(list_id_t list_id, std::unique_lock<std::mutex>& lock);
+        /** Wait until the dirty frames of the list are not being written by FlushDirtyFrames(). The latch must be held. */
+        void WaitForFlush(list_id_t list_id);
+
+        /** Pin / unpin the frames of a list without counting an access. */
+        void PinFrames(frame_id_t frame_id, int list_size);
+        void UnpinFrames(frame_id_t frame_id, int list_size);
+
+        /** Describe the file ranges of the dirty frames of the list starting at the frame, and clear their dirty flags. */
+        void CollectDirtyFrames(frame_id_t frame_id, std::vector<IoSegment>& segments);
+        /**
+         * Write the dirty frames of the list starting at the frame back to the file, holding the latch.
+         * Waits first for a write of the list by FlushDirtyFrames(), which the list is pinned for.
+        */
+        void FlushList(frame_id_t frame_id);
+        /** Write the segments to the file in offset order, adjacent ones in a single pwritev(). */
+        void WriteSegments(int fd, std::vector<IoSegment>& segments);
+
+        /**
+         * Evict the list starting at the frame without going through the replacer. The list must not be pinned.
+         * @param spill is false if the content is outdated and must not go to the secondary cache.
+        */
+        void ReleaseList(frame_id_t frame_id, bool spill = true);
+        /** Copy the list starting at the frame to pending_spills_, if the secondary cache reserves slots for it. */
+        void SpillList(frame_id_t frame_id);
+        /** Write the spilled lists to the secondary cache. Must be called without holding the latch. */
+        void WriteSpills(std::vector<SpilledList>& spills);
+
+        /** Read the heat map and load the hottest lists which fit into the free frames. */
+        void WarmUp(std::string filename, int thread_num);
+
+        /** Map the memory of a new page / frame from the arena. */
+        auto AllocatePage(frame_id_t frame_id) -> Page*;
+        /** Unmap the memory of a page / frame and give it back to the OS. */
+        void ReleasePage(frame_id_t frame_id);
+
+        /** Describe the pinned frames of a list as a ListView. */
+        auto MakeListView(index_id_t index_id, list_id_t list_id, const std::vector<frame_id_t>& frame_ids) -> ListView;
+
+        /** Map the vectors of the frames of a list into a new window, if list views are enabled. */
+        void MapListWindow(frame_id_t frame_id, int list_size);
+        /** Unmap the window of the list starting at the frame, if it has one. */
+        void UnmapListWindow(frame_id_t frame_id);
 };
 
 }
\ No newline at end of file
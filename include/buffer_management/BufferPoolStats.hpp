@@ -0,0 +1,156 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../storage-node/types.hpp"
+
+#define LATENCY_BUCKET_NUM 64
+
+namespace ann_dkvs {
+/**
+ * Snapshot of a latency histogram. Bucket i counts the samples in [2^(i-1), 2^i) nanoseconds,
+ * bucket 0 the samples of 0 nanoseconds.
+*/
+struct LatencyHistogramSnapshot {
+    std::array<uint64_t, LATENCY_BUCKET_NUM> buckets{};
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    /** Return the upper bound in nanoseconds of the bucket holding the given percentile, p in [0, 1]. */
+    auto Percentile(double p) const -> uint64_t;
+    /** Return the mean latency in nanoseconds. */
+    auto Mean() const -> double { return count == 0 ? 0 : sum_ns / (double) count; }
+};
+
+/**
+ * Hits, misses and frames of one index served by a buffer pool.
+*/
+struct IndexStatsSnapshot {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    /** Frames held by the lists of the index at the time of the snapshot. */
+    uint64_t used_frames = 0;
+    size_t min_frames = 0;
+    size_t max_frames = 0;
+
+    auto HitRatio() const -> double { return hits + misses == 0 ? 0 : hits / (double) (hits + misses); }
+};
+
+/**
+ * Snapshot of the statistics of a buffer pool, aggregated over all threads.
+*/
+struct BufferPoolStatsSnapshot {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes_read = 0;
+    uint64_t read_syscalls = 0;
+    uint64_t bytes_written = 0;
+    uint64_t write_syscalls = 0;
+    /** Misses which had enough free frames in total, but no continuous range of them. */
+    uint64_t contiguous_alloc_failures = 0;
+    /** Fetches which waited for a concurrent load of the same list instead of reading it. */
+    uint64_t miss_waits = 0;
+    /** Cached lists which were dropped because they had been modified in the lists file. */
+    uint64_t invalidations = 0;
+    /** Number of frames pinned at the time of the snapshot. */
+    uint64_t pinned_frames = 0;
+
+    LatencyHistogramSnapshot fetch_latency;
+    LatencyHistogramSnapshot io_latency;
+    LatencyHistogramSnapshot evict_latency;
+
+    /** Hits and misses of every list, indexed by list id. */
+    std::vector<uint64_t> list_hits;
+    std::vector<uint64_t> list_misses;
+    /** Statistics of every index, indexed by index id. */
+    std::vector<IndexStatsSnapshot> indexes;
+
+    auto HitRatio() const -> double { return hits + misses == 0 ? 0 : hits / (double) (hits + misses); }
+};
+
+/**
+ * Counters of a single thread. Only the owner thread writes them, with relaxed loads and stores,
+ * so updating a counter costs a plain add; readers aggregate all threads in BufferPoolStats::Collect().
+*/
+struct ThreadStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> read_syscalls{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> write_syscalls{0};
+    std::atomic<uint64_t> contiguous_alloc_failures{0};
+    std::atomic<uint64_t> miss_waits{0};
+    std::atomic<uint64_t> invalidations{0};
+
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM> fetch_latency{};
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM> io_latency{};
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM> evict_latency{};
+    std::atomic<uint64_t> fetch_latency_sum{0};
+    std::atomic<uint64_t> io_latency_sum{0};
+    std::atomic<uint64_t> evict_latency_sum{0};
+
+    std::vector<std::atomic<uint64_t> > list_hits;
+    std::vector<std::atomic<uint64_t> > list_misses;
+
+    ThreadStats() : list_hits(NUM_LISTS), list_misses(NUM_LISTS) {}
+
+    static inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    inline void AddListHit(list_id_t list_id) {
+        if (list_id >= 0 && (size_t) list_id < list_hits.size()) {
+            Add(list_hits[list_id], 1);
+        }
+    }
+
+    inline void AddListMiss(list_id_t list_id) {
+        if (list_id >= 0 && (size_t) list_id < list_misses.size()) {
+            Add(list_misses[list_id], 1);
+        }
+    }
+
+    /** Record a latency in the log-bucketed histogram. */
+    static inline void AddLatency(std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM>& histogram, std::atomic<uint64_t>& sum, uint64_t ns) {
+        int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+        Add(histogram[bucket < LATENCY_BUCKET_NUM ? bucket : LATENCY_BUCKET_NUM - 1], 1);
+        Add(sum, ns);
+    }
+};
+
+/**
+ * Thread-safe statistics of a buffer pool, kept as per-thread counters.
+*/
+class BufferPoolStats {
+    public:
+        BufferPoolStats();
+        ~BufferPoolStats() = default;
+
+        /** Return the counters of the calling thread, created on its first call. */
+        auto Local() -> ThreadStats*;
+
+        /** Aggregate the counters of all threads. pinned_frames is left to the caller. */
+        auto Collect() -> BufferPoolStatsSnapshot;
+
+        /** Nanoseconds elapsed since the given time point. */
+        static inline auto ElapsedNs(std::chrono::steady_clock::time_point start) -> uint64_t {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        /** Unique id of this object, used as key of the thread-local lookup. */
+        const uint64_t id_;
+        /** Counters of all threads which have used the buffer pool. */
+        std::vector<std::unique_ptr<ThreadStats> > threads_;
+        /** Latch */
+        std::mutex latch_;
+};
+
+}
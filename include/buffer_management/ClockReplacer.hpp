@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <vector>
 #include <mutex>
 
@@ -30,6 +31,13 @@ class ClockReplacer {
    */
   bool EvictFrame(frame_id_t *frame_id);
 
+  /**
+   * Same as EvictFrame(), but only first frames accepted by the filter are victimized.
+   * Rejected frames keep their reference bits.
+   * @param filter returns true if the list starting at the frame may be evicted, nullptr accepts every frame
+   */
+  bool EvictFrame(frame_id_t *frame_id, const std::function<bool(frame_id_t)> &filter);
+
   /**
    * Different from the previous victim function, 
    * it victim the frame which is pointed by the clock pointer currently.
@@ -67,8 +75,25 @@ class ClockReplacer {
    */
   // int Size();
 
+  /**
+   * @return number of frames currently pinned
+   */
+  int GetPinnedNum() { return num_pinned_pages_; }
+
   bool GetUsedFrame(frame_id_t frame_id);
 
+  /**
+   * Reset the frame to the unused state, regardless of where the clock pointer is.
+   * Called from the buffer pool manager when a list is released without victimizing it.
+   */
+  void RemoveFrame(frame_id_t frame_id);
+
+  /**
+   * Change the number of frames in the replacer.
+   * When shrinking, the removed frames must not be in use.
+   */
+  void Resize(int num_pages);
+
   bool GetRefFlag(frame_id_t frame_id);
 
  private:
@@ -0,0 +1,88 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <sys/uio.h>
+
+#include "BufferPoolStats.hpp"
+#include "../storage-node/types.hpp"
+
+namespace ann_dkvs {
+/**
+ * A continuous byte range of the lists file, scattered into several buffers (e.g. the frames of a list).
+*/
+struct IoSegment {
+    size_t offset;
+    std::vector<iovec> buffers;
+
+    auto Size() const -> size_t {
+        size_t size = 0;
+        for (const iovec& buffer : buffers) {
+            size += buffer.iov_len;
+        }
+        return size;
+    }
+};
+
+/**
+ * IoScheduler is an elevator-style scheduler of the reads of the lists file.
+ *
+ * Inverted lists are allocated back-to-back in the lists file, so concurrent misses often read neighbouring ranges.
+ * Read requests of concurrent threads are queued, and one of the waiting threads dispatches the whole queue at once.
+ * Up to max_batches batches are in flight, so that a fast device still sees several reads at a time:
+ * a thread whose request is queued dispatches the queue as soon as fewer batches are in flight.
+ * The segments of a batch are sorted by file offset (a circular scan starting at the position of the previous batch),
+ * adjacent or nearly adjacent segments are merged into a single preadv() of at most max_read_bytes,
+ * and the data is scattered directly into the destination buffers. The bytes in a gap between merged segments
+ * (at most max_gap_bytes) are read into a scratch buffer and dropped.
+*/
+class IoScheduler {
+    public:
+        /**
+         * @param fd is the file descriptor of the lists file, owned by the caller.
+         * @param max_read_bytes is the largest size of a merged read. Larger segments are read on their own.
+         * @param max_gap_bytes is the largest hole between two segments which are merged.
+         * @param max_batches is the largest number of batches read at the same time.
+         * @param stats receives the read syscalls and bytes read.
+        */
+        IoScheduler(int fd, size_t max_read_bytes, size_t max_gap_bytes, size_t max_batches, BufferPoolStats* stats);
+        ~IoScheduler() = default;
+
+        /**
+         * Read all segments, blocking until they are filled.
+         * The reads are batched and merged with the ones of concurrent callers.
+        */
+        void Read(std::vector<IoSegment>& segments);
+
+    private:
+        /** The segments of one Read() call, done is set by the dispatching thread. */
+        struct IoRequest {
+            std::vector<IoSegment>* segments;
+            bool done;
+        };
+
+        int fd_;
+        size_t max_read_bytes_;
+        size_t max_gap_bytes_;
+        size_t max_batches_;
+        BufferPoolStats* stats_;
+        /** Requests which wait to be dispatched. */
+        std::vector<IoRequest*> pending_;
+        /** Number of batches being read. */
+        size_t dispatched_batches_ = 0;
+        /** File offset where the previous batch ended, the next sweep starts here. */
+        size_t head_offset_ = 0;
+        /** Latch */
+        std::mutex latch_;
+        std::condition_variable cv_;
+
+        /**
+         * Sort, merge and read the segments of a batch of requests, in a circular scan from head_offset.
+         * @return the file offset where the batch ended.
+        */
+        auto Dispatch(const std::vector<IoRequest*>& batch, size_t head_offset) -> size_t;
+        /** Read a continuous range into the buffers, continuing after short reads. */
+        void ReadRange(size_t offset, std::vector<iovec>& buffers);
+};
+
+}
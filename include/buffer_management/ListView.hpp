@@ -0,0 +1,62 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "../storage-node/types.hpp"
+
+namespace ann_dkvs {
+/**
+ * A list fetched from a buffer pool, as returned by FetchListView().
+ * If the frames of the list are virtually contiguous, vectors points to all vectors of the list as one span,
+ * which can be scanned sequentially. Otherwise the vectors are reached through the frames, and the same for the ids.
+*/
+struct ListView {
+    /** All vectors of the list, nullptr if the frames are not contiguous. */
+    const vector_el_t* vectors = nullptr;
+    /** All ids of the list, nullptr if they are not contiguous. */
+    const vector_id_t* ids = nullptr;
+    /** Vectors and ids of every frame of the list. */
+    std::vector<const vector_el_t*> frame_vectors;
+    std::vector<const vector_id_t*> frame_ids;
+    /** Squared norms of the vectors, contiguous or per frame. Both are empty if the lists do not store them. */
+    const distance_t* norms = nullptr;
+    std::vector<const distance_t*> frame_norms;
+    /** Number of vectors in the list. */
+    len_t length = 0;
+    /** Components of a vector in the span, the frames always hold vectors of DATA_DIMENSION. */
+    len_t dimension = DATA_DIMENSION;
+
+    inline auto GetVector(len_t i) const -> const vector_el_t* {
+        if (vectors != nullptr) {
+            return vectors + i * dimension;
+        }
+        return frame_vectors[i / FRAME_DATA_NUM] + (i % FRAME_DATA_NUM) * DATA_DIMENSION;
+    }
+
+    inline auto GetID(len_t i) const -> vector_id_t {
+        if (ids != nullptr) {
+            return ids[i];
+        }
+        return frame_ids[i / FRAME_DATA_NUM][i % FRAME_DATA_NUM];
+    }
+
+    inline auto HasNorms() const -> bool { return norms != nullptr || !frame_norms.empty(); }
+
+    /** Pointer to the norm of vector i, the following norms are contiguous up to BlockLength(i). */
+    inline auto GetNorms(len_t i) const -> const distance_t* {
+        if (norms != nullptr) {
+            return norms + i;
+        }
+        return frame_norms[i / FRAME_DATA_NUM] + i % FRAME_DATA_NUM;
+    }
+
+    /** Number of vectors from vector i on whose vectors and norms are contiguous, at least up to the end of the frame. */
+    inline auto BlockLength(len_t i) const -> len_t {
+        if (vectors != nullptr && (norms != nullptr || frame_norms.empty())) {
+            return length - i;
+        }
+        return std::min<len_t>(length - i, FRAME_DATA_NUM - i % FRAME_DATA_NUM);
+    }
+};
+
+}
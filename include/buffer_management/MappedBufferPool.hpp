@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+#include "BufferPoolStats.hpp"
+#include "ListView.hpp"
+#include "../storage-node/types.hpp"
+#include "../storage-node/StorageLists.hpp"
+
+/** Frame ids of a MappedBufferPool hold the list id above this bit and the index of the frame in the list below it. */
+#define MAPPED_FRAME_SHIFT 20
+
+namespace ann_dkvs {
+/**
+ * MappedBufferPool is a zero-copy backend of the buffer pool.
+ *
+ * The lists file is mapped once, read-only, and FetchListPages() hands out frames which point into the mapping,
+ * so nothing is copied and the page cache is the only copy of a list in memory.
+ * The pool only decides which lists are resident: a miss populates the pages of the list
+ * (and optionally locks them), and cold lists are dropped from the mapping and the page cache
+ * until the resident lists fit into the memory budget again, in LRU order.
+ *
+ * It has the same FetchListPages() / UnPinListPages() / GetPageVectors() / GetPageIDs() contract
+ * as the BufferPoolManager. Lists are read-only, the frames must not be written.
+*/
+class MappedBufferPool {
+    public:
+        /**
+         * @param budget_bytes is the memory the resident lists may occupy.
+         * @param lock_lists locks the resident lists in memory with mlock(), so they are never paged out.
+        */
+        MappedBufferPool(size_t budget_bytes, const StorageLists* lists, std::string filename, bool lock_lists = false);
+        ~MappedBufferPool();
+
+        /**
+         * Return the frames of the list, pinned for the caller.
+         * A frame is a window of FRAME_DATA_NUM vectors of the list in the mapping of the lists file.
+        */
+        auto FetchListPages(list_id_t list_id) -> std::vector<frame_id_t>;
+        /** Same as FetchListPages(), the vectors and the ids of the list are always one span in the mapping. */
+        auto FetchListView(list_id_t list_id) -> ListView;
+        /**
+         * Same as FetchListView() if the list is resident, counted as a hit.
+         * @return false if the list is not resident, nothing is read then.
+        */
+        auto FetchResidentListView(list_id_t list_id, ListView* view) -> bool;
+        /**
+         * Read the vector and the id of one entry of a list with pread(), without making the list resident.
+         * @return false if the entry is beyond the end of the list or cannot be read.
+        */
+        auto ReadEntry(list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) -> bool;
+        /** Unpin the list, it may be dropped afterwards. */
+        auto UnPinListPages(list_id_t list_id) -> bool;
+
+        auto GetPageVectors(frame_id_t frame_id) -> vector_el_t* {
+            return (vector_el_t*) (base_ + lists_[FrameList(frame_id)].vectors_offset) + FrameIndex(frame_id) * FRAME_DATA_SIZE;
+        }
+
+        auto GetPageIDs(frame_id_t frame_id) -> vector_id_t* {
+            return (vector_id_t*) (base_ + lists_[FrameList(frame_id)].ids_offset) + FrameIndex(frame_id) * FRAME_DATA_NUM;
+        }
+
+        /** Change the memory budget, dropping cold lists if the resident ones do not fit anymore. */
+        void SetMemoryBudget(size_t budget_bytes);
+
+        auto GetMemoryBudget() -> size_t { return budget_bytes_; }
+
+        /** Return the bytes of the resident lists. */
+        auto GetResidentBytes() -> size_t;
+
+        /**
+         * Return the statistics of the pool. bytes_read counts the bytes populated by misses,
+         * pinned_frames the frames of the pinned lists.
+        */
+        auto GetStats() -> BufferPoolStatsSnapshot;
+
+    private:
+        /** Location and residency of a list. */
+        struct MappedList {
+            size_t vectors_offset;
+            size_t ids_offset;
+            /** 0 if the lists file does not store norms. */
+            size_t norms_offset;
+            size_t length;
+            /** Number of frames of the list. */
+            int list_size;
+            bool resident = false;
+            int pin_count = 0;
+            /** Position in lru_list_ if resident. */
+            std::list<list_id_t>::iterator lru_position;
+        };
+
+        /** Budget for the resident lists. */
+        size_t budget_bytes_;
+        /** Cleared when mlock() fails, e.g. because of RLIMIT_MEMLOCK. */
+        std::atomic<bool> lock_lists_;
+        /** Mapping of the lists file. */
+        uint8_t* base_;
+        size_t mapped_size_;
+        int db_io_;
+        std::vector<MappedList> lists_;
+        /** Resident lists, the most recently used one in the front. */
+        std::list<list_id_t> lru_list_;
+        /** Sum of the byte ranges of the resident lists. */
+        size_t resident_bytes_ = 0;
+        /**
+         * Number of resident list ranges which start or end in a page, for the pages which are not fully owned by one list.
+         * A boundary page is only unlocked and dropped when no resident list uses it anymore.
+         */
+        std::unordered_map<size_t, int> boundary_page_refs_;
+        BufferPoolStats stats_;
+        /** Latch */
+        std::mutex latch_;
+
+        static auto FrameList(frame_id_t frame_id) -> list_id_t { return frame_id >> MAPPED_FRAME_SHIFT; }
+        static auto FrameIndex(frame_id_t frame_id) -> size_t { return frame_id & ((1L << MAPPED_FRAME_SHIFT) - 1); }
+
+        /** The byte ranges of the vectors, the ids and the norms of the list. */
+        auto ListRanges(list_id_t list_id) -> std::vector<std::pair<size_t, size_t> >;
+        /** The byte range widened to whole pages. */
+        auto PageRange(const std::pair<size_t, size_t>& range) -> std::pair<size_t, size_t>;
+        /** Count the first and last pages of the ranges of a list which becomes resident. */
+        void ReferenceBoundaryPages(list_id_t list_id);
+        auto ListBytes(list_id_t list_id) -> size_t;
+        /** Describe the pinned frames of a list as a ListView. */
+        auto MakeListView(list_id_t list_id, const std::vector<frame_id_t>& frame_ids) -> ListView;
+        /** Fault the pages of the list in, without holding the latch. Return the bytes populated. */
+        auto PopulateList(list_id_t list_id) -> size_t;
+        /** Drop unpinned lists in LRU order until the resident ones fit into the budget. */
+        void EnforceBudget();
+        /**
+         * Unlock and drop the pages of the list from the mapping and the page cache,
+         * except for the boundary pages which are still used by another resident list.
+        */
+        void DropList(list_id_t list_id);
+};
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "../storage-node/types.hpp"
+
+namespace ann_dkvs {
+/**
+ * MissRatioCurve estimates online how the hit ratio of the buffer pool depends on its size,
+ * using spatially hashed sampling of list accesses (SHARDS).
+ *
+ * Only lists whose hashed id falls under the sampling threshold are tracked. For every sampled access
+ * the reuse distance is computed, i.e. the number of frames occupied by the distinct sampled lists accessed since
+ * the previous access of the same list plus the frames of the list itself, and scaled by the inverse sampling rate.
+ * An access hits in an LRU pool of size C if its reuse distance is at most C frames.
+ * The buffer pool uses a clock replacer and contiguous allocation, so the curve is an approximation.
+*/
+class MissRatioCurve {
+    public:
+        /**
+         * Create a new MissRatioCurve.
+         * @param sampling_rate is the fraction of lists which are tracked, in (0, 1].
+         * @param bucket_size is the granularity of the histogram of reuse distances in frames.
+        */
+        MissRatioCurve(double sampling_rate, size_t bucket_size);
+
+        ~MissRatioCurve() = default;
+
+        /**
+         * Record an access of a list which occupies the given number of frames.
+         * Accesses of empty lists are not recorded.
+        */
+        void AccessList(list_id_t list_id, int list_size);
+
+        /**
+         * Return the expected hit ratio of a pool holding the given number of frames.
+        */
+        auto GetHitRatio(size_t pool_size) -> double;
+
+        /**
+         * Return the smallest pool size (in frames) whose expected hit ratio reaches the target,
+         * or 0 if it is not reached by any pool size seen in the recorded reuse distances.
+        */
+        auto GetPoolSizeForHitRatio(double hit_ratio) -> size_t;
+
+        /** Return the number of sampled accesses. */
+        auto GetSampledNum() -> size_t { return sampled_num_; }
+
+        /** Forget all recorded accesses. */
+        void Reset();
+
+    private:
+        /** Sampling threshold of the hashed list ids in [0, SAMPLING_MODULUS). */
+        size_t threshold_;
+        /** Fraction of lists which are tracked. */
+        double sampling_rate_;
+        /** Width of a histogram bucket in frames. */
+        const size_t bucket_size_;
+
+        /** Histogram of the (scaled) reuse distances, in buckets of bucket_size_ frames. */
+        std::vector<size_t> histogram_;
+        /** Number of sampled accesses. */
+        size_t sampled_num_;
+
+        /** Logical time of the last access of every sampled list. */
+        std::unordered_map<list_id_t, size_t> hash_to_last_time_;
+        /** Size in frames of every sampled list at its last access. */
+        std::unordered_map<list_id_t, int> hash_to_list_size_;
+        /**
+         * Fenwick tree over the logical times. At the time of the last access of each list it stores the size of the list,
+         * so the suffix sum after a time is the number of frames of the distinct lists accessed since then.
+        */
+        std::vector<int64_t> tree_;
+        /** Next logical time. */
+        size_t current_time_;
+        /** Latch */
+        std::mutex latch_;
+
+        static constexpr size_t SAMPLING_MODULUS = 1 << 24;
+
+        /** Whether the list is tracked. */
+        auto IsSampled(list_id_t list_id) -> bool;
+
+        void TreeAdd(size_t time, int64_t delta);
+        /** Sum of the tree over the logical times [0, time]. */
+        auto TreeSum(size_t time) -> int64_t;
+
+        /** Renumber the last access times of the tracked lists when the tree is full. */
+        void Compact();
+};
+
+}
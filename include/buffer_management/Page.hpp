@@ -16,20 +16,25 @@ class Page{
 
         inline auto GetVectors() -> vector_el_t* { return vectors_; }
         inline auto GetIDs() -> vector_id_t* { return ids_; }
+        inline auto GetNorms() -> distance_t* { return norms_; }
         inline auto GetPinCount() -> int { return pin_count_; }
         inline auto GetListID() -> list_id_t { return list_id_; }
         inline auto GetAccessTimes() -> int { return access_times_; }
         inline auto GetListSize() -> int { return list_size_; }
+        inline auto IsDirty() -> bool { return dirty_; }
 
     // private:
         inline void ResetMemory() { 
             memset(vectors_, -1, sizeof(vectors_));
             memset(ids_, -1, sizeof(ids_));
+            memset(norms_, 0, sizeof(norms_));
         }
         // char vectors_[FRAME_DATA_SIZE * sizeof(vector_el_t)]{};
         // char ids_[FRAME_DATA_SIZE * sizeof(vector_id_t)]{};
         vector_el_t vectors_[FRAME_DATA_SIZE]{};
         vector_id_t ids_[FRAME_DATA_NUM]{};
+        /** Squared norms of the vectors, only loaded if the lists file stores them. */
+        distance_t norms_[FRAME_DATA_NUM]{};
 
         list_id_t list_id_ = INVALID_LIST_ID;
         int pin_count_ = 0;
@@ -43,6 +48,7 @@ class Page{
         */
         int access_times_ = 0;
         int list_size_ = 0; /** How many pages in buffer the list occupied. */
+        bool dirty_ = false; /** Holds appended entries which are not written to the lists file yet. */
 };
 
 }
\ No newline at end of file
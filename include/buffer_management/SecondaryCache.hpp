@@ -0,0 +1,104 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+#include "Page.hpp"
+#include "../storage-node/types.hpp"
+
+#define SECONDARY_CACHE_FILENAME "bpm_secondary_cache.bin"
+
+namespace ann_dkvs {
+/**
+ * SecondaryCache is an optional spill tier of the buffer pool which lives on a fast local device (e.g. SSD).
+ * Lists evicted from the buffer pool are written into a cache file already laid out in frame format,
+ * so that a later miss can be served from the local device instead of the (slow) primary lists file.
+ *
+ * The cache file is divided into slots of one frame each. A list occupies any set of slots,
+ * and whole lists are replaced in LRU order when the cache is full.
+ *
+ * A list is inserted in two steps, so that the buffer pool does not write to the device with its latch held:
+ * Reserve() takes the slots while the frames are evicted, and Write() stores a copy of the frames later.
+*/
+class SecondaryCache {
+    public:
+        /**
+         * Create a new SecondaryCache.
+         * @param directory is the directory in which the cache file is created.
+         * @param capacity is the number of frames the cache file can hold.
+        */
+        SecondaryCache(const std::string& directory, size_t capacity);
+        ~SecondaryCache();
+
+        /**
+         * Return true if the list is stored in the cache.
+        */
+        auto Contains(list_id_t list_id) -> bool;
+
+        /**
+         * Reserve the slots of a list of page_num frames. The list is not served until Write() has stored it.
+         * Lists which are already cached are only marked as recently used, because the contents never change.
+         * @return false if nothing has to be written: the list is cached or being written, or it cannot be stored
+         * (e.g. it is larger than the whole cache).
+        */
+        auto Reserve(list_id_t list_id, size_t page_num, std::vector<size_t>& slots) -> bool;
+
+        /**
+         * Write the frames of a list, copied back-to-back with CopyFrame(), into its reserved slots.
+         * The latch is not held during the writes.
+         * @return false if a write fails or the list has been erased since Reserve(), its slots are released then.
+        */
+        auto Write(list_id_t list_id, const std::vector<size_t>& slots, const char* frames) -> bool;
+
+        /** Copy the vectors, ids and norms of a frame into a buffer of SLOT_BYTES, in the layout of a slot. */
+        static void CopyFrame(Page* page, char* slot);
+
+        /**
+         * Read the idx-th frame of a cached list into the page.
+         * @return false if the list is not cached or the read fails.
+        */
+        auto ReadFrame(list_id_t list_id, size_t idx, Page* page) -> bool;
+
+        /**
+         * Drop a list from the cache and release its slots.
+        */
+        void Erase(list_id_t list_id);
+
+        auto GetCapacity() -> size_t { return capacity_; }
+
+        auto GetFreeNum() -> size_t { return free_slots_.size(); }
+
+        /** Number of bytes of a single slot in the cache file. */
+        static constexpr size_t SLOT_BYTES = sizeof(vector_el_t) * FRAME_DATA_SIZE + sizeof(vector_id_t) * FRAME_DATA_NUM + sizeof(distance_t) * FRAME_DATA_NUM;
+
+    private:
+        /** Number of frames / slots the cache file holds. */
+        const size_t capacity_;
+        /** Path of the cache file. */
+        std::string filename_;
+        /** File descriptor of the cache file. */
+        int cache_io_;
+        /** Slots which are not used by any list. */
+        std::vector<size_t> free_slots_;
+        /** Lists in the cache, the most recently used one in the front. */
+        std::list<list_id_t> lru_list_;
+        /** Hash from list id to its position in lru_list_. */
+        std::unordered_map<list_id_t, std::list<list_id_t>::iterator> hash_to_lru_;
+        /** Hash from list id to the slots storing its frames (in order). */
+        std::unordered_map<list_id_t, std::vector<size_t> > hash_to_slots_;
+        /** Lists whose slots are reserved but not written yet, false once they have been erased. */
+        std::unordered_map<list_id_t, bool> pending_lists_;
+        /** Latch */
+        std::mutex latch_;
+
+        /** Evict the least recently used list. Return false if the cache is empty. */
+        auto EvictList() -> bool;
+        /** Erase without taking the latch. */
+        void EraseInternal(list_id_t list_id);
+};
+
+}
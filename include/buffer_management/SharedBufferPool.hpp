@@ -0,0 +1,163 @@
+#pragma once
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Page.hpp"
+#include "BufferPoolStats.hpp"
+#include "ListView.hpp"
+#include "../storage-node/types.hpp"
+#include "../storage-node/StorageLists.hpp"
+
+#define SHARED_POOL_MAGIC 0x53484d42504f4f4cUL
+
+namespace ann_dkvs {
+/**
+ * SharedBufferPool is a buffer pool shared by all processes of a host.
+ *
+ * The frames, the directory from list id to frames and the clock state live in a named POSIX shared-memory
+ * segment (shm_open()). The first process which opens a name creates and initializes the segment, the others
+ * attach to it, so each hot list is cached once per host instead of once per process.
+ * All state is protected by a process-shared robust mutex: if a process dies while holding it,
+ * the next process takes it over, and loads started by dead processes are dropped.
+ *
+ * Lists are read-only: all processes must open the same, unmodified lists file.
+ * Frames pinned by a process which dies stay pinned until the segment is removed.
+ * It has the same FetchListPages() / UnPinListPages() contract as the BufferPoolManager,
+ * without the optional features (secondary cache, write-back, several indexes).
+*/
+class SharedBufferPool {
+    public:
+        /**
+         * Create the segment with pool_size frames, or attach to the existing one of that name
+         * (the pool size of the existing segment is kept).
+         * @param name is the name of the segment, e.g. "/bpm_lists_1B".
+        */
+        SharedBufferPool(const std::string& name, size_t pool_size, const StorageLists* lists, std::string filename);
+        /** Detach from the segment. The segment stays until Remove(), so that later processes find the cached lists. */
+        ~SharedBufferPool();
+
+        /**
+         * Return the ids of the frames which store the content of the list, pinned for the caller.
+         * Concurrent misses on the same list, also from other processes, wait for the first one.
+        */
+        auto FetchListPages(list_id_t list_id) -> std::vector<frame_id_t>;
+        /**
+         * Same as FetchListPages(), but return the list as a ListView.
+         * The frames of a list are not virtually contiguous, so only lists of a single frame have one span of vectors.
+        */
+        auto FetchListView(list_id_t list_id) -> ListView;
+        /**
+         * Same as FetchListView() if the list is resident in the pool (and not being loaded), counted as a hit.
+         * @return false if the list is not resident, nothing is read then.
+        */
+        auto FetchResidentListView(list_id_t list_id, ListView* view) -> bool;
+        /**
+         * Read the vector and the id of one entry of a list from the lists file, without loading the list.
+         * @return false if the entry is beyond the end of the list or cannot be read.
+        */
+        auto ReadEntry(list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) -> bool;
+        /** Unpin the frames of the list. */
+        auto UnPinListPages(list_id_t list_id) -> bool;
+
+        auto GetPageVectors(frame_id_t frame_id) -> vector_el_t* { return pages_[frame_id].GetVectors(); }
+
+        auto GetPageIDs(frame_id_t frame_id) -> vector_id_t* { return pages_[frame_id].GetIDs(); }
+
+        auto GetPoolSize() -> size_t { return header_->pool_size; }
+
+        /** Whether this process has created the segment. */
+        auto IsCreator() -> bool { return creator_; }
+
+        /**
+         * Return the statistics of all processes sharing the pool.
+         * Only hits, misses, evictions, bytes read, read syscalls and pinned frames are kept.
+        */
+        auto GetStats() -> BufferPoolStatsSnapshot;
+
+        /** Remove the segment of that name. Attached processes keep their mapping. */
+        static void Remove(const std::string& name);
+
+    private:
+        /** Beginning of the segment, followed by the directory, the frame flags and the frames. */
+        struct SharedHeader {
+            std::atomic<uint64_t> magic;
+            uint64_t pool_size;
+            uint64_t list_num;
+            uint64_t frame_bytes;
+            /** Hash of the list lengths, all processes must see the same lists. */
+            uint64_t lists_signature;
+            /** Offsets of the parts of the segment. */
+            size_t directory_offset;
+            size_t flags_offset;
+            size_t pages_offset;
+            pthread_mutex_t latch;
+            /** Broadcast when a load is finished or a list is unpinned. */
+            pthread_cond_t cond;
+            size_t clock_pointer;
+            uint64_t attached;
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t bytes_read;
+            uint64_t read_syscalls;
+        };
+
+        /** Location of a list in the pool. */
+        struct SharedListEntry {
+            frame_id_t first_frame;
+            /** Process which loads the list, 0 if the content of the frames is complete. */
+            pid_t loader_pid;
+        };
+
+        /** Flags of a frame in the clock. */
+        enum FrameFlag : uint8_t {
+            FRAME_FIRST = 1,
+            FRAME_REFERENCED = 2
+        };
+
+        std::string name_;
+        bool creator_ = false;
+        int shm_fd_;
+        size_t segment_size_;
+        SharedHeader* header_;
+        SharedListEntry* directory_;
+        uint8_t* flags_;
+        Page* pages_;
+        /** Base pointer of the lists file on disk. */
+        int db_io_;
+        /** Location and length of every list, from the local StorageLists. */
+        std::vector<std::pair<size_t, size_t> > list_offsets_;
+        std::vector<size_t> list_lengths_;
+        /** Offset of the norms of every list, 0 if the lists file does not store norms. */
+        std::vector<size_t> list_norms_offsets_;
+
+        static auto SegmentSize(size_t pool_size) -> size_t;
+        /** Initialize a new segment. Other processes only use it after the magic is set at the end. */
+        void InitSegment(size_t pool_size, uint64_t lists_signature);
+
+        /** Lock the latch, and recover the state left by a process which died while holding it. */
+        void Lock();
+        void Unlock();
+        /** Wait for a broadcast, at most a short time so that dead loaders are noticed. */
+        void Wait();
+        /** Drop the loads of processes which do not exist anymore. */
+        void DropDeadLoads();
+
+        auto ListPageSize(list_id_t list_id) -> int;
+        /** Describe the pinned frames of a list as a ListView. */
+        auto MakeListView(list_id_t list_id, const std::vector<frame_id_t>& frame_ids) -> ListView;
+        /** Find the first range of continuous free frames which can hold the list. */
+        auto LookUpFreeList(int size) -> frame_id_t;
+        /** Evict one unpinned list with the clock algorithm. */
+        auto EvictList() -> bool;
+        /** Reset the frames of the list and remove it from the directory. */
+        void ReleaseFrames(list_id_t list_id);
+        /** Read the content of the list into the frames, without holding the latch. Return the bytes read. */
+        auto LoadFrames(list_id_t list_id, frame_id_t first_frame, int list_size) -> size_t;
+};
+
+}
@@ -62,7 +62,8 @@ namespace ann_dkvs
 
     /**
      * Given a query and the results of the nearest centroid search,
-     * this function sets the lists to be searched for the query.
+     * this function sets the lists to be searched for the query
+     * and the distances of the query to their centroids.
      *
      * @param query A pointer to the query object.
      * @param nearest_centroids A heap of the nearest centroid candidates.
@@ -82,6 +83,14 @@ namespace ann_dkvs
      */
     void add_candidate(const Query *query, const CentroidsResult &candidate, centroids_heap_t &candidates);
 
+    /**
+     * Same as preassign_query(), with the distance of an L2Distance specialization.
+     *
+     * @param query A pointer to the query object.
+     */
+    template <class Distance>
+    void preassign_query(Query *query, Distance);
+
   public:
     /**
      * Creates a new root index object.
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/version.hpp>
+
+#include "types.hpp"
+#include "StorageLists.hpp"
+#include "../HammingKernels.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Computes the Hamming distances from the code of a query to n codes, see HammingKernels.hpp.
+   */
+  using hamming_func_t = void (*)(const uint64_t *query_code, const uint64_t *codes, size_t n_words, len_t n, uint16_t *distances);
+
+  /**
+   * In-memory binary codes of the vectors of StorageLists, used as a cheap prefilter of the scans (see StorageIndex::set_binary_prefilter()).
+   *
+   * The code of a vector has one bit per dimension, the sign of the vector minus the centroid of its list,
+   * i.e. n_words = ceil(vector_dim / 64) 64-bit words (16 bytes for 128 dimensions). The Hamming distance
+   * between the codes of a query and of a vector, relative to the same centroid, estimates the angle
+   * between them as seen from the centroid, so the closest codes are the likely nearest neighbors.
+   *
+   * The codes of a list are in the order of its entries in the StorageLists.
+   */
+  class BinaryLists
+  {
+  public:
+    /**
+     * The centroid and the codes of an inverted list.
+     */
+    struct CodeList
+    {
+      template <class Archive>
+      void serialize(Archive &ar, const unsigned int /*version*/)
+      {
+        ar & centroid;
+        ar & codes;
+      }
+
+      std::vector<float> centroid;
+      /** n_words words per vector. */
+      std::vector<uint64_t> codes;
+    };
+
+    BinaryLists() = default;
+
+    /**
+     * Creates empty lists.
+     *
+     * @param vector_dim The dimension of the vectors, at most 64 * HAMMING_MAX_WORDS.
+     */
+    BinaryLists(size_t vector_dim);
+
+    /**
+     * Encodes all lists of a StorageLists object, in the order of their entries.
+     *
+     * @param lists The lists.
+     * @param centroids The centroids of the lists, vector_dim floats each, indexed by list id
+     *                  (e.g. the centroids of the RootIndex). If it is nullptr, the centroid of a list
+     *                  is the mean of its vectors.
+     */
+    void add_lists(const StorageLists &lists, const float *centroids);
+
+    /**
+     * Encodes a vector relative to a centroid.
+     *
+     * @param centroid The centroid, vector_dim floats.
+     * @param vector The vector.
+     * @param code n_words words.
+     */
+    void encode(const float *centroid, const vector_el_t *vector, uint64_t *code) const;
+
+    /**
+     * Encodes a query relative to the centroid of a list.
+     */
+    void encode_query(const list_id_t list_id, const vector_el_t *query, uint64_t *code) const;
+
+    /**
+     * Returns the Hamming kernel of the SIMD level of this CPU (see L2Space::get_simd_level()).
+     */
+    static hamming_func_t get_hamming_func();
+
+    bool has_list(const list_id_t list_id) const;
+
+    /**
+     * Returns the number of codes of a list.
+     *
+     * @throws std::invalid_argument if the list does not exist.
+     */
+    len_t get_list_length(const list_id_t list_id) const;
+
+    const uint64_t *get_codes(const list_id_t list_id) const;
+
+    /** Returns the number of 64-bit words of a code. */
+    size_t get_n_words() const;
+
+    size_t get_vector_dim() const;
+
+    /** Returns the bytes of the centroids and codes of all lists. */
+    size_t get_total_size() const;
+
+  private:
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive &ar, const unsigned int /*version*/)
+    {
+      ar & vector_dim;
+      ar & n_words;
+      ar & id_to_list_map;
+    }
+
+    size_t vector_dim = 0;
+    size_t n_words = 0;
+
+    std::unordered_map<list_id_t, CodeList> id_to_list_map;
+
+    /** Returns a list, throws std::invalid_argument if it does not exist. */
+    const CodeList &get_list(const list_id_t list_id) const;
+  };
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <queue>
+
+#include "PQLists.hpp"
+#include "../Query.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * A result of the compressed search, with the location of the vector in the lists,
+   * i.e. entry offset of list list_id (see PQLists::add_lists()).
+   */
+  struct PQCandidate
+  {
+    distance_t distance;
+    vector_id_t vector_id;
+    list_id_t list_id;
+    len_t offset;
+    friend bool operator<(const PQCandidate &a, const PQCandidate &b)
+    {
+      bool closer = a.distance < b.distance ||
+                    (a.distance == b.distance && a.vector_id < b.vector_id);
+      return closer;
+    }
+  };
+
+  typedef std::vector<PQCandidate> PQCandidates;
+
+  /**
+   * Max heap of the candidates of the compressed search.
+   */
+  typedef std::priority_queue<PQCandidate> pq_heap_t;
+
+  /**
+   * Searches the compressed lists of a PQLists object, the counterpart of StorageIndex.
+   * The distances are the ADC distances of the quantized distance table, i.e. estimates of the exact distances;
+   * the lists are in memory, so no vector is read from disk.
+   */
+  class PQIndex
+  {
+
+  private:
+    /**
+     * Pointer to the compressed lists
+     * used to access the codes.
+     */
+    const PQLists *lists;
+
+    /**
+     * The fast-scan kernel of this CPU.
+     */
+    pq_fast_scan_func_t fast_scan_func;
+
+    /**
+     * Converts a heap of candidates into a vector, the closest one first.
+     */
+    PQCandidates extract_candidates(pq_heap_t &candidates) const;
+
+    /**
+     * Adds a candidate to the heap if it is closer than the furthest candidate in the heap,
+     * or if the heap holds less than n_results candidates.
+     */
+    void add_candidate(const len_t n_results, const PQCandidate &candidate, pq_heap_t &candidates) const;
+
+    /**
+     * Scans the blocks of a list with the fast-scan kernel and adds the vectors to the candidates.
+     * The quantized distances of a block are compared to the furthest candidate before they are converted,
+     * so most vectors are discarded with one integer comparison.
+     *
+     * @param table The quantized distance table of the query.
+     * @param list_id The id of the list to search.
+     * @param n_results The number of results to keep.
+     * @param candidates The heap of the results.
+     */
+    void search_preassigned_list(const PQLookupTable &table, const list_id_t list_id,
+                                 const len_t n_results, pq_heap_t &candidates) const;
+
+  public:
+    /**
+     * Creates a new index over compressed lists.
+     *
+     * @param lists A pointer to the compressed lists, with a trained quantizer.
+     */
+    PQIndex(const PQLists *lists);
+
+    /**
+     * Searches all lists of a query selected for probing
+     * for its nearest neighbors, by their ADC distances.
+     *
+     * @param query A pointer to a query object.
+     * @return A vector of query results.
+     */
+    QueryResults search_preassigned(const Query *query) const;
+
+    /**
+     * Same as search_preassigned(), but keeps n_candidates results instead of the query's number of results,
+     * with their location in the lists, to shortlist candidates for re-ranking (see StorageIndex::search_two_stage()).
+     *
+     * @param query A pointer to a query object.
+     * @param n_candidates The number of candidates to keep.
+     * @return The candidates, the closest one first.
+     */
+    PQCandidates shortlist(const Query *query, const len_t n_candidates) const;
+
+    /**
+     * Searches all lists of a batch of queries selected for probing, the queries are distributed among the threads.
+     *
+     * @param queries A batch of queries, i.e. a vector of query objects.
+     * @return A batch of query results.
+     */
+    QueryResultsBatch batch_search_preassigned(const QueryBatch &queries) const;
+  };
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/version.hpp>
+
+#include "types.hpp"
+#include "ProductQuantizer.hpp"
+#include "StorageLists.hpp"
+#include "../PQKernels.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Computes the quantized distances of a block of PQ_FAST_SCAN_BLOCK_SIZE encoded vectors, see PQKernels.hpp.
+   */
+  using pq_fast_scan_func_t = void (*)(const uint8_t *codes, const uint8_t *table, size_t n_subquantizers, uint16_t *distances);
+
+  /**
+   * The distance table of a query for the fast-scan kernels, quantized to one byte per entry.
+   * The distance to an encoded vector is bias + (sum of its entries) / scale.
+   */
+  struct PQLookupTable
+  {
+    std::vector<uint8_t> table;
+    float bias;
+    float scale;
+
+    distance_t get_distance(const uint16_t quantized_distance) const
+    {
+      return bias + quantized_distance / scale;
+    }
+  };
+
+  /**
+   * In-memory inverted lists of product quantization codes, the compressed counterpart of StorageLists.
+   *
+   * Vectors are encoded with a 4-bit ProductQuantizer, so a vector takes n_subquantizers / 2 bytes
+   * (e.g. 64 bytes instead of 512 for 128 floats and 128 subquantizers), and all lists can be kept in memory.
+   * The codes are stored in the fast-scan layout (see PQKernels.hpp): a list is a sequence of blocks of
+   * PQ_FAST_SCAN_BLOCK_SIZE vectors, the last one padded with zero codes.
+   *
+   * Lists encoded with add_lists() keep the order of the entries of the StorageLists,
+   * so entry i of a list here is entry i of the same list there.
+   */
+  class PQLists
+  {
+  public:
+    /**
+     * The codes and the vector ids of an inverted list.
+     */
+    struct CodeList
+    {
+      template <class Archive>
+      void serialize(Archive &ar, const unsigned int /*version*/)
+      {
+        ar & codes;
+        ar & ids;
+      }
+
+      /** The blocks of the list, 16 * n_subquantizers bytes each. */
+      std::vector<uint8_t> codes;
+      std::vector<vector_id_t> ids;
+    };
+
+    PQLists() = default;
+
+    /**
+     * Creates empty lists with an untrained quantizer.
+     *
+     * @param vector_dim The dimension of the vectors.
+     * @param n_subquantizers The number of 4-bit codes of a vector, an even divisor of vector_dim.
+     */
+    PQLists(size_t vector_dim, size_t n_subquantizers);
+
+    /**
+     * Trains the quantizer on the given vectors.
+     *
+     * @param vectors The training vectors, stored consecutively.
+     * @param n_vectors The number of training vectors, at least 16.
+     * @param n_iterations The number of k-means iterations.
+     * @param seed The seed of the initialization.
+     */
+    void train(const vector_el_t *vectors, const len_t n_vectors, const int n_iterations, const unsigned seed);
+
+    /**
+     * Trains the quantizer on a uniform sample of the vectors of the given lists.
+     *
+     * @param lists The lists to sample from.
+     * @param n_training_vectors The size of the sample.
+     */
+    void train(const StorageLists &lists, const len_t n_training_vectors, const int n_iterations, const unsigned seed);
+
+    /**
+     * Encodes vectors and appends them to a list. The list is created if it does not exist.
+     *
+     * @param list_id The id of the list.
+     * @param vectors The vectors, stored consecutively.
+     * @param ids The vector ids.
+     * @param n_entries The number of vectors.
+     */
+    void add_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries);
+
+    /**
+     * Encodes all lists of a StorageLists object, in the order of their entries.
+     */
+    void add_lists(const StorageLists &lists);
+
+    /**
+     * Computes the quantized distance table of a query for the fast-scan kernels.
+     */
+    void compute_lookup_table(const vector_el_t *query, PQLookupTable &table) const;
+
+    /**
+     * Returns the fast-scan kernel of the SIMD level of this CPU (see L2Space::get_simd_level()).
+     */
+    static pq_fast_scan_func_t get_fast_scan_func();
+
+    bool has_list(const list_id_t list_id) const;
+
+    /**
+     * Returns the number of vectors of a list.
+     *
+     * @throws std::invalid_argument if the list does not exist.
+     */
+    len_t get_list_length(const list_id_t list_id) const;
+
+    /** Returns the blocks of a list. */
+    const uint8_t *get_codes(const list_id_t list_id) const;
+
+    const vector_id_t *get_ids(const list_id_t list_id) const;
+
+    /** Returns the size of a block in bytes. */
+    size_t get_block_size() const;
+
+    /** Returns the bytes of the codes and ids of all lists. */
+    size_t get_total_size() const;
+
+    const ProductQuantizer &get_quantizer() const;
+
+  private:
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive &ar, const unsigned int /*version*/)
+    {
+      ar & quantizer;
+      ar & id_to_list_map;
+    }
+
+    ProductQuantizer quantizer;
+
+    std::unordered_map<list_id_t, CodeList> id_to_list_map;
+
+    /** Returns a list, throws std::invalid_argument if it does not exist. */
+    const CodeList &get_list(const list_id_t list_id) const;
+
+    /** Encodes vectors and appends them to the blocks of a list. */
+    void append_entries(CodeList &list, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries) const;
+  };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
+
+#include "types.hpp"
+
+namespace ann_dkvs
+{
+  /**
+   * Product quantizer: a vector is split into n_subquantizers sub-vectors of equal dimension,
+   * and every sub-vector is replaced by the id of its nearest centroid in the codebook of its subspace,
+   * i.e. a vector is compressed to n_subquantizers codes of n_bits each.
+   *
+   * Distances from a query to encoded vectors are computed asymmetrically (ADC):
+   * the distances from the query to all centroids are computed once (the distance table),
+   * and the distance to an encoded vector is the sum of one table entry per subquantizer.
+   */
+  class ProductQuantizer
+  {
+  public:
+    ProductQuantizer() = default;
+
+    /**
+     * Creates an untrained product quantizer.
+     *
+     * @param vector_dim The dimension of the vectors, a multiple of n_subquantizers.
+     * @param n_subquantizers The number of sub-vectors (and of codes) of a vector.
+     * @param n_bits The bits of a code, i.e. every codebook has 2^n_bits centroids. At most 8.
+     */
+    ProductQuantizer(size_t vector_dim, size_t n_subquantizers, size_t n_bits);
+
+    /**
+     * Trains the codebooks with k-means in every subspace.
+     * The centroids are initialized with distinct random training vectors,
+     * clusters which become empty are re-seeded with a random training vector.
+     *
+     * @param vectors The training vectors, stored consecutively.
+     * @param n_vectors The number of training vectors, at least 2^n_bits.
+     * @param n_iterations The number of k-means iterations.
+     * @param seed The seed of the initialization.
+     */
+    void train(const vector_el_t *vectors, const len_t n_vectors, const int n_iterations, const unsigned seed);
+
+    bool is_trained() const;
+
+    /**
+     * Encodes a vector.
+     *
+     * @param vector The vector.
+     * @param code n_subquantizers codes, one byte each.
+     */
+    void encode(const vector_el_t *vector, uint8_t *code) const;
+
+    /**
+     * Decodes a vector, i.e. concatenates the centroids of its codes.
+     *
+     * @param code n_subquantizers codes, one byte each.
+     * @param vector The decoded vector, vector_dim floats.
+     */
+    void decode(const uint8_t *code, float *vector) const;
+
+    /**
+     * Computes the distance table of a query: the squared distance from every sub-vector of the query
+     * to every centroid of its subspace.
+     *
+     * @param query The query vector.
+     * @param table n_subquantizers * 2^n_bits distances, the ones of subquantizer m start at m * 2^n_bits.
+     */
+    void compute_distance_table(const vector_el_t *query, float *table) const;
+
+    /**
+     * Returns the distance from a query to an encoded vector (ADC).
+     *
+     * @param table The distance table of the query.
+     * @param code n_subquantizers codes, one byte each.
+     */
+    distance_t compute_distance(const float *table, const uint8_t *code) const;
+
+    size_t get_vector_dim() const;
+    size_t get_n_subquantizers() const;
+    size_t get_n_bits() const;
+    /** The number of centroids of every codebook, 2^n_bits. */
+    size_t get_n_centroids() const;
+    /** The dimension of a sub-vector. */
+    size_t get_subquantizer_dim() const;
+
+  private:
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive &ar, const unsigned int /*version*/)
+    {
+      ar & vector_dim;
+      ar & n_subquantizers;
+      ar & n_bits;
+      ar & n_centroids;
+      ar & subquantizer_dim;
+      ar & centroids;
+    }
+
+    size_t vector_dim = 0;
+    size_t n_subquantizers = 0;
+    size_t n_bits = 0;
+    size_t n_centroids = 0;
+    size_t subquantizer_dim = 0;
+
+    /**
+     * The codebooks, n_subquantizers * n_centroids * subquantizer_dim floats:
+     * centroid k of subquantizer m starts at (m * n_centroids + k) * subquantizer_dim.
+     * Empty until the quantizer is trained.
+     */
+    std::vector<float> centroids;
+
+    /**
+     * Runs k-means on the sub-vectors of one subspace.
+     *
+     * @param subvectors n_vectors sub-vectors of subquantizer_dim floats, stored consecutively.
+     * @param centroids The n_centroids centroids of the subspace.
+     */
+    void train_subquantizer(const float *subvectors, const len_t n_vectors, const int n_iterations,
+                            const unsigned seed, float *centroids) const;
+
+    /** Returns the nearest centroid of a sub-vector among the centroids of a subspace. */
+    uint8_t find_nearest_centroid(const float *subvector, const float *centroids) const;
+  };
+}
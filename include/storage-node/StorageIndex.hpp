@@ -4,10 +4,23 @@
 #include <queue>
 
 #include "StorageLists.hpp"
+#include "PQIndex.hpp"
+#include "BinaryLists.hpp"
 #include "../L2Space.hpp"
 #include "../Query.hpp"
 
 #include "../buffer_management/BufferPoolManager.hpp"
+#include "../buffer_management/SharedBufferPool.hpp"
+#include "../buffer_management/MappedBufferPool.hpp"
+
+/** Number of vectors whose distances are computed at once by the block kernel. */
+#define SCAN_BLOCK_SIZE 256
+
+/**
+ * Relative rounding error allowed for the distances of the triangle inequality bounds,
+ * so that rounding never prunes a vector which is closer than the furthest result.
+ */
+#define CENTROID_PRUNING_TOLERANCE 1e-4f
 
 namespace ann_dkvs
 {
@@ -39,6 +52,13 @@ namespace ann_dkvs
    */
   typedef std::vector<QueryListPair> QueryListPairs;
 
+  /**
+   * Internal data structure representing a list and the ids of all queries of a batch which probe it,
+   * the work item of the list-major search.
+   */
+  typedef std::pair<list_id_t, std::vector<len_t>> ListQueries;
+  typedef std::vector<ListQueries> ListQueriesBatch;
+
   class StorageIndex
   {
 
@@ -50,10 +70,20 @@ namespace ann_dkvs
     const StorageLists *lists;
 
     /**
-     * Distance function used to compute the distance
-     * between query vector and the vectors within a list.
+     * Binary codes of the lists used to prefilter the scans, nullptr if the prefilter is disabled.
+     * See set_binary_prefilter().
+     */
+    const BinaryLists *binary_lists = nullptr;
+
+    /**
+     * The prefilter keeps prefilter_expansion times the number of results of a query in every list.
+     */
+    len_t prefilter_expansion = 0;
+
+    /**
+     * The Hamming kernel of this CPU.
      */
-    const distance_func_t distance_func;
+    hamming_func_t hamming_func = nullptr;
 
     /**
      * Converts a heap of results into a QueryResults object,
@@ -64,6 +94,125 @@ namespace ann_dkvs
      */
     QueryResults extract_results(heap_t &candidates) const;
 
+    /**
+     * Computes the distances between the query and all vectors of a list
+     * and adds them to the candidates.
+     * If the norms of the vectors are stored, blocks of up to SCAN_BLOCK_SIZE vectors
+     * are computed at once with the block kernel.
+     * Instantiated for every L2Distance specialization, see dispatch_l2().
+     *
+     * @param query A pointer to a query object.
+     * @param view The vectors and ids of the list.
+     * @param candidates A reference to a heap of query results used to store the query results.
+     */
+    template <class Distance>
+    void scan_list(const Query *query, const ListView &view, heap_t &candidates) const;
+
+    /**
+     * Same as scan_list() for all queries of a work item at once: every block of vectors is applied to all queries,
+     * so the list is read once instead of once per query. If the norms of the vectors are stored,
+     * the distances of a block to all queries are computed together with the matrix kernel.
+     *
+     * @param queries A batch of queries.
+     * @param work_item The list and the ids of the queries which probe it.
+     * @param view The vectors and ids of the list.
+     * @param candidates One heap per query of the work item, in the same order.
+     */
+    template <class Distance>
+    void scan_list_queries(const QueryBatch &queries, const ListQueries &work_item,
+                           const ListView &view, std::vector<heap_t> &candidates) const;
+
+    /**
+     * Adds the candidates found in the list of a work item to the candidates of its queries.
+     */
+    void merge_list_candidates(const QueryBatch &queries, const ListQueries &work_item,
+                               std::vector<heap_t> &local_candidates, std::vector<heap_t> &candidate_lists) const;
+
+    /**
+     * Returns whether the scan of a list by a query is prefiltered: the prefilter is enabled,
+     * the binary codes of the list are up to date (they have as many entries as the list),
+     * and the prefilter keeps less vectors than the list has.
+     */
+    bool is_prefiltered(const Query *query, const list_id_t list_id, const len_t length) const;
+
+    /**
+     * Same as scan_list() with the binary prefilter: the Hamming distances from the code of the query
+     * to the codes of the list are computed first, and only the prefilter_expansion * n_results vectors
+     * with the closest codes are compared with their exact distances.
+     *
+     * @param query A pointer to a query object.
+     * @param list_id The id of the list, for its binary codes.
+     * @param view The vectors and ids of the list.
+     * @param candidates A reference to a heap of query results used to store the query results.
+     */
+    template <class Distance>
+    void scan_list_prefiltered(const Query *query, const list_id_t list_id, const ListView &view, heap_t &candidates) const;
+
+    /**
+     * The distances used to prune the scan of a list by a query with the triangle inequality.
+     *
+     * - query_distance: distance of the query to the centroid of the list (not squared)
+     * - distances: distances of the vectors of the list to its centroid (see StorageLists::set_centroid_distances())
+     * - sorted: whether the entries of the list are sorted by these distances
+     */
+    struct CentroidBounds
+    {
+      distance_t query_distance;
+      const distance_t *distances;
+      bool sorted;
+    };
+
+    /**
+     * Returns whether the scan of a list by a query can be pruned: the query holds its distance
+     * to the centroid of the list (see RootIndex::preassign_query()) and the lists hold up-to-date distances
+     * of the length entries of the list to its centroid.
+     */
+    bool get_centroid_bounds(const Query *query, const list_id_t list_id, const len_t length, CentroidBounds &bounds) const;
+
+    /**
+     * Same as scan_list(), skipping the vectors which cannot be closer than the furthest result:
+     * by the triangle inequality, the distance of the query q to a vector x of the list of centroid c
+     * is at least |d(q, c) - d(x, c)|. If the entries are sorted by d(x, c), this bound grows
+     * in both directions from the position of d(q, c), so the scan starts there, goes both ways
+     * in the order of the bound and stops at the first vector pruned, skipping the rest of the list.
+     *
+     * @param query A pointer to a query object.
+     * @param bounds The distances to the centroid of the list.
+     * @param view The vectors and ids of the list.
+     * @param candidates A reference to a heap of query results used to store the query results.
+     */
+    template <class Distance>
+    void scan_list_pruned(const Query *query, const CentroidBounds &bounds, const ListView &view, heap_t &candidates) const;
+
+    /**
+     * Computes the exact distances of the candidates of a list, which must be sorted by offset,
+     * and adds them to the results. Candidates whose entry does not hold their vector id anymore,
+     * because the list changed since it was encoded, are skipped.
+     */
+    template <class Distance>
+    void rerank_list(const Query *query, const ListView &view, const PQCandidate *candidates,
+                     const len_t n_candidates, heap_t &results) const;
+
+    /**
+     * Re-ranks a shortlist of the compressed search: the candidates are grouped by list,
+     * and rerank_list(list_id, candidates, n_candidates, results) is called once per list.
+     */
+    template <class RerankList>
+    QueryResults rerank_shortlist(PQCandidates &shortlist, RerankList &&rerank_list) const;
+
+    /**
+     * Re-ranks the candidates of a list read through a buffer pool. A resident list is read from its frames,
+     * otherwise only the vectors of the candidates are read from the lists file, and the list is not loaded.
+     */
+    template <class BufferPool>
+    void rerank_list_bpm(const Query *query, list_id_t list_id, const PQCandidate *candidates,
+                         const len_t n_candidates, heap_t &results, BufferPool *bpm) const;
+
+    /**
+     * Returns the vectors, ids and norms of a list in memory.
+     */
+    ListView get_list_view(const list_id_t list_id) const;
+
     /**
      * Searches a single list for the nearest neighbors of a query.
      *
@@ -77,10 +226,15 @@ namespace ann_dkvs
         heap_t &candidates) const;
 
 
+    /**
+     * Same as search_preassigned_list(), reading the list through a buffer pool
+     * (BufferPoolManager, SharedBufferPool or MappedBufferPool).
+     */
+    template <class BufferPool>
     void search_preassigned_list_bpm(
         const Query *query,
         const list_id_t list_id,
-        heap_t &candidates, BufferPoolManager* bpm) const;
+        heap_t &candidates, BufferPool* bpm) const;
 
     /**
      * Creates a list of work items for a batch of queries.
@@ -92,6 +246,15 @@ namespace ann_dkvs
      */
     QueryListPairs get_work_items(const QueryBatch &queries) const;
 
+    /**
+     * Creates the work items of the list-major search for a batch of queries:
+     * every list probed by the batch, with the ids of the queries which probe it.
+     *
+     * @param queries A batch of queries.
+     * @return A vector of work items, in the order the lists are first probed.
+     */
+    ListQueriesBatch get_list_work_items(const QueryBatch &queries) const;
+
     /**
      * Adds a given query result to the heap of candidate results.
      *
@@ -113,10 +276,24 @@ namespace ann_dkvs
      */
     StorageIndex(const StorageLists *lists);
 
+    /**
+     * Enables the binary prefilter of the scans of search_preassigned() and search_preassigned_bpm()
+     * and of their batch versions, see scan_list_prefiltered(). Lists without up-to-date codes are scanned fully.
+     *
+     * @param binary_lists The binary codes of the lists, encoded by BinaryLists::add_lists(); nullptr disables the prefilter.
+     * @param expansion_factor The prefilter keeps expansion_factor times the number of results of a query in every list,
+     *                         the larger it is the higher the recall; 0 disables the prefilter.
+     */
+    void set_binary_prefilter(const BinaryLists *binary_lists, const len_t expansion_factor);
+
     /**
      * Searches all lists of a query selected for probing
      * to find the query's nearest neighbors.
      *
+     * Lists whose distances to the centroid are stored (see StorageLists::set_centroid_distances())
+     * are pruned with the triangle inequality if the query has been preassigned by the RootIndex,
+     * see scan_list_pruned(); the results are the same. The binary prefilter takes precedence.
+     *
      * @param query A pointer to a query object.
      * @return A vector of query results.
      */
@@ -132,8 +309,57 @@ namespace ann_dkvs
      */
     QueryResultsBatch batch_search_preassigned(const QueryBatch &queries) const;
 
+    /**
+     * Same as batch_search_preassigned(), but list-major: every list is scanned once
+     * for all queries of the batch which probe it, and the lists are distributed among the threads.
+     * Worth it for large batches, where many queries share lists.
+     *
+     * @param queries A batch of queries, i.e. a vector of query objects.
+     * @return A batch of query results,
+     *          i.e. a vector of vectors of query results.
+     */
+    QueryResultsBatch batch_search_preassigned_by_list(const QueryBatch &queries) const;
+
 
-    QueryResults search_preassigned_bpm(const Query *query, BufferPoolManager* bpm) const;
-    QueryResultsBatch batch_search_preassigned_bpm(const QueryBatch &queries, BufferPoolManager* bpm) const;
+    /**
+     * Two-stage search: the compressed lists of the probed lists are scanned for a shortlist of
+     * n_shortlist candidates (see PQIndex::shortlist()), then only the vectors of the shortlist are read
+     * from the lists and re-ranked with their exact distances, so the results have exact distances
+     * although a few hundred vectors are read instead of whole lists.
+     * The vectors are read from the memory-mapped lists, i.e. only their pages are faulted in.
+     *
+     * @param query A pointer to a query object.
+     * @param compressed_index The index of the lists compressed by PQLists::add_lists().
+     * @param n_shortlist The number of candidates of the compressed search, at least the query's number of results.
+     * @return A vector of query results.
+     */
+    QueryResults search_two_stage(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist) const;
+    QueryResultsBatch batch_search_two_stage(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist) const;
+
+    /**
+     * Same as search_two_stage() and batch_search_two_stage(), reading the lists of the shortlist through a buffer pool:
+     * a resident list is pinned once for all of its candidates, the candidates of other lists are read one by one,
+     * so the re-ranking neither loads whole lists nor evicts the cached ones.
+     */
+    template <class BufferPool>
+    QueryResults search_two_stage_bpm(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist, BufferPool *bpm) const;
+    template <class BufferPool>
+    QueryResultsBatch batch_search_two_stage_bpm(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist, BufferPool *bpm) const;
+
+    /**
+     * Same as search_preassigned() and batch_search_preassigned(), reading the lists through a buffer pool.
+     * Instantiated for BufferPoolManager, SharedBufferPool and MappedBufferPool.
+     */
+    template <class BufferPool>
+    QueryResults search_preassigned_bpm(const Query *query, BufferPool* bpm) const;
+    template <class BufferPool>
+    QueryResultsBatch batch_search_preassigned_bpm(const QueryBatch &queries, BufferPool* bpm) const;
+
+    /**
+     * Same as batch_search_preassigned_by_list(), reading the lists through a buffer pool:
+     * every list is fetched and pinned once per batch.
+     */
+    template <class BufferPool>
+    QueryResultsBatch batch_search_preassigned_by_list_bpm(const QueryBatch &queries, BufferPool* bpm) const;
   };
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 #include <string>
@@ -9,6 +13,7 @@
 #include <boost/serialization/string.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/version.hpp>
 
 #include "types.hpp"
 
@@ -41,6 +46,10 @@ namespace ann_dkvs
      * that the list can hold without having to be extended.
      * - used_entries: number of entries currently
      *  in use and containing valid data (vectors and vector ids)
+     *
+     * The vectors of a list are followed by its vector ids and,
+     * if has_norms(), by the squared norms of its vectors,
+     * each holding allocated_entries entries.
      */
     struct InvertedList
     { 
@@ -73,6 +82,44 @@ namespace ann_dkvs
       size_t size;
     };
 
+    /**
+     * Versions of the inverted lists, shared with readers which cache the lists
+     * outside of the memory-mapped region (e.g. the buffer pool) so that they
+     * can detect lists which have been relocated or modified.
+     *
+     * - version: incremented on every mutation of any list
+     * - list_versions: version of the last mutation of every list,
+     *   lists which have never been mutated have version 0
+     * - latch: protects list_versions and id_to_list_map against concurrent
+     *   readers, mutations are assumed to come from a single thread
+     */
+    struct ListDirectory
+    {
+      std::atomic<uint64_t> version{0};
+      std::unordered_map<list_id_t, uint64_t> list_versions;
+      mutable std::shared_mutex latch;
+    };
+
+    /**
+     * Distances of the vectors of an inverted list to its centroid, see set_centroid_distances().
+     *
+     * - distances: one per used entry, in the order of the entries
+     * - sorted: whether the entries are sorted by their distance
+     * - list_version: version of the list when the distances were computed,
+     *   they are outdated as soon as the list is mutated
+     */
+    struct CentroidDistances
+    {
+      template <class Archive>
+      void serialize(Archive & ar, const unsigned int /*version*/){
+        ar & distances;
+        ar & sorted;
+      }
+      std::vector<distance_t> distances;
+      bool sorted;
+      uint64_t list_version;
+    };
+
     /**
      * A type that represents a map from list ids to inverted lists.
      */
@@ -170,6 +217,26 @@ namespace ann_dkvs
      */
     std::string get_filename() const;
 
+    /**
+     * Returns the version of the list directory, which is incremented
+     * on every mutation of any list. Readers compare it with the version
+     * they have last seen to skip revalidating their cached lists.
+     *
+     * @return The version of the directory.
+     */
+    uint64_t get_version() const;
+
+    /**
+     * Returns the location and the version of the given list,
+     * consistent with concurrent mutations of the directory.
+     *
+     * @param list_id The id of the list.
+     * @param list Receives the location and length of the list.
+     * @param version Receives the version of the last mutation of the list.
+     * @return False if the list does not exist.
+     */
+    bool get_list_snapshot(const list_id_t list_id, InvertedList &list, uint64_t &version) const;
+
     /**
      * Returns a pointer to the vectors of the given list.
      *
@@ -179,6 +246,61 @@ namespace ann_dkvs
      */
     const vector_el_t *get_vectors(const list_id_t list_id) const;
 
+    /**
+     * Returns whether the squared norms of the vectors are stored
+     * alongside every list. They are stored in new files,
+     * lists saved without them keep their layout.
+     *
+     * @return True if the norms are stored.
+     */
+    bool has_norms() const;
+
+    /**
+     * Returns the storage format of the components of the vectors,
+     * e.g. "float32", "fp16" or "uint8" (see vector_el_t).
+     *
+     * @return The name of the format.
+     */
+    const std::string &get_vector_el_name() const;
+
+    /**
+     * Returns a pointer to the squared norms of the vectors of the given list,
+     * used by the block distance kernels.
+     *
+     * @param list_id The id of the list.
+     * @return A pointer to the norm of the first vector of the list,
+     *         nullptr if the norms are not stored.
+     * @throws std::invalid_argument If the list does not exist.
+     */
+    const distance_t *get_norms(const list_id_t list_id) const;
+
+    /**
+     * Computes the distance of every vector to the centroid of its list, used to prune the scans
+     * with the triangle inequality (see StorageIndex::search_preassigned()). The distances are kept
+     * in memory and saved with the archive, they are dropped for lists which are modified afterwards.
+     *
+     * If sort_lists is true, the entries of every list are also reordered by their distance to the centroid,
+     * so that a scan can skip whole ranges of entries. The entries are rewritten in place, so codes which refer
+     * to the entries by their offset (e.g. BinaryLists, PQLists) must be built after the lists have been sorted.
+     *
+     * @param centroids The centroids of the lists, vector_dim components each, indexed by list id,
+     *                  the same as the ones of the RootIndex.
+     * @param sort_lists Whether to sort the entries of the lists by their distance to the centroid.
+     */
+    void set_centroid_distances(const vector_el_t *centroids, const bool sort_lists);
+
+    /**
+     * Returns the distances of the vectors of the given list to its centroid (not squared),
+     * see set_centroid_distances().
+     *
+     * @param list_id The id of the list.
+     * @param length The number of entries the caller is about to scan.
+     * @param sorted Receives whether the entries are sorted by their distance.
+     * @return A pointer to the distance of the first vector of the list, nullptr if the distances
+     *         have not been computed, if the list has been modified since or if it does not have length entries.
+     */
+    const distance_t *get_centroid_distances(const list_id_t list_id, const len_t length, bool &sorted) const;
+
     /**
      * Returns a pointer to the ids of the given list.
      *
@@ -251,6 +373,8 @@ namespace ann_dkvs
      * are expected to be stored consecutively in the following format:
      * - vectors: vector_dim * sizeof(vector_el_t) bytes per vector,
      *            the vector dimension is to be specified in the constructor.
+     *            If vector_el_t is not float, a file of floats (vector_dim * 4 bytes per vector)
+     *            is also accepted, its components are converted with to_vector_el().
      * - vector ids: sizeof(vector_id_t) bytes per id
      * - list ids: sizeof(list_id_t) bytes per id
      *
@@ -262,6 +386,15 @@ namespace ann_dkvs
      * @param n_entries The number of entries to insert.
      */
     void bulk_insert_entries(const std::string &vectors_filename, const std::string &vector_ids_filename, const std::string &list_ids_filename, const len_t n_entries);
+
+    /**
+     * Converts a float component to vector_el_t,
+     * rounded and clamped to its range if vector_el_t is an integer type, rounded to nearest even if it is half precision.
+     *
+     * @param value The component.
+     * @return The component as vector_el_t.
+     */
+    static vector_el_t to_vector_el(const float value);
   
   
   private:
@@ -276,6 +409,47 @@ namespace ann_dkvs
       // ar & base_ptr;
       ar & id_to_list_map;
       ar & free_slots;
+      /** Archives of version 0 have been saved without norms. */
+      if (version >= 1)
+      {
+        ar & store_norms;
+      }
+      else
+      {
+        store_norms = false;
+      }
+      /** Archives before version 2 have been saved by float32 builds. */
+      if (version >= 2)
+      {
+        ar & vector_el_name;
+      }
+      else
+      {
+        vector_el_name = "float32";
+      }
+      if (vector_el_name != VECTOR_EL_NAME)
+      {
+        throw std::runtime_error("The lists have been saved with " + vector_el_name + " components, this build stores " VECTOR_EL_NAME " components");
+      }
+      /**
+       * Archives before version 3 have been saved without centroid distances.
+       * Only the distances of unmodified lists are saved, and the versions of the lists restart at 0 once loaded.
+       */
+      if (Archive::is_saving::value)
+      {
+        discard_outdated_centroid_distances();
+      }
+      if (version >= 3)
+      {
+        ar & centroid_distances;
+      }
+      if (Archive::is_loading::value)
+      {
+        for (auto &list_distances : centroid_distances)
+        {
+          list_distances.second.list_version = 0;
+        }
+      }
     }
 
     /**
@@ -294,6 +468,31 @@ namespace ann_dkvs
      */
     size_t vector_size;
 
+    /**
+     * Specifies whether the squared norms of the vectors
+     * are stored after the vector ids of every list.
+     * The kernels of components other than float do not use them.
+     */
+    bool store_norms = std::is_same<vector_el_t, float>::value;
+
+    /**
+     * Storage format of the components (VECTOR_EL_NAME),
+     * archives of another format cannot be loaded.
+     */
+    std::string vector_el_name = VECTOR_EL_NAME;
+
+    /**
+     * Versions of the lists. Shared by copies of this object,
+     * as they refer to the same file.
+     */
+    std::shared_ptr<ListDirectory> directory = std::make_shared<ListDirectory>();
+
+    /**
+     * Distances of the vectors to the centroids of their lists, by list id.
+     * See set_centroid_distances().
+     */
+    std::unordered_map<list_id_t, CentroidDistances> centroid_distances;
+
     /**
      * In-memory data structure that holds a list of free slots
      * in the memory-mapped file.
@@ -333,6 +532,16 @@ namespace ann_dkvs
      */
     vector_id_t *get_ids_by_list(const InvertedList *list) const;
 
+    /**
+     * Returns a pointer to the first squared norm within the memory region
+     * associated with the given inverted list.
+     *
+     * @param list A pointer to the inverted list
+     *             for which the norms are being requested.
+     * @return A pointer to the first norm, nullptr if the norms are not stored.
+     */
+    distance_t *get_norms_by_list(const InvertedList *list) const;
+
     /**
      * Returns total size by the given amount of vector ids
      * when they are stored contiguously in memory.
@@ -351,6 +560,15 @@ namespace ann_dkvs
      */
     size_t get_vectors_size(const len_t n_entries) const;
 
+    /**
+     * Returns total size by the given amount of squared norms
+     * when they are stored contiguously in memory, 0 if they are not stored.
+     *
+     * @param n_entries The number of norms.
+     * @return The total size in bytes.
+     */
+    size_t get_norms_size(const len_t n_entries) const;
+
     /**
      * Returns total size by the given amount of list ids
      * when they are stored contiguously in memory.
@@ -547,6 +765,35 @@ namespace ann_dkvs
      */
     Slot *to_slot(const slot_it_t it) const;
 
+    /**
+     * Stores the given location of a list in the directory
+     * and increments its version.
+     *
+     * @param list_id The id of the list.
+     * @param list The new location and length of the list.
+     */
+    void commit_list(const list_id_t list_id, const InvertedList &list);
+
+    /**
+     * Increments the version of the given list after its entries
+     * have been modified in place.
+     *
+     * @param list_id The id of the list.
+     */
+    void bump_list_version(const list_id_t list_id) const;
+
+    /**
+     * Returns the version of the last mutation of the given list, 0 if it has never been mutated.
+     *
+     * @param list_id The id of the list.
+     */
+    uint64_t get_list_version(const list_id_t list_id) const;
+
+    /**
+     * Removes the centroid distances of the lists which have been modified since they were computed.
+     */
+    void discard_outdated_centroid_distances();
+
     /**
      * Grows the memory-mapped region until it is large enough to hold
      * at least the given number of entries.
@@ -574,4 +821,6 @@ namespace ann_dkvs
      */
     std::ifstream open_filestream(const std::string &filename) const;
   };
-}
\ No newline at end of file
+}
+
+BOOST_CLASS_VERSION(ann_dkvs::StorageLists, 3)
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstring>
+
+namespace ann_dkvs
+{
+  /**
+   * Half precision components, the storage format of the lists with -DVECTOR_EL_FP16=1 or -DVECTOR_EL_BF16=1.
+   * They are only stored, every computation converts them to float, so they can be used like floats.
+   * The SIMD kernels widen them on the fly (see L2Kernels.hpp).
+   */
+
+  /** IEEE 754 binary16: 1 sign, 5 exponent and 10 mantissa bits. */
+  struct float16_t
+  {
+    unsigned short bits;
+
+    float16_t() = default;
+    float16_t(float value) : bits(from_float(value)) {}
+    operator float() const { return to_float(bits); }
+
+    static unsigned short from_float(float value)
+    {
+      unsigned int f;
+      memcpy(&f, &value, sizeof(f));
+      unsigned int sign = (f >> 16) & 0x8000;
+      unsigned int abs = f & 0x7fffffff;
+      if (abs >= 0x7f800000)
+      {
+        /** Infinity, or a quiet NaN. */
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+      }
+      if (abs >= 0x477ff000)
+      {
+        /** Rounds to a value above 65504. */
+        return sign | 0x7c00;
+      }
+      if (abs < 0x38800000)
+      {
+        /** Subnormal: align the mantissa (with its implicit bit) to 2^-24, rounding to nearest even. */
+        if (abs < 0x33000000)
+        {
+          return sign;
+        }
+        unsigned int shift = 126 - (abs >> 23);
+        unsigned int mantissa = (abs & 0x7fffff) | 0x800000;
+        unsigned int half = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+        {
+          half++;
+        }
+        return sign | half;
+      }
+      /** Normal: rebias the exponent and round the mantissa to nearest even. */
+      unsigned int half = ((abs - 0x38000000) + 0xfff + ((abs >> 13) & 1)) >> 13;
+      return sign | half;
+    }
+
+    static float to_float(unsigned short half)
+    {
+      unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+      unsigned int exponent = (half >> 10) & 0x1f;
+      unsigned int mantissa = half & 0x3ff;
+      unsigned int f;
+      if (exponent == 0x1f)
+      {
+        f = sign | 0x7f800000 | (mantissa << 13);
+      }
+      else if (exponent != 0)
+      {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+      }
+      else if (mantissa != 0)
+      {
+        /** Subnormal: normalize the mantissa. */
+        exponent = 113;
+        while ((mantissa & 0x400) == 0)
+        {
+          mantissa <<= 1;
+          exponent--;
+        }
+        f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+      }
+      else
+      {
+        f = sign;
+      }
+      float value;
+      memcpy(&value, &f, sizeof(value));
+      return value;
+    }
+  };
+
+  /** bfloat16: the upper half of a float, 8 exponent and 7 mantissa bits. */
+  struct bfloat16_t
+  {
+    unsigned short bits;
+
+    bfloat16_t() = default;
+    bfloat16_t(float value) : bits(from_float(value)) {}
+    operator float() const { return to_float(bits); }
+
+    static unsigned short from_float(float value)
+    {
+      unsigned int f;
+      memcpy(&f, &value, sizeof(f));
+      if ((f & 0x7fffffff) > 0x7f800000)
+      {
+        /** Quiet NaN, rounding could turn it into infinity. */
+        return (f >> 16) | 0x40;
+      }
+      return (f + 0x7fff + ((f >> 16) & 1)) >> 16;
+    }
+
+    static float to_float(unsigned short half)
+    {
+      unsigned int f = (unsigned int)half << 16;
+      float value;
+      memcpy(&value, &f, sizeof(value));
+      return value;
+    }
+  };
+}
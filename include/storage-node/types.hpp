@@ -3,12 +3,36 @@
 #include <vector>
 #include <cassert>
 
+#include "float16.hpp"
+
 namespace ann_dkvs
 {
   // 1 byte
   typedef unsigned char uint8_t;
+  /**
+   * Components of the vectors: float by default, or 1 byte when the whole tree is built with
+   * -DVECTOR_EL_UINT8=1 (e.g. SIFT / BIGANN) or -DVECTOR_EL_INT8=1, which makes the lists file,
+   * the reads and the frames 4x smaller, or half precision floats with -DVECTOR_EL_FP16=1
+   * or -DVECTOR_EL_BF16=1, 2x smaller. Distances are always float.
+   * VECTOR_EL_NAME is recorded in the metadata of the lists.
+   */
+#if VECTOR_EL_UINT8
+  typedef unsigned char vector_el_t;
+  #define VECTOR_EL_NAME "uint8"
+#elif VECTOR_EL_INT8
+  typedef signed char vector_el_t;
+  #define VECTOR_EL_NAME "int8"
+#elif VECTOR_EL_FP16
+  typedef float16_t vector_el_t;
+  #define VECTOR_EL_NAME "fp16"
+#elif VECTOR_EL_BF16
+  typedef bfloat16_t vector_el_t;
+  #define VECTOR_EL_NAME "bf16"
+#else
   // 4 bytes
   typedef float vector_el_t;
+  #define VECTOR_EL_NAME "float32"
+#endif
   typedef float distance_t;
   // 8 bytes
   typedef unsigned long len_t;
@@ -21,6 +45,7 @@ namespace ann_dkvs
    * My defination.
   */
   typedef int64_t frame_id_t; 
+  typedef int64_t index_id_t;
   // typedef int64_t list_id_t;
   // typedef int64_t vector_el_t;
   // typedef int64_t vector_id_t;
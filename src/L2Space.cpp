@@ -1,20 +1,114 @@
 #include "L2Space.hpp"
 
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
 namespace ann_dkvs
 {
 
-  L2Space::L2Space(size_t vector_dim) : vector_dim(vector_dim)
+#if defined(__x86_64__) || defined(__i386__)
+  float L2SqrSSE4(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
   {
-    distance_func = L2Sqr;
+    return L2SqrKernelSSE4<0>((const vector_el_t *)pVect1v, (const vector_el_t *)pVect2v, *((size_t *)qty_ptr));
+  }
+
+  float L2SqrAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    return L2SqrKernelAVX2<0>((const vector_el_t *)pVect1v, (const vector_el_t *)pVect2v, *((size_t *)qty_ptr));
+  }
+
+  float L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
+  {
+    return L2SqrKernelAVX512<0>((const vector_el_t *)pVect1v, (const vector_el_t *)pVect2v, *((size_t *)qty_ptr));
+  }
+#endif
+
+  template <SimdLevel LEVEL>
+  static void L2SqrBlock(const vector_el_t *query, distance_t query_norm, const vector_el_t *vectors,
+                         const distance_t *norms, len_t n, size_t dim, distance_t *distances)
+  {
+    L2Distance<0, LEVEL>::compute_block(query, query_norm, vectors, norms, n, dim, distances);
+  }
+
+  static SimdLevel detect_simd_level()
+  {
+    SimdLevel level = SimdLevel::SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+      level = SimdLevel::SSE4;
+    }
+    /** The kernels of fp16 vectors also need F16C. */
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && (!std::is_same<vector_el_t, float16_t>::value || __builtin_cpu_supports("f16c")))
+    {
+      level = SimdLevel::AVX2;
+    }
+    /** The kernels of 1-byte vectors also need AVX512BW. */
+    if (__builtin_cpu_supports("avx512f") && (sizeof(vector_el_t) != 1 || __builtin_cpu_supports("avx512bw")))
+    {
+      level = SimdLevel::AVX512;
+    }
+#endif
+
+    const char *cap = getenv("ANN_DKVS_SIMD");
+    if (cap != nullptr)
+    {
+      for (SimdLevel capped : {SimdLevel::SCALAR, SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512})
+      {
+        if (strcmp(cap, L2Space::get_simd_level_name(capped)) == 0 && capped < level)
+        {
+          level = capped;
+        }
+      }
+    }
+    return level;
+  }
+
+  SimdLevel L2Space::get_simd_level()
+  {
+    static const SimdLevel level = detect_simd_level();
+    return level;
+  }
 
-#ifdef __AVX__
-    if (vector_dim % 16 == 0)
+  const char *L2Space::get_simd_level_name(SimdLevel level)
+  {
+    switch (level)
     {
-      distance_func = L2SqrSIMD16ExtAVX;
+    case SimdLevel::SSE4:
+      return "sse4";
+    case SimdLevel::AVX2:
+      return "avx2";
+    case SimdLevel::AVX512:
+      return "avx512";
+    default:
+      return "scalar";
     }
-    else if (vector_dim > 16)
+  }
+
+  L2Space::L2Space(size_t vector_dim) : vector_dim(vector_dim)
+  {
+    distance_func = L2Sqr;
+    distance_block_func = L2SqrBlock<SimdLevel::SCALAR>;
+
+#if defined(__x86_64__) || defined(__i386__)
+    switch (get_simd_level())
     {
-      distance_func = L2SqrSIMD16ExtResiduals;
+    case SimdLevel::AVX512:
+      distance_func = L2SqrAVX512;
+      distance_block_func = L2SqrBlock<SimdLevel::AVX512>;
+      break;
+    case SimdLevel::AVX2:
+      distance_func = L2SqrAVX2;
+      distance_block_func = L2SqrBlock<SimdLevel::AVX2>;
+      break;
+    case SimdLevel::SSE4:
+      distance_func = L2SqrSSE4;
+      distance_block_func = L2SqrBlock<SimdLevel::SSE4>;
+      break;
+    default:
+      break;
     }
 #endif
   }
@@ -24,6 +118,11 @@ namespace ann_dkvs
     return distance_func;
   }
 
+  distance_block_func_t L2Space::get_distance_block_func() const
+  {
+    return distance_block_func;
+  }
+
   len_t L2Space::get_vector_dim() const
   {
     return vector_dim;
@@ -2,9 +2,9 @@
 
 namespace ann_dkvs
 {
-  Query::Query(vector_el_t *query_vector, const len_t n_results, const len_t n_probes) : query_vector(query_vector), list_to_probe(new list_id_t[n_probes]), n_results(n_results), n_probes(n_probes), free_list_to_probe(true) {}
+  Query::Query(vector_el_t *query_vector, const len_t n_results, const len_t n_probes) : query_vector(query_vector), list_to_probe(new list_id_t[n_probes]), probe_distances(n_probes, -1), n_results(n_results), n_probes(n_probes), free_list_to_probe(true) {}
   Query::Query(vector_el_t *query_vector, list_id_t *list_to_probe, const len_t n_results, const len_t n_probes)
-      : query_vector(query_vector), list_to_probe(list_to_probe), n_results(n_results), n_probes(n_probes) {}
+      : query_vector(query_vector), list_to_probe(list_to_probe), probe_distances(n_probes, -1), n_results(n_results), n_probes(n_probes) {}
   vector_el_t *Query::get_query_vector() const { return query_vector; }
   list_id_t Query::get_list_to_probe(const len_t i) const
   {
@@ -23,6 +23,15 @@ namespace ann_dkvs
     assert(offset < n_probes);
     list_to_probe[offset] = list_id;
   }
+  distance_t Query::get_probe_distance(const len_t i) const
+  {
+    return probe_distances[i];
+  }
+  void Query::set_probe_distance(const len_t offset, const distance_t distance)
+  {
+    assert(offset < n_probes);
+    probe_distances[offset] = distance;
+  }
   Query::~Query()
   {
     if (free_list_to_probe)
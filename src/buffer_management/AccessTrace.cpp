@@ -0,0 +1,73 @@
+#include "buffer_management/AccessTrace.hpp"
+#include <stdexcept>
+#include <iostream>
+
+namespace ann_dkvs {
+TraceRecorder::TraceRecorder(const std::string& filename, const TraceHeader& header)
+    : start_time_(std::chrono::steady_clock::now()) {
+
+    trace_file_ = fopen(filename.c_str(), "wb");
+    if (trace_file_ == nullptr) {
+        std::cout << "WARNING: Cannot open trace file " << filename << std::endl;
+    } else {
+        fwrite(&header, sizeof(TraceHeader), 1, trace_file_);
+    }
+    buffer_.reserve(TRACE_BUFFER_SIZE);
+}
+
+void TraceRecorder::Record(list_id_t list_id, int page_num) {
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time_).count();
+
+    std::scoped_lock<std::mutex> lock(latch_);
+    buffer_.push_back(TraceRecord{(uint32_t) list_id, (uint32_t) page_num, timestamp});
+    if (buffer_.size() >= TRACE_BUFFER_SIZE) {
+        FlushInternal();
+    }
+}
+
+void TraceRecorder::FlushInternal() {
+    if (trace_file_ != nullptr && !buffer_.empty()) {
+        fwrite(buffer_.data(), sizeof(TraceRecord), buffer_.size(), trace_file_);
+    }
+    buffer_.clear();
+}
+
+void TraceRecorder::Flush() {
+    std::scoped_lock<std::mutex> lock(latch_);
+    FlushInternal();
+    if (trace_file_ != nullptr) {
+        fflush(trace_file_);
+    }
+}
+
+TraceRecorder::~TraceRecorder() {
+    Flush();
+    if (trace_file_ != nullptr) {
+        fclose(trace_file_);
+    }
+}
+
+std::vector<TraceRecord> ReadTrace(const std::string& filename, TraceHeader* header) {
+    FILE* trace_file = fopen(filename.c_str(), "rb");
+    if (trace_file == nullptr) {
+        throw std::runtime_error("Could not open trace file " + filename);
+    }
+    TraceHeader file_header;
+    if (fread(&file_header, sizeof(TraceHeader), 1, trace_file) != 1 || file_header.magic != TRACE_MAGIC) {
+        fclose(trace_file);
+        throw std::runtime_error("Missing trace header in " + filename);
+    }
+    if (header != nullptr) {
+        *header = file_header;
+    }
+    std::vector<TraceRecord> records;
+    std::vector<TraceRecord> buffer(TRACE_BUFFER_SIZE);
+    size_t read_num;
+    while ((read_num = fread(buffer.data(), sizeof(TraceRecord), buffer.size(), trace_file)) > 0) {
+        records.insert(records.end(), buffer.begin(), buffer.begin() + read_num);
+    }
+    fclose(trace_file);
+    return records;
+}
+
+}
@@ -1,21 +1,33 @@
 #include "buffer_management/BufferPoolManager.hpp"
+#include "L2Space.hpp"
 #include <cassert>
 #include <math.h>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <linux/falloc.h>
 
 namespace ann_dkvs {
-BufferPoolManager::BufferPoolManager(size_t pool_size, const StorageLists* lists, std::string filename)
-    : pool_size_(pool_size) {
-    
-    /** Binary mode to read. */
-    // db_io_.open(filename, std::ios::binary | std::ios::in);
-    // assert(db_io_.is_open() || !"Cannot open the lists file on disk!");
-    db_io_ = open(filename.c_str(), O_RDONLY);
-    int flags = fcntl(db_io_, F_GETFL, 0);
-    fcntl(db_io_, F_SETFL, flags | O_NONBLOCK);
-    assert(db_io_ != -1 || !"Cannot open the lists file on disk!");
+BufferPoolManager::BufferPoolManager(size_t pool_size, const StorageLists* lists, std::string filename, SecondaryCache* secondary_cache)
+    : pool_size_(pool_size), secondary_cache_(secondary_cache) {
+
+    arena_fd_ = memfd_create("bpm_frames", MFD_CLOEXEC);
+    assert(arena_fd_ != -1 || !"Cannot create the memory file of the frames!");
+    size_t system_page_size = sysconf(_SC_PAGESIZE);
+    page_stride_ = (sizeof(Page) + system_page_size - 1) / system_page_size * system_page_size;
 
-    pages_ = new Page[pool_size_];
+    pages_capacity_ = pool_size_;
+    pages_ = new Page*[pages_capacity_];
+    for (size_t i = 0; i < pool_size_; i++) {
+        pages_[i] = AllocatePage(i);
+    }
     replacer_ = new ClockReplacer(pool_size_);
     free_num_ = pool_size_;
     
@@ -24,24 +36,187 @@ BufferPoolManager::BufferPoolManager(size_t pool_size, const StorageLists* lists
         free_list_.push_back(true);
     }
 
-    size_t vector_size = lists->get_vector_size(); 
+    AddIndex(lists, filename, 0, SIZE_MAX);
+}
+
+index_id_t BufferPoolManager::AddIndex(const StorageLists* lists, const std::string& filename, size_t min_frames, size_t max_frames) {
+    IndexInfo index;
+    index.lists = lists;
+    index.min_frames = min_frames;
+    index.max_frames = max_frames;
+
+    /** Binary mode to read. */
+    // db_io_.open(filename, std::ios::binary | std::ios::in);
+    // assert(db_io_.is_open() || !"Cannot open the lists file on disk!");
+    index.db_io = open(filename.c_str(), O_RDONLY);
+    int flags = fcntl(index.db_io, F_GETFL, 0);
+    fcntl(index.db_io, F_SETFL, flags | O_NONBLOCK);
+    assert(index.db_io != -1 || !"Cannot open the lists file on disk!");
+    if (io_max_read_bytes_ > 0) {
+        index.io_scheduler = new IoScheduler(index.db_io, io_max_read_bytes_, io_max_gap_bytes_, io_max_batches_, &stats_);
+    }
+
+    index_id_t index_id = indexes_.size();
+    /** Read the version first, so that lists modified while the directory is copied are revalidated. */
+    index.directory_version = lists->get_version();
+    indexes_.push_back(index);
     for (size_t i = 0; i < NUM_LISTS; i++) {
-        /** Initialize the hash table: list_id => list_size. */
-        size_t list_size = lists->get_list_length(i);
-        // size_t list_pages_size = ceil( list_size / (double) 56.0 );
-        hash_to_list_size_.insert(std::make_pair((list_id_t) i, list_size));
+        StorageLists::InvertedList list;
+        uint64_t version;
+        bool list_found = lists->get_list_snapshot(i, list, version);
+        assert(list_found || !"Cannot find the list id from the disk file!");
+
+        SetListLocation(ListKey(index_id, i), list, version);
+        hash_to_buffer_pages_.insert(std::make_pair(ListKey(index_id, i), -1));
+    }
+    return index_id;
+}
+
+index_id_t BufferPoolManager::RegisterIndex(const StorageLists* lists, size_t min_frames, size_t max_frames) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    assert(indexes_.size() < MAX_INDEX_NUM || !"Too many indexes in the buffer pool!");
+    size_t reserved_frames = min_frames;
+    for (const IndexInfo& index : indexes_) {
+        reserved_frames += index.min_frames;
+    }
+    if (reserved_frames > pool_size_) {
+        std::cout << "WARNING: The minimum quotas of the indexes exceed the buffer pool." << std::endl;
+        return -1;
+    }
+    return AddIndex(lists, lists->get_filename(), min_frames, max_frames);
+}
 
-        /** Initialize the hash table: list_id => (vectors_offset, ids_offset). */
-        StorageLists::list_id_list_map_t::const_iterator list_it = lists->id_to_list_map.find(i);
-        assert(list_it != lists->id_to_list_map.end() || !"Cannot find the list id from the disk file!");
+bool BufferPoolManager::SetIndexQuota(index_id_t index_id, size_t min_frames, size_t max_frames) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    size_t reserved_frames = min_frames;
+    for (size_t i = 0; i < indexes_.size(); i++) {
+        reserved_frames += (index_id_t) i == index_id ? 0 : indexes_[i].min_frames;
+    }
+    if (reserved_frames > pool_size_) {
+        return false;
+    }
+    indexes_[index_id].min_frames = min_frames;
+    indexes_[index_id].max_frames = max_frames;
+    return true;
+}
 
-        const StorageLists::InvertedList *list = &list_it->second;
-        size_t vectors_offset = list->offset;
-        size_t ids_offset = list->offset + vector_size * list->allocated_entries;
+void BufferPoolManager::SetListLocation(list_id_t list_id, const StorageLists::InvertedList& list, uint64_t version) {
+    /** Initialize the hash table: list_id => list_size. */
+    hash_to_list_size_[list_id] = list.used_entries;
 
-        hash_to_disk_vectors_.insert(std::make_pair( (list_id_t) i, std::make_pair(vectors_offset, ids_offset)) );
-        hash_to_buffer_pages_.insert(std::make_pair((list_id_t) i, -1));
+    /** Initialize the hash table: list_id => (vectors_offset, ids_offset). */
+    size_t vectors_offset = list.offset;
+    size_t ids_offset = list.offset + indexes_[KeyIndex(list_id)].lists->get_vector_size() * list.allocated_entries;
+    hash_to_disk_vectors_[list_id] = std::make_pair(vectors_offset, ids_offset);
+    const StorageLists* lists = indexes_[KeyIndex(list_id)].lists;
+    hash_to_disk_norms_[list_id] = lists->has_norms() ? ids_offset + sizeof(vector_id_t) * list.allocated_entries : 0;
+    hash_to_list_version_[list_id] = version;
+}
+
+void BufferPoolManager::RevalidateList(list_id_t list_id) {
+    /** Nothing has been modified since the pool was opened, which is the common case when serving only. */
+    IndexInfo& index = indexes_[KeyIndex(list_id)];
+    if (index.lists->get_version() == index.directory_version) {
+        return;
     }
+    /** Only this list is checked, a single lookup in the directory. */
+    RevalidateListLocation(list_id);
+}
+
+void BufferPoolManager::RevalidateListLocation(list_id_t list_id) {
+    const IndexInfo& index = indexes_[KeyIndex(list_id)];
+    StorageLists::InvertedList list;
+    uint64_t version;
+    if (!index.lists->get_list_snapshot(KeyList(list_id), list, version) || version == hash_to_list_version_.at(list_id)) {
+        return;
+    }
+    /** The loader has read the previous location, the list is checked again once it is loaded. */
+    if (in_flight_.find(list_id) != in_flight_.end()) {
+        return;
+    }
+
+    frame_id_t frame_id = hash_to_buffer_pages_[list_id];
+    if (frame_id != -1) {
+        /** Readers hold the frames, so the previous version is served until they are unpinned. */
+        if (pages_[frame_id]->pin_count_ != 0) {
+            return;
+        }
+        /** The list has been relocated or overwritten by someone else, its old location must not be written. */
+        for (int i = 0; i < pages_[frame_id]->list_size_; i++) {
+            if (pages_[frame_id + i]->dirty_) {
+                std::cout << "WARNING: List " << KeyList(list_id) << " of index " << KeyIndex(list_id) << " was modified in the lists file while it had unflushed appends, they are dropped." << std::endl;
+                pages_[frame_id + i]->dirty_ = false;
+            }
+        }
+        ReleaseList(frame_id, false);
+        unpin_cv_.notify_all();
+    }
+    if (secondary_cache_ != nullptr) {
+        secondary_cache_->Erase(list_id);
+    }
+    SetListLocation(list_id, list, version);
+    ThreadStats::Add(stats_.Local()->invalidations, 1);
+}
+
+Page* BufferPoolManager::AllocatePage(frame_id_t frame_id) {
+    size_t offset = frame_id * page_stride_;
+    if (offset + page_stride_ > arena_size_) {
+        arena_size_ = offset + page_stride_;
+        int truncated = ftruncate(arena_fd_, arena_size_);
+        assert(truncated == 0 || !"Cannot grow the memory file of the frames!");
+    }
+    /**
+     * Map every page on its own instead of using the heap, so that it can be released when the pool shrinks.
+     * The pages are placed behind each other if possible, so the kernel merges their mappings into one.
+    */
+    void* hint = arena_base_ == nullptr ? nullptr : arena_base_ + offset;
+    void* memory = mmap(hint, sizeof(Page), PROT_READ | PROT_WRITE, MAP_SHARED, arena_fd_, offset);
+    assert(memory != MAP_FAILED || !"Cannot map memory for a page!");
+    if (frame_id == 0) {
+        arena_base_ = (char*) memory;
+    }
+    return new (memory) Page();
+}
+
+void BufferPoolManager::ReleasePage(frame_id_t frame_id) {
+    pages_[frame_id]->~Page();
+    munmap(pages_[frame_id], sizeof(Page));
+    /** The memory of the arena is only returned to the OS when the range is punched out of the file. */
+    fallocate(arena_fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, frame_id * page_stride_, page_stride_);
+}
+
+void BufferPoolManager::MapListWindow(frame_id_t frame_id, int list_size) {
+    if (!list_views_ || list_size <= 1) {
+        return;
+    }
+    size_t vectors_bytes = FRAME_DATA_SIZE * sizeof(vector_el_t);
+    /** Reserve the address range, then replace it frame by frame with the vectors of the frames in the arena. */
+    char* window = (char*) mmap(nullptr, list_size * vectors_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    bool mapped = window != MAP_FAILED;
+    for (int i = 0; mapped && i < list_size; i++) {
+        mapped = mmap(window + i * vectors_bytes, vectors_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                      arena_fd_, (frame_id + i) * page_stride_) != MAP_FAILED;
+    }
+    if (!mapped) {
+        /** Every frame of a window is a mapping of its own, so large pools can run out of mappings. */
+        std::cout << "WARNING: Cannot map a list window, check vm.max_map_count. List views are disabled." << std::endl;
+        if (window != MAP_FAILED) {
+            munmap(window, list_size * vectors_bytes);
+        }
+        list_views_ = false;
+        return;
+    }
+    hash_to_window_[frame_id] = (vector_el_t*) window;
+}
+
+void BufferPoolManager::UnmapListWindow(frame_id_t frame_id) {
+    auto window = hash_to_window_.find(frame_id);
+    if (window == hash_to_window_.end()) {
+        return;
+    }
+    munmap(window->second, pages_[frame_id]->list_size_ * FRAME_DATA_SIZE * sizeof(vector_el_t));
+    hash_to_window_.erase(window);
 }
 
 int BufferPoolManager::ListPageSize(list_id_t list_id) {
@@ -86,20 +261,25 @@ void BufferPoolManager::AllocateFreeFrames(std::vector<frame_id_t>& found_pages,
 }
 
 void BufferPoolManager::ResetFrame(frame_id_t frame_id) {
-    pages_[frame_id].pin_count_ = 0;
-    pages_[frame_id].access_times_ = 0;
-    pages_[frame_id].list_size_ = 0;
-    pages_[frame_id].list_id_ = INVALID_LIST_ID;
+    UnmapListWindow(frame_id);
+    if (pages_[frame_id]->list_id_ != INVALID_LIST_ID) {
+        indexes_[KeyIndex(pages_[frame_id]->list_id_)].used_frames--;
+    }
+    pages_[frame_id]->pin_count_ = 0;
+    pages_[frame_id]->access_times_ = 0;
+    pages_[frame_id]->list_size_ = 0;
+    pages_[frame_id]->list_id_ = INVALID_LIST_ID;
+    pages_[frame_id]->dirty_ = false;
 
-    pages_[frame_id].ResetMemory();
+    pages_[frame_id]->ResetMemory();
 }
 
 void BufferPoolManager::AccessList(frame_id_t frame_id, int list_size) {
     for (int i = 0; i < list_size; i++) {
         assert(frame_id + i < pool_size_ || !"1: In principle a list cannot be cycled!");
 
-        pages_[frame_id + i].pin_count_++;
-        pages_[frame_id + i].access_times_++;
+        pages_[frame_id + i]->pin_count_++;
+        pages_[frame_id + i]->access_times_++;
 
         if (!replacer_->GetUsedFrame(frame_id + i)) {
             replacer_->AccessFrame(frame_id + i, false);
@@ -107,95 +287,189 @@ void BufferPoolManager::AccessList(frame_id_t frame_id, int list_size) {
         assert(replacer_->GetUsedFrame(frame_id + i) || !"Failed to set unused!");
 
         replacer_->Pin(frame_id + i);
-        if (pages_[frame_id + i].access_times_ == pages_[frame_id + i].list_size_) {
+        if (pages_[frame_id + i]->access_times_ == pages_[frame_id + i]->list_size_) {
             replacer_->AccessFrame(frame_id + i, true);
-            pages_[frame_id + i].access_times_ = 0;
+            pages_[frame_id + i]->access_times_ = 0;
         }
     }
 }
 
-void BufferPoolManager::UpdateSingleFrame(frame_id_t frame_id, size_t vectors_offset, size_t ids_offset, size_t item_num) {
+void BufferPoolManager::UpdateSingleFrame(int fd, frame_id_t frame_id, size_t vectors_offset, size_t ids_offset, size_t norms_offset, size_t item_num) {
     /** Set the content of vectors_. */
     size_t vectors_size = item_num * sizeof(vector_el_t) * DATA_DIMENSION;
     // db_io_.seekg(vectors_offset);
-    // db_io_.read((char*) pages_[frame_id].GetVectors(), vectors_size);
+    // db_io_.read((char*) pages_[frame_id]->GetVectors(), vectors_size);
     // assert(!db_io_.bad() || !"I/O error when reading file for vectors_!");
 
     // int read_count = db_io_.gcount();
     // if (read_count != vectors_size) {
     //     db_io_.clear();
-    //     pages_[frame_id].ResetMemory();
+    //     pages_[frame_id]->ResetMemory();
     //     assert("Vectors' reading bytes are inconsistent!");
     // }
 
 
-    lseek(db_io_, vectors_offset, SEEK_SET);
-    read(db_io_, (char*) pages_[frame_id].GetVectors(), vectors_size);
-    // ssize_t read_vectors = pread(db_io_, (char*) pages_[frame_id].GetVectors(), vectors_size, vectors_offset);
-    // assert(read_vectors != -1 || !"I/O error when reading file for vectors_!");
+    /** pread() does not move the shared file offset, so frames can be loaded from several threads. */
+    ssize_t read_vectors = pread(fd, (char*) pages_[frame_id]->GetVectors(), vectors_size, vectors_offset);
+    assert(read_vectors != -1 || !"I/O error when reading file for vectors_!");
     
     /** Set the content of ids_. */
     size_t ids_size = item_num * sizeof(vector_id_t);
     // db_io_.seekg(ids_offset);
-    // db_io_.read((char*) pages_[frame_id].GetIDs(), ids_size);
+    // db_io_.read((char*) pages_[frame_id]->GetIDs(), ids_size);
     // assert(!db_io_.bad() || !"I/O error when reading file for ids_!");
 
     // read_count = db_io_.gcount();
     // if (read_count != ids_size) {
     //     db_io_.clear();
-    //     pages_[frame_id].ResetMemory();
+    //     pages_[frame_id]->ResetMemory();
     //     assert("IDs' reading bytes are inconsistent!");
     // }
 
 
-    lseek(db_io_, ids_offset, SEEK_SET);
-    read(db_io_, (char*) pages_[frame_id].GetIDs(), ids_size);
-    // ssize_t read_ids = pread(db_io_, (char*) pages_[frame_id].GetIDs(), ids_size, ids_offset);
-    // assert(read_ids != -1 || !"I/O error when reading file for vectors_!");
-}
+    ssize_t read_ids = pread(fd, (char*) pages_[frame_id]->GetIDs(), ids_size, ids_offset);
+    assert(read_ids != -1 || !"I/O error when reading file for ids_!");
 
-void BufferPoolManager::UpdateFrames(std::vector<frame_id_t> frame_ids, list_id_t list_id) {
-    size_t list_size = frame_ids.size();
-    size_t vectors_start_offset = hash_to_disk_vectors_[list_id].first;
-    size_t ids_start_offset = hash_to_disk_vectors_[list_id].second;
+    ssize_t read_norms = 0;
+    if (norms_offset != 0) {
+        read_norms = pread(fd, (char*) pages_[frame_id]->GetNorms(), item_num * sizeof(distance_t), norms_offset);
+        assert(read_norms != -1 || !"I/O error when reading file for norms_!");
+    }
 
-    size_t vectors_bytes_per_page = FRAME_DATA_SIZE * sizeof(vector_el_t);
-    size_t ids_bytes_per_page = FRAME_DATA_NUM * sizeof(vector_id_t);
+    ThreadStats* stats = stats_.Local();
+    ThreadStats::Add(stats->read_syscalls, norms_offset != 0 ? 3 : 2);
+    ThreadStats::Add(stats->bytes_read, std::max(read_vectors, (ssize_t) 0) + std::max(read_ids, (ssize_t) 0) + std::max(read_norms, (ssize_t) 0));
+}
 
+void BufferPoolManager::SetFramesList(const std::vector<frame_id_t>& frame_ids, list_id_t list_id) {
+    size_t list_size = frame_ids.size();
     for (size_t i = 0; i < list_size; i++) {
         frame_id_t frame_id = frame_ids[i];
-        assert(replacer_->GetFirstFrame(frame_id) == true || !"Logical error for first_frame_ value when checking UpdateFrames()!");
+        assert(replacer_->GetFirstFrame(frame_id) == true || !"Logical error for first_frame_ value when checking SetFramesList()!");
 
-        pages_[frame_id].list_id_ = list_id;
-        pages_[frame_id].list_size_ = list_size;
+        pages_[frame_id]->list_id_ = list_id;
+        pages_[frame_id]->list_size_ = list_size;
         if (i == 0) {
             replacer_->SetFirstFrame(frame_id, true);
         } else {
             replacer_->SetFirstFrame(frame_id, false);
         }
+    }
+    indexes_[KeyIndex(list_id)].used_frames += list_size;
+}
+
+void BufferPoolManager::LoadFrames(const std::vector<frame_id_t>& frame_ids, list_id_t list_id) {
+    const IndexInfo& index = indexes_[KeyIndex(list_id)];
+    size_t list_size = frame_ids.size();
+    size_t vectors_start_offset = hash_to_disk_vectors_.at(list_id).first;
+    size_t ids_start_offset = hash_to_disk_vectors_.at(list_id).second;
+    size_t norms_start_offset = hash_to_disk_norms_.at(list_id);
+    size_t list_length = hash_to_list_size_.at(list_id);
+
+    size_t vectors_bytes_per_page = FRAME_DATA_SIZE * sizeof(vector_el_t);
+    size_t ids_bytes_per_page = FRAME_DATA_NUM * sizeof(vector_id_t);
+    size_t norms_bytes_per_page = FRAME_DATA_NUM * sizeof(distance_t);
+
+    ThreadStats* stats = stats_.Local();
+    auto start_time = std::chrono::steady_clock::now();
+
+    /** Lists in the secondary cache are already in frame format, so they are read from there. */
+    bool in_secondary = secondary_cache_ != nullptr && secondary_cache_->Contains(list_id);
+
+    /** The vectors, the ids and the norms of a list are continuous ranges of the file, each scattered over the frames. */
+    if (!in_secondary && index.io_scheduler != nullptr) {
+        std::vector<IoSegment> segments(norms_start_offset != 0 ? 3 : 2);
+        segments[0].offset = vectors_start_offset;
+        segments[1].offset = ids_start_offset;
+        if (norms_start_offset != 0) {
+            segments[2].offset = norms_start_offset;
+        }
+        for (size_t i = 0; i < list_size; i++) {
+            Page* page = pages_[frame_ids[i]];
+            size_t item_num = FRAME_DATA_NUM;
+            if (i == list_size - 1 && list_length % FRAME_DATA_NUM != 0) {
+                item_num = list_length % FRAME_DATA_NUM;
+            }
+            segments[0].buffers.push_back(iovec{page->GetVectors(), item_num * sizeof(vector_el_t) * DATA_DIMENSION});
+            segments[1].buffers.push_back(iovec{page->GetIDs(), item_num * sizeof(vector_id_t)});
+            if (norms_start_offset != 0) {
+                segments[2].buffers.push_back(iovec{page->GetNorms(), item_num * sizeof(distance_t)});
+            }
+        }
+        index.io_scheduler->Read(segments);
+        ThreadStats::AddLatency(stats->io_latency, stats->io_latency_sum, BufferPoolStats::ElapsedNs(start_time));
+        return;
+    }
+
+    for (size_t i = 0; i < list_size; i++) {
+        frame_id_t frame_id = frame_ids[i];
+
+        if (in_secondary && secondary_cache_->ReadFrame(list_id, i, pages_[frame_id])) {
+            ThreadStats::Add(stats->read_syscalls, 1);
+            ThreadStats::Add(stats->bytes_read, vectors_bytes_per_page + ids_bytes_per_page + norms_bytes_per_page);
+            continue;
+        }
 
         size_t vectors_offset = vectors_start_offset + i * vectors_bytes_per_page;
         size_t ids_offset = ids_start_offset + i * ids_bytes_per_page;
+        size_t norms_offset = norms_start_offset == 0 ? 0 : norms_start_offset + i * norms_bytes_per_page;
 
         if (i != list_size - 1) {
-            UpdateSingleFrame(frame_id, vectors_offset, ids_offset, FRAME_DATA_NUM);
+            UpdateSingleFrame(index.db_io, frame_id, vectors_offset, ids_offset, norms_offset, FRAME_DATA_NUM);
         } else {
-            size_t last_page_num = hash_to_list_size_[list_id] % FRAME_DATA_NUM;
+            size_t last_page_num = list_length % FRAME_DATA_NUM;
             size_t last_page_size = last_page_num == 0 ? FRAME_DATA_NUM : last_page_num;
-            UpdateSingleFrame(frame_id, vectors_offset, ids_offset, last_page_size);
+            UpdateSingleFrame(index.db_io, frame_id, vectors_offset, ids_offset, norms_offset, last_page_size);
         }
     }
+    ThreadStats::AddLatency(stats->io_latency, stats->io_latency_sum, BufferPoolStats::ElapsedNs(start_time));
 }
 
-std::vector<frame_id_t> BufferPoolManager::FetchListPages(list_id_t list_id) {
-    // std::scoped_lock<std::mutex> lock(latch_);
+void BufferPoolManager::WaitForLoad(list_id_t list_id, std::unique_lock<std::mutex>& lock) {
+    auto in_flight = in_flight_.find(list_id);
+    while (in_flight != in_flight_.end()) {
+        std::shared_future<void> loaded = in_flight->second;
+        ThreadStats::Add(stats_.Local()->miss_waits, 1);
+        lock.unlock();
+        loaded.wait();
+        lock.lock();
+        in_flight = in_flight_.find(list_id);
+    }
+}
+
+void BufferPoolManager::WaitForFlush(list_id_t list_id) {
+    while (flushing_lists_.find(list_id) != flushing_lists_.end()) {
+        flushed_cv_.wait(latch_);
+    }
+}
+
+std::vector<frame_id_t> BufferPoolManager::FetchListPages(index_id_t index_id, list_id_t list_id_in_index) {
+    auto start_time = std::chrono::steady_clock::now();
+    ThreadStats* stats = stats_.Local();
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    IndexInfo& index = indexes_[index_id];
+    std::unique_lock<std::mutex> lock(latch_);
 
-    total++;
-    
     frame_id_t frame_id;
     int fetch_size = ListPageSize(list_id);
     std::vector<frame_id_t> found_pages;
 
+    hash_to_access_times_[list_id]++;
+    if (trace_ != nullptr) {
+        trace_->Record(list_id, fetch_size);
+    }
+    if (mrc_ != nullptr) {
+        mrc_->AccessList(list_id, fetch_size);
+    }
+
+    /** Another thread is loading the list. Wait for it instead of reading the list a second time. */
+    WaitForLoad(list_id, lock);
+
+    /** The list is not loaded by anyone now, check that its cached location is still up to date. */
+    RevalidateList(list_id);
+    fetch_size = ListPageSize(list_id);
+
     /** Found the list in the buffer pool. */
     // auto iter = hash_to_buffer_pages_.find(list_id);
 
@@ -203,7 +477,9 @@ std::vector<frame_id_t> BufferPoolManager::FetchListPages(list_id_t list_id) {
     if (found_id != -1) {
     // if (iter != hash_to_buffer_pages_.end()) {
 
-        hit++;
+        ThreadStats::Add(stats->hits, 1);
+        stats->AddListHit(list_id);
+        index.hits++;
 
         // frame_id = iter->second;
         frame_id = found_id;
@@ -213,12 +489,27 @@ std::vector<frame_id_t> BufferPoolManager::FetchListPages(list_id_t list_id) {
             found_pages.push_back(frame_id + i);
         }
 
+        ThreadStats::AddLatency(stats->fetch_latency, stats->fetch_latency_sum, BufferPoolStats::ElapsedNs(start_time));
         return found_pages;
     }
 
     /** Didn't find the list in the buffer pool. */
+    ThreadStats::Add(stats->misses, 1);
+    stats->AddListMiss(list_id);
+    index.misses++;
     int evict_frame = -1;
 
+    /**
+     * Publish the load before looking for frames, because waiting for frames to be unpinned releases the latch.
+     * The list is only installed in hash_to_buffer_pages_ after its content is read.
+     */
+    std::promise<void> loaded;
+    in_flight_[list_id] = loaded.get_future().share();
+
+    /** Over its maximum quota, the index replaces its own lists, as long as they are not pinned. */
+    auto own_lists = [this, index_id](frame_id_t frame_id) { return KeyIndex(pages_[frame_id]->list_id_) == index_id; };
+    while (index.used_frames + fetch_size > index.max_frames && EvictList(own_lists)) {}
+
     /** Look up the free_list first. */
     if (free_num_ >= fetch_size) {
         evict_frame = LookUpFreeList(fetch_size);
@@ -226,55 +517,134 @@ std::vector<frame_id_t> BufferPoolManager::FetchListPages(list_id_t list_id) {
         if (evict_frame != -1) {
             AllocateFreeFrames(found_pages, evict_frame, fetch_size);
             frame_id = evict_frame;
+        } else {
+            ThreadStats::Add(stats->contiguous_alloc_failures, 1);
         }
     }
+
+    /** Lists of other indexes are protected while their index holds no more than its minimum quota. */
+    auto unprotected_lists = [this, index_id](frame_id_t frame_id) {
+        index_id_t owner = KeyIndex(pages_[frame_id]->list_id_);
+        return owner == index_id || indexes_[owner].used_frames >= indexes_[owner].min_frames + pages_[frame_id]->list_size_;
+    };
     /** Need to evict some pages / frames from the buffer pool. */
     while (evict_frame == -1) {
-        bool evict_success = replacer_->EvictFrame(&frame_id);
-
-        if (evict_success) {
-            int evict_size = pages_[frame_id].list_size_;
-            list_id_t evict_list_id = pages_[frame_id].list_id_;
-
-            free_list_[frame_id] = true;
-            free_num_++;
-            ResetFrame(frame_id);
-
-            /** Update the evicted frames in the free space. */
-            for (int i = 1; i < evict_size; i++) {
-                bool evict_non_first = replacer_->EvictNonFirstFrame();
-
-                assert(evict_non_first || !"Logical error when evicting non-first frames!");
-                assert(frame_id + i < pool_size_ || !"3: In principle a list cannot be cycled!");
-
-                free_list_[i + frame_id] = true;
-                free_num_++;
-                ResetFrame(i + frame_id);
-            }
-        
-            // hash_to_buffer_pages_.erase(evict_list_id);
-            hash_to_buffer_pages_[evict_list_id] = -1;
-            // std::cout << "Evict list is: " << evict_list_id << std::endl;
-
-            evict_frame = LookUpFreeList(fetch_size);
-            if (evict_frame != -1) {
-                AllocateFreeFrames(found_pages, evict_frame, fetch_size);
-            }
+        if (!EvictList(unprotected_lists) && !EvictList(nullptr)) {
+            /** Every list is pinned. Wait for UnPinListPages() instead of spinning with the latch held. */
+            unpin_cv_.wait(lock);
+        }
+        evict_frame = LookUpFreeList(fetch_size);
+        if (evict_frame != -1) {
+            AllocateFreeFrames(found_pages, evict_frame, fetch_size);
         }
     }
 
     assert(found_pages.size() == fetch_size || !"Error when setting found_pages (wrong number of result frames)!");
     assert(found_pages[0] == evict_frame || !"Logical error when allocating free frames!");
 
+    /** Pin the frames for the caller, so that they cannot be evicted during the load. */
+    SetFramesList(found_pages, list_id);
+    MapListWindow(found_pages[0], fetch_size);
+    AccessList(found_pages[0], fetch_size);
+
+    lock.unlock();
+    LoadFrames(found_pages, list_id);
+    lock.lock();
+
     // hash_to_buffer_pages_.insert(std::make_pair(list_id, found_pages[0]));
     hash_to_buffer_pages_[list_id] = found_pages[0];
-    UpdateFrames(found_pages, list_id);
-    AccessList(found_pages[0], fetch_size);
+    in_flight_.erase(list_id);
+    loaded.set_value();
+    ThreadStats::AddLatency(stats->fetch_latency, stats->fetch_latency_sum, BufferPoolStats::ElapsedNs(start_time));
+
+    /** Write the lists evicted for this one (or by concurrent misses) to the secondary cache without the latch. */
+    std::vector<SpilledList> spills;
+    spills.swap(pending_spills_);
+    lock.unlock();
+    WriteSpills(spills);
     return found_pages;
 }
 
-bool BufferPoolManager::UnPinListPages(list_id_t list_id) {
-    // std::scoped_lock<std::mutex> lock(latch_);
+bool BufferPoolManager::EvictList(const std::function<bool(frame_id_t)>& filter) {
+    ThreadStats* stats = stats_.Local();
+    auto start_time = std::chrono::steady_clock::now();
+    frame_id_t frame_id;
+    bool evict_success = replacer_->EvictFrame(&frame_id, filter);
+    if (!evict_success) {
+        /** A sweep may only have cleared reference flags, the second one finds a victim if there is any. */
+        evict_success = replacer_->EvictFrame(&frame_id, filter);
+    }
+    if (!evict_success) {
+        return false;
+    }
+
+    int evict_size = pages_[frame_id]->list_size_;
+    list_id_t evict_list_id = pages_[frame_id]->list_id_;
+
+    /** Write the appends back and copy the evicted list for the secondary cache before its frames are reset. */
+    FlushList(frame_id);
+    SpillList(frame_id);
+
+    free_list_[frame_id] = true;
+    free_num_++;
+    ResetFrame(frame_id);
+
+    /** Update the evicted frames in the free space. */
+    for (int i = 1; i < evict_size; i++) {
+        bool evict_non_first = replacer_->EvictNonFirstFrame();
+
+        assert(evict_non_first || !"Logical error when evicting non-first frames!");
+        assert(frame_id + i < pool_size_ || !"3: In principle a list cannot be cycled!");
+
+        free_list_[i + frame_id] = true;
+        free_num_++;
+        ResetFrame(i + frame_id);
+    }
+
+    // hash_to_buffer_pages_.erase(evict_list_id);
+    hash_to_buffer_pages_[evict_list_id] = -1;
+    ThreadStats::Add(stats->evictions, 1);
+    ThreadStats::AddLatency(stats->evict_latency, stats->evict_latency_sum, BufferPoolStats::ElapsedNs(start_time));
+    return true;
+}
+
+void BufferPoolManager::StartTrace(const std::string& filename) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    TraceHeader header;
+    for (size_t index_id = 0; index_id < indexes_.size() && index_id < TRACE_MAX_INDEX_NUM; index_id++) {
+        if (indexes_[index_id].lists->has_norms()) {
+            header.SetNorms(index_id);
+        }
+    }
+    delete trace_;
+    trace_ = new TraceRecorder(filename, header);
+}
+
+void BufferPoolManager::StopTrace() {
+    std::scoped_lock<std::mutex> lock(latch_);
+    delete trace_;
+    trace_ = nullptr;
+}
+
+BufferPoolStatsSnapshot BufferPoolManager::GetStats() {
+    BufferPoolStatsSnapshot snapshot = stats_.Collect();
+    std::scoped_lock<std::mutex> lock(latch_);
+    snapshot.pinned_frames = replacer_->GetPinnedNum();
+    for (const IndexInfo& index : indexes_) {
+        IndexStatsSnapshot index_stats;
+        index_stats.hits = index.hits;
+        index_stats.misses = index.misses;
+        index_stats.used_frames = index.used_frames;
+        index_stats.min_frames = index.min_frames;
+        index_stats.max_frames = index.max_frames;
+        snapshot.indexes.push_back(index_stats);
+    }
+    return snapshot;
+}
+
+bool BufferPoolManager::UnPinListPages(index_id_t index_id, list_id_t list_id_in_index) {
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    std::scoped_lock<std::mutex> lock(latch_);
 
     // auto iter = hash_to_buffer_pages_.find(list_id);
     // assert(iter != hash_to_buffer_pages_.end() || !"Try to unpin a list not in the buffer pool!");
@@ -283,26 +653,685 @@ bool BufferPoolManager::UnPinListPages(list_id_t list_id) {
     frame_id_t frame_id = hash_to_buffer_pages_[list_id];
     assert(frame_id != -1 || !"Try to unpin a list not in the buffer pool!");
 
-    assert(pages_[frame_id].pin_count_ != 0 || !"1: Unpin a non-pin list!");
+    assert(pages_[frame_id]->pin_count_ != 0 || !"1: Unpin a non-pin list!");
+
+    UnpinFrames(frame_id, ListPageSize(list_id));
+    return true;
+}
+
+void BufferPoolManager::PinFrames(frame_id_t frame_id, int list_size) {
+    for (int i = 0; i < list_size; i++) {
+        pages_[frame_id + i]->pin_count_++;
+        replacer_->Pin(frame_id + i);
+    }
+}
 
-    int list_size = ListPageSize(list_id);
+void BufferPoolManager::UnpinFrames(frame_id_t frame_id, int list_size) {
     for (int i = 0; i < list_size; i++) {
         assert(frame_id + i < pool_size_ || !"4: In principle a list cannot be cycled!");
-        assert(pages_[frame_id + i].pin_count_ != 0 || !"2: Unpin a non-pin list!");
+        assert(pages_[frame_id + i]->pin_count_ != 0 || !"2: Unpin a non-pin list!");
 
-        pages_[frame_id + i].pin_count_--;
-        if (pages_[frame_id + i].pin_count_ == 0) {
+        pages_[frame_id + i]->pin_count_--;
+        if (pages_[frame_id + i]->pin_count_ == 0) {
             replacer_->Unpin(frame_id + i);
         }
     }
+    if (pages_[frame_id]->pin_count_ == 0) {
+        unpin_cv_.notify_all();
+    }
+}
+
+void BufferPoolManager::ReleaseList(frame_id_t frame_id, bool spill) {
+    int list_size = pages_[frame_id]->list_size_;
+    list_id_t list_id = pages_[frame_id]->list_id_;
+
+    FlushList(frame_id);
+    if (spill) {
+        SpillList(frame_id);
+    }
+
+    for (int i = 0; i < list_size; i++) {
+        assert(pages_[frame_id + i]->pin_count_ == 0 || !"Try to release a pinned list!");
+
+        replacer_->RemoveFrame(frame_id + i);
+        free_list_[frame_id + i] = true;
+        free_num_++;
+        ResetFrame(frame_id + i);
+    }
+    hash_to_buffer_pages_[list_id] = -1;
+}
+
+void BufferPoolManager::SpillList(frame_id_t frame_id) {
+    if (secondary_cache_ == nullptr) {
+        return;
+    }
+    int list_size = pages_[frame_id]->list_size_;
+    SpilledList spill;
+    spill.list_id = pages_[frame_id]->list_id_;
+    if (!secondary_cache_->Reserve(spill.list_id, list_size, spill.slots)) {
+        return;
+    }
+    /** The frames are reused as soon as the latch is released, the write goes from the copy. */
+    spill.frames.resize(list_size * SecondaryCache::SLOT_BYTES);
+    for (int i = 0; i < list_size; i++) {
+        SecondaryCache::CopyFrame(pages_[frame_id + i], spill.frames.data() + i * SecondaryCache::SLOT_BYTES);
+    }
+    pending_spills_.push_back(std::move(spill));
+}
+
+void BufferPoolManager::WriteSpills(std::vector<SpilledList>& spills) {
+    for (SpilledList& spill : spills) {
+        secondary_cache_->Write(spill.list_id, spill.slots, spill.frames.data());
+    }
+}
+
+bool BufferPoolManager::Resize(size_t pool_size) {
+    std::unique_lock<std::mutex> lock(latch_);
+
+    if (pool_size == 0) {
+        return false;
+    }
+
+    if (pool_size > pool_size_) {
+        if (pool_size > pages_capacity_) {
+            /**
+             * Readers access the page table without the latch (GetPageVectors(), LoadFrames()),
+             * so the old table is kept alive until the buffer pool is destroyed.
+             */
+            pages_capacity_ = std::max(pool_size, 2 * pages_capacity_);
+            Page** pages = new Page*[pages_capacity_];
+            std::copy(pages_.load(), pages_.load() + pool_size_, pages);
+            retired_pages_.push_back(pages_.load());
+            pages_.store(pages);
+        }
+        for (size_t i = pool_size_; i < pool_size; i++) {
+            pages_[i] = AllocatePage(i);
+            free_list_.push_back(true);
+        }
+        free_num_ += pool_size - pool_size_;
+        replacer_->Resize(pool_size);
+        pool_size_ = pool_size;
+        unpin_cv_.notify_all();
+        return true;
+    }
+
+    /** Lists which overlap the released frames. A pinned one cannot be evicted, so nothing is changed. */
+    std::vector<frame_id_t> release_lists;
+    for (size_t i = pool_size; i < pool_size_; i++) {
+        if (pages_[i]->list_id_ == INVALID_LIST_ID) {
+            continue;
+        }
+        frame_id_t first_frame = hash_to_buffer_pages_[pages_[i]->list_id_];
+        if (pages_[i]->pin_count_ != 0) {
+            return false;
+        }
+        if (release_lists.empty() || release_lists.back() != first_frame) {
+            release_lists.push_back(first_frame);
+        }
+    }
+    for (frame_id_t first_frame : release_lists) {
+        ReleaseList(first_frame);
+    }
+
+    for (size_t i = pool_size; i < pool_size_; i++) {
+        assert(free_list_[i] == true || !"Release a used frame when shrinking the buffer pool!");
+        ReleasePage(i);
+        pages_[i] = nullptr;
+    }
+    free_list_.resize(pool_size);
+    free_num_ -= pool_size_ - pool_size;
+    replacer_->Resize(pool_size);
+    pool_size_ = pool_size;
+
+    std::vector<SpilledList> spills;
+    spills.swap(pending_spills_);
+    lock.unlock();
+    WriteSpills(spills);
+    return true;
+}
+
+void BufferPoolManager::EnableMissRatioCurve(double sampling_rate, size_t bucket_size) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    delete mrc_;
+    mrc_ = new MissRatioCurve(sampling_rate, bucket_size);
+}
+
+double BufferPoolManager::GetExpectedHitRatio(size_t pool_size) {
+    if (mrc_ == nullptr) {
+        return 0;
+    }
+    return mrc_->GetHitRatio(pool_size);
+}
+
+size_t BufferPoolManager::ResizeForHitRatio(double hit_ratio, size_t max_pool_size) {
+    if (mrc_ == nullptr) {
+        return pool_size_;
+    }
+    size_t pool_size = mrc_->GetPoolSizeForHitRatio(hit_ratio);
+    if (pool_size == 0 || pool_size > max_pool_size) {
+        pool_size = max_pool_size;
+    }
+    Resize(pool_size);
+    return pool_size_;
+}
+
+void BufferPoolManager::EnableIoScheduler(size_t max_read_bytes, size_t max_gap_bytes, size_t max_batches) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    io_max_read_bytes_ = max_read_bytes;
+    io_max_gap_bytes_ = max_gap_bytes;
+    io_max_batches_ = max_batches;
+    for (IndexInfo& index : indexes_) {
+        delete index.io_scheduler;
+        index.io_scheduler = new IoScheduler(index.db_io, max_read_bytes, max_gap_bytes, max_batches, &stats_);
+    }
+}
+
+void BufferPoolManager::EnableWriteBack(StorageLists* lists, size_t flush_interval_ms) {
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        auto index = std::find_if(indexes_.begin(), indexes_.end(), [lists](const IndexInfo& index) { return index.lists == lists; });
+        assert(index != indexes_.end() || !"Write-back needs the lists of an index of the buffer pool!");
+        index->writable_lists = lists;
+        if (index->write_io == -1) {
+            index->write_io = open(lists->get_filename().c_str(), O_WRONLY);
+            assert(index->write_io != -1 || !"Cannot open the lists file on disk for writing!");
+        }
+    }
+    if (flush_interval_ms == 0 || flush_thread_.joinable()) {
+        return;
+    }
+    flush_stop_ = false;
+    flush_thread_ = std::thread([this, flush_interval_ms] {
+        std::unique_lock<std::mutex> lock(flush_latch_);
+        while (!flush_cv_.wait_for(lock, std::chrono::milliseconds(flush_interval_ms), [this] { return flush_stop_; })) {
+            FlushDirtyFrames();
+        }
+    });
+}
+
+bool BufferPoolManager::AppendEntries(index_id_t index_id, list_id_t list_id_in_index, const vector_el_t* vectors, const vector_id_t* ids, len_t n_entries) {
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    IndexInfo& index = indexes_[index_id];
+    assert(index.writable_lists != nullptr || !"Write-back is not enabled!");
+    std::unique_lock<std::mutex> lock(latch_);
+    /** The frames of the list must neither be loaded nor written back while they are appended to or the list is relocated. */
+    while (in_flight_.find(list_id) != in_flight_.end() || flushing_lists_.find(list_id) != flushing_lists_.end()) {
+        WaitForLoad(list_id, lock);
+        WaitForFlush(list_id);
+    }
+    RevalidateList(list_id);
+
+    frame_id_t frame_id = hash_to_buffer_pages_[list_id];
+    size_t list_length = hash_to_list_size_[list_id];
+    size_t allocated_entries = (hash_to_disk_vectors_[list_id].second - hash_to_disk_vectors_[list_id].first) / index.lists->get_vector_size();
+    size_t tail_entries = list_length % FRAME_DATA_NUM;
+    size_t new_length = list_length + n_entries;
+
+    /** The same conditions as StorageLists::resize_list() to keep the list in place. */
+    bool fits_in_place = new_length <= allocated_entries && new_length > allocated_entries / 2;
+    bool fits_in_tail = tail_entries != 0 && tail_entries + n_entries <= FRAME_DATA_NUM;
+    if (frame_id == -1 || !fits_in_place || !fits_in_tail) {
+        /** The list may be relocated, so its unflushed appends must reach the file first. */
+        if (frame_id != -1) {
+            FlushList(frame_id);
+        }
+        index.writable_lists->insert_entries(list_id_in_index, vectors, ids, n_entries);
+        return false;
+    }
+
+    Page* tail = pages_[frame_id + ListPageSize(list_id) - 1];
+    memcpy(tail->GetVectors() + tail_entries * DATA_DIMENSION, vectors, n_entries * DATA_DIMENSION * sizeof(vector_el_t));
+    memcpy(tail->GetIDs() + tail_entries, ids, n_entries * sizeof(vector_id_t));
+    if (index.lists->has_norms()) {
+        L2SqrNorms(vectors, n_entries, DATA_DIMENSION, tail->GetNorms() + tail_entries);
+    }
+    tail->dirty_ = true;
+
+    /** The copy in the secondary cache does not have the new entries. */
+    if (secondary_cache_ != nullptr) {
+        secondary_cache_->Erase(list_id);
+    }
+
+    /**
+     * Publish the new length. The version is bumped by this pool, so the cached list stays valid,
+     * and if nothing else has changed, the fast path of RevalidateList() is kept.
+     */
+    uint64_t directory_version = index.lists->get_version();
+    index.writable_lists->resize_list(list_id_in_index, new_length);
+    StorageLists::InvertedList list;
+    uint64_t version;
+    index.lists->get_list_snapshot(list_id_in_index, list, version);
+    SetListLocation(list_id, list, version);
+    if (directory_version == index.directory_version && version == directory_version + 1) {
+        index.directory_version = version;
+    }
+    return true;
+}
+
+bool BufferPoolManager::EnableListViews() {
+    std::scoped_lock<std::mutex> lock(latch_);
+    if (FRAME_DATA_SIZE * sizeof(vector_el_t) % sysconf(_SC_PAGESIZE) != 0) {
+        std::cout << "WARNING: The vectors of a frame are not a multiple of the page size, list views are disabled." << std::endl;
+        return false;
+    }
+    list_views_ = true;
+    for (auto& item : hash_to_buffer_pages_) {
+        if (item.second != -1) {
+            MapListWindow(item.second, pages_[item.second]->list_size_);
+        }
+    }
+    return true;
+}
+
+ListView BufferPoolManager::FetchListView(index_id_t index_id, list_id_t list_id) {
+    return MakeListView(index_id, list_id, FetchListPages(index_id, list_id));
+}
+
+ListView BufferPoolManager::MakeListView(index_id_t index_id, list_id_t list_id, const std::vector<frame_id_t>& frame_ids) {
+    ListView view;
+    for (frame_id_t frame_id : frame_ids) {
+        view.frame_vectors.push_back(pages_[frame_id]->GetVectors());
+        view.frame_ids.push_back(pages_[frame_id]->GetIDs());
+        if (indexes_[index_id].lists->has_norms()) {
+            view.frame_norms.push_back(pages_[frame_id]->GetNorms());
+        }
+    }
+    std::scoped_lock<std::mutex> lock(latch_);
+    view.length = hash_to_list_size_[ListKey(index_id, list_id)];
+    if (frame_ids.size() == 1) {
+        view.vectors = view.frame_vectors[0];
+        view.ids = view.frame_ids[0];
+        view.norms = view.frame_norms.empty() ? nullptr : view.frame_norms[0];
+    } else if (!frame_ids.empty()) {
+        auto window = hash_to_window_.find(frame_ids[0]);
+        if (window != hash_to_window_.end()) {
+            view.vectors = window->second;
+        }
+    }
+    return view;
+}
+
+bool BufferPoolManager::FetchResidentListView(index_id_t index_id, list_id_t list_id_in_index, ListView* view) {
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    ThreadStats* stats = stats_.Local();
+    std::vector<frame_id_t> found_pages;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        if (in_flight_.find(list_id) != in_flight_.end()) {
+            return false;
+        }
+        RevalidateList(list_id);
+        frame_id_t frame_id = hash_to_buffer_pages_[list_id];
+        if (frame_id == -1) {
+            return false;
+        }
+        hash_to_access_times_[list_id]++;
+        ThreadStats::Add(stats->hits, 1);
+        stats->AddListHit(list_id);
+        indexes_[index_id].hits++;
+        int fetch_size = ListPageSize(list_id);
+        AccessList(frame_id, fetch_size);
+        for (int i = 0; i < fetch_size; i++) {
+            found_pages.push_back(frame_id + i);
+        }
+    }
+    *view = MakeListView(index_id, list_id_in_index, found_pages);
+    return true;
+}
+
+bool BufferPoolManager::ReadEntry(index_id_t index_id, list_id_t list_id_in_index, len_t offset, vector_el_t* vector, vector_id_t* id) {
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    const IndexInfo& index = indexes_[index_id];
+    std::pair<size_t, size_t> disk_offsets;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        RevalidateList(list_id);
+        if (offset >= (len_t) hash_to_list_size_[list_id]) {
+            return false;
+        }
+        disk_offsets = hash_to_disk_vectors_[list_id];
+    }
+
+    ThreadStats* stats = stats_.Local();
+    size_t vector_size = index.lists->get_vector_size();
+    ssize_t read_vector = pread(index.db_io, (char*) vector, vector_size, disk_offsets.first + offset * vector_size);
+    assert(read_vector != -1 || !"I/O error when reading file for vectors_!");
+    ssize_t read_id = pread(index.db_io, (char*) id, sizeof(vector_id_t), disk_offsets.second + offset * sizeof(vector_id_t));
+    assert(read_id != -1 || !"I/O error when reading file for ids_!");
+    ThreadStats::Add(stats->read_syscalls, 2);
+    ThreadStats::Add(stats->bytes_read, std::max(read_vector, (ssize_t) 0) + std::max(read_id, (ssize_t) 0));
+    return read_vector == (ssize_t) vector_size && read_id == (ssize_t) sizeof(vector_id_t);
+}
+
+void BufferPoolManager::CollectDirtyFrames(frame_id_t frame_id, std::vector<IoSegment>& segments) {
+    list_id_t list_id = pages_[frame_id]->list_id_;
+    int list_size = pages_[frame_id]->list_size_;
+    size_t list_length = hash_to_list_size_[list_id];
+    size_t vectors_bytes_per_page = FRAME_DATA_SIZE * sizeof(vector_el_t);
+    size_t ids_bytes_per_page = FRAME_DATA_NUM * sizeof(vector_id_t);
+
+    for (int i = 0; i < list_size; i++) {
+        Page* page = pages_[frame_id + i];
+        if (!page->dirty_) {
+            continue;
+        }
+        page->dirty_ = false;
+        size_t item_num = FRAME_DATA_NUM;
+        if (i == list_size - 1 && list_length % FRAME_DATA_NUM != 0) {
+            item_num = list_length % FRAME_DATA_NUM;
+        }
+        IoSegment vectors_segment{hash_to_disk_vectors_[list_id].first + i * vectors_bytes_per_page, {}};
+        vectors_segment.buffers.push_back(iovec{page->GetVectors(), item_num * sizeof(vector_el_t) * DATA_DIMENSION});
+        IoSegment ids_segment{hash_to_disk_vectors_[list_id].second + i * ids_bytes_per_page, {}};
+        ids_segment.buffers.push_back(iovec{page->GetIDs(), item_num * sizeof(vector_id_t)});
+        segments.push_back(vectors_segment);
+        segments.push_back(ids_segment);
+        if (hash_to_disk_norms_[list_id] != 0) {
+            IoSegment norms_segment{hash_to_disk_norms_[list_id] + i * FRAME_DATA_NUM * sizeof(distance_t), {}};
+            norms_segment.buffers.push_back(iovec{page->GetNorms(), item_num * sizeof(distance_t)});
+            segments.push_back(norms_segment);
+        }
+    }
+}
+
+void BufferPoolManager::FlushList(frame_id_t frame_id) {
+    list_id_t list_id = pages_[frame_id]->list_id_;
+    int write_io = indexes_[KeyIndex(list_id)].write_io;
+    if (write_io == -1) {
+        return;
+    }
+    WaitForFlush(list_id);
+    assert(pages_[frame_id]->list_id_ == list_id || !"The list has been evicted while it was flushed!");
+    std::vector<IoSegment> segments;
+    CollectDirtyFrames(frame_id, segments);
+    WriteSegments(write_io, segments);
+}
+
+void BufferPoolManager::FlushDirtyFrames() {
+    /** Segments of every index, each written to its own lists file. */
+    std::vector<std::vector<IoSegment> > segments;
+    std::vector<std::pair<frame_id_t, int> > pinned_lists;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        segments.resize(indexes_.size());
+        for (size_t i = 0; i < pool_size_; i++) {
+            if (!replacer_->GetFirstFrame(i) || pages_[i]->list_id_ == INVALID_LIST_ID) {
+                continue;
+            }
+            index_id_t index_id = KeyIndex(pages_[i]->list_id_);
+            if (indexes_[index_id].write_io == -1) {
+                continue;
+            }
+            size_t segments_num = segments[index_id].size();
+            CollectDirtyFrames(i, segments[index_id]);
+            /** Keep the list in its frames and at its location while they are written without the latch. */
+            if (segments[index_id].size() != segments_num) {
+                PinFrames(i, pages_[i]->list_size_);
+                pinned_lists.push_back(std::make_pair(i, pages_[i]->list_size_));
+                flushing_lists_.insert(pages_[i]->list_id_);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (!segments[i].empty()) {
+            WriteSegments(indexes_[i].write_io, segments[i]);
+        }
+    }
+
+    std::scoped_lock<std::mutex> lock(latch_);
+    for (auto& pinned_list : pinned_lists) {
+        flushing_lists_.erase(pages_[pinned_list.first]->list_id_);
+        UnpinFrames(pinned_list.first, pinned_list.second);
+    }
+    flushed_cv_.notify_all();
+}
+
+void BufferPoolManager::WriteSegments(int fd, std::vector<IoSegment>& segments) {
+    std::sort(segments.begin(), segments.end(), [](const IoSegment& a, const IoSegment& b) { return a.offset < b.offset; });
+    ThreadStats* stats = stats_.Local();
+
+    size_t index = 0;
+    while (index < segments.size()) {
+        /** Gather the segments which continue each other into one write. */
+        std::vector<iovec> buffers = segments[index].buffers;
+        size_t offset = segments[index].offset;
+        size_t end = offset + segments[index].Size();
+        for (index++; index < segments.size() && segments[index].offset == end && buffers.size() < IOV_MAX; index++) {
+            buffers.insert(buffers.end(), segments[index].buffers.begin(), segments[index].buffers.end());
+            end += segments[index].Size();
+        }
+
+        size_t buffer_index = 0;
+        while (buffer_index < buffers.size()) {
+            int count = std::min(buffers.size() - buffer_index, (size_t) IOV_MAX);
+            ssize_t written_bytes = pwritev(fd, &buffers[buffer_index], count, offset);
+            assert(written_bytes != -1 || !"I/O error when writing back to the lists file!");
+            ThreadStats::Add(stats->write_syscalls, 1);
+            if (written_bytes <= 0) {
+                std::cout << "WARNING: Cannot write back to the lists file." << std::endl;
+                break;
+            }
+            ThreadStats::Add(stats->bytes_written, written_bytes);
+            offset += written_bytes;
+
+            /** Skip the written buffers. A short write continues in the middle of a buffer. */
+            size_t remaining = written_bytes;
+            while (buffer_index < buffers.size() && remaining >= buffers[buffer_index].iov_len) {
+                remaining -= buffers[buffer_index].iov_len;
+                buffer_index++;
+            }
+            if (remaining > 0) {
+                buffers[buffer_index].iov_base = (char*) buffers[buffer_index].iov_base + remaining;
+                buffers[buffer_index].iov_len -= remaining;
+            }
+        }
+    }
+}
+
+bool BufferPoolManager::PrefetchList(index_id_t index_id, list_id_t list_id_in_index) {
+    assert((index_id >= 0 && (size_t) index_id < indexes_.size()) || !"Unknown index id!");
+    list_id_t list_id = ListKey(index_id, list_id_in_index);
+    std::vector<frame_id_t> found_pages;
+    std::promise<void> loaded;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        if (in_flight_.find(list_id) != in_flight_.end()) {
+            return false;
+        }
+        RevalidateList(list_id);
+        if (hash_to_buffer_pages_[list_id] != -1) {
+            return false;
+        }
+        int fetch_size = ListPageSize(list_id);
+        if (indexes_[index_id].used_frames + fetch_size > indexes_[index_id].max_frames) {
+            return false;
+        }
+        frame_id_t start_frame = LookUpFreeList(fetch_size);
+        if (start_frame == -1) {
+            return false;
+        }
+        AllocateFreeFrames(found_pages, start_frame, fetch_size);
+        SetFramesList(found_pages, list_id);
+        MapListWindow(start_frame, fetch_size);
+        /** Keep the frames away from Resize() while they are loaded. They are not in the replacer yet. */
+        for (frame_id_t frame_id : found_pages) {
+            pages_[frame_id]->pin_count_ = 1;
+        }
+        /** Queries which want the list meanwhile wait for this load instead of reading it again. */
+        in_flight_[list_id] = loaded.get_future().share();
+    }
+
+    LoadFrames(found_pages, list_id);
+
+    std::scoped_lock<std::mutex> lock(latch_);
+    for (frame_id_t frame_id : found_pages) {
+        pages_[frame_id]->pin_count_ = 0;
+    }
+    hash_to_buffer_pages_[list_id] = found_pages[0];
+    /** Unpinned and without reference flag, the warmed list is the first to go if it is not used. */
+    for (frame_id_t frame_id : found_pages) {
+        replacer_->AccessFrame(frame_id, false);
+    }
+    in_flight_.erase(list_id);
+    loaded.set_value();
+    unpin_cv_.notify_all();
+    return true;
+}
+
+void BufferPoolManager::SaveHeatMap(const std::string& filename) {
+    std::vector<std::pair<list_id_t, size_t> > heat_map;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        for (auto& item : hash_to_buffer_pages_) {
+            if (item.second != -1) {
+                heat_map.push_back(std::make_pair(item.first, hash_to_access_times_[item.first]));
+            }
+        }
+    }
+
+    /** Write to a temporary file first, so a crash never leaves a truncated heat map behind. */
+    std::string tmp_filename = filename + ".tmp";
+    std::ofstream heat_map_file(tmp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!heat_map_file.is_open()) {
+        std::cout << "WARNING: Cannot open heat map file " << tmp_filename << std::endl;
+        return;
+    }
+    for (auto& item : heat_map) {
+        heat_map_file.write((char*) &item.first, sizeof(list_id_t));
+        heat_map_file.write((char*) &item.second, sizeof(size_t));
+    }
+    heat_map_file.close();
+    if (heat_map_file.fail() || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::cout << "WARNING: Cannot write heat map file " << filename << std::endl;
+    }
+}
+
+void BufferPoolManager::StartHeatMapSnapshots(const std::string& filename, size_t interval_seconds) {
+    StopHeatMapSnapshots();
+    snapshot_stop_ = false;
+    snapshot_thread_ = std::thread([this, filename, interval_seconds] {
+        std::unique_lock<std::mutex> lock(snapshot_latch_);
+        while (!snapshot_cv_.wait_for(lock, std::chrono::seconds(interval_seconds), [this] { return snapshot_stop_; })) {
+            SaveHeatMap(filename);
+        }
+    });
+}
+
+void BufferPoolManager::StopHeatMapSnapshots() {
+    {
+        std::scoped_lock<std::mutex> lock(snapshot_latch_);
+        snapshot_stop_ = true;
+    }
+    snapshot_cv_.notify_all();
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join();
+    }
+}
+
+void BufferPoolManager::WarmUp(std::string filename, int thread_num) {
+    std::ifstream heat_map_file(filename, std::ios::in | std::ios::binary);
+    if (!heat_map_file.is_open()) {
+        return;
+    }
+    std::vector<std::pair<list_id_t, size_t> > heat_map;
+    std::pair<list_id_t, size_t> item;
+    while (heat_map_file.read((char*) &item.first, sizeof(list_id_t)) && heat_map_file.read((char*) &item.second, sizeof(size_t))) {
+        heat_map.push_back(item);
+    }
+    heat_map_file.close();
+
+    /** The hottest lists which fit into the free frames. */
+    std::sort(heat_map.begin(), heat_map.end(),
+        [](const std::pair<list_id_t, size_t>& a, const std::pair<list_id_t, size_t>& b) { return a.second > b.second; });
+    std::vector<list_id_t> warm_lists;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        int free_frames = free_num_;
+        for (auto& heat : heat_map) {
+            /** Skip the lists which are not in the served indexes (anymore). */
+            if (hash_to_list_size_.find(heat.first) == hash_to_list_size_.end()) {
+                continue;
+            }
+            int list_size = ListPageSize(heat.first);
+            if (list_size > free_frames) {
+                continue;
+            }
+            free_frames -= list_size;
+            warm_lists.push_back(heat.first);
+            /** Carry the frequencies over, so the next snapshot still knows the list is hot. */
+            hash_to_access_times_[heat.first] += heat.second;
+        }
+        /** Read in file offset order, each thread a consecutive range, to keep the I/O sequential. */
+        std::sort(warm_lists.begin(), warm_lists.end(),
+            [this](list_id_t a, list_id_t b) { return hash_to_disk_vectors_.at(a).first < hash_to_disk_vectors_.at(b).first; });
+    }
+
+    thread_num = std::max(1, thread_num);
+    size_t chunk_size = (warm_lists.size() + thread_num - 1) / thread_num;
+    std::vector<std::thread> workers;
+    for (size_t start = 0; start < warm_lists.size(); start += chunk_size) {
+        size_t end = std::min(start + chunk_size, warm_lists.size());
+        workers.emplace_back([this, &warm_lists, start, end] {
+            for (size_t i = start; i < end; i++) {
+                PrefetchList(KeyIndex(warm_lists[i]), KeyList(warm_lists[i]));
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void BufferPoolManager::StartWarmUp(const std::string& filename, int thread_num) {
+    WaitForWarmUp();
+    warmup_thread_ = std::thread(&BufferPoolManager::WarmUp, this, filename, thread_num);
+}
+
+void BufferPoolManager::WaitForWarmUp() {
+    if (warmup_thread_.joinable()) {
+        warmup_thread_.join();
+    }
 }
 
 BufferPoolManager::~BufferPoolManager() {
-    delete[] pages_;
+    StopHeatMapSnapshots();
+    WaitForWarmUp();
+    {
+        std::scoped_lock<std::mutex> lock(flush_latch_);
+        flush_stop_ = true;
+    }
+    flush_cv_.notify_all();
+    if (flush_thread_.joinable()) {
+        flush_thread_.join();
+    }
+    FlushDirtyFrames();
+    delete mrc_;
+    delete trace_;
+    for (auto& window : hash_to_window_) {
+        munmap(window.second, pages_[window.first]->list_size_ * FRAME_DATA_SIZE * sizeof(vector_el_t));
+    }
+    for (size_t i = 0; i < pool_size_; i++) {
+        ReleasePage(i);
+    }
+    close(arena_fd_);
+    delete[] pages_.load();
+    for (Page** pages : retired_pages_) {
+        delete[] pages;
+    }
     delete replacer_;
-    // db_io_.close();
-    if (close(db_io_) < 0) {
-        assert("Failed to close the disk file!");
+    for (IndexInfo& index : indexes_) {
+        delete index.io_scheduler;
+        if (index.write_io != -1) {
+            close(index.write_io);
+        }
+        // db_io_.close();
+        if (close(index.db_io) < 0) {
+            assert("Failed to close the disk file!");
+        }
     }
 }
 
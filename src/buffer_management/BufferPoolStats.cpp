@@ -0,0 +1,87 @@
+#include "buffer_management/BufferPoolStats.hpp"
+#include <unordered_map>
+
+namespace ann_dkvs {
+namespace {
+std::atomic<uint64_t> next_stats_id{1};
+
+void CollectHistogram(LatencyHistogramSnapshot& snapshot,
+                      const std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM>& histogram,
+                      const std::atomic<uint64_t>& sum) {
+    for (int i = 0; i < LATENCY_BUCKET_NUM; i++) {
+        uint64_t count = histogram[i].load(std::memory_order_relaxed);
+        snapshot.buckets[i] += count;
+        snapshot.count += count;
+    }
+    snapshot.sum_ns += sum.load(std::memory_order_relaxed);
+}
+}
+
+uint64_t LatencyHistogramSnapshot::Percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (p * count);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_NUM; i++) {
+        seen += buckets[i];
+        if (seen > rank || seen == count) {
+            return i == 0 ? 0 : (1ULL << i) - 1;
+        }
+    }
+    return UINT64_MAX;
+}
+
+BufferPoolStats::BufferPoolStats() : id_(next_stats_id.fetch_add(1)) {}
+
+ThreadStats* BufferPoolStats::Local() {
+    /** Usually a thread works with a single buffer pool, so remember the last one before the map lookup. */
+    thread_local uint64_t cached_id = 0;
+    thread_local ThreadStats* cached_stats = nullptr;
+    thread_local std::unordered_map<uint64_t, ThreadStats*> local_stats;
+
+    if (cached_id == id_) {
+        return cached_stats;
+    }
+    auto iter = local_stats.find(id_);
+    if (iter == local_stats.end()) {
+        std::scoped_lock<std::mutex> lock(latch_);
+        threads_.push_back(std::make_unique<ThreadStats>());
+        iter = local_stats.insert(std::make_pair(id_, threads_.back().get())).first;
+    }
+    cached_id = id_;
+    cached_stats = iter->second;
+    return cached_stats;
+}
+
+BufferPoolStatsSnapshot BufferPoolStats::Collect() {
+    BufferPoolStatsSnapshot snapshot;
+    snapshot.list_hits.assign(NUM_LISTS, 0);
+    snapshot.list_misses.assign(NUM_LISTS, 0);
+
+    std::scoped_lock<std::mutex> lock(latch_);
+    for (auto& stats : threads_) {
+        snapshot.hits += stats->hits.load(std::memory_order_relaxed);
+        snapshot.misses += stats->misses.load(std::memory_order_relaxed);
+        snapshot.evictions += stats->evictions.load(std::memory_order_relaxed);
+        snapshot.bytes_read += stats->bytes_read.load(std::memory_order_relaxed);
+        snapshot.read_syscalls += stats->read_syscalls.load(std::memory_order_relaxed);
+        snapshot.bytes_written += stats->bytes_written.load(std::memory_order_relaxed);
+        snapshot.write_syscalls += stats->write_syscalls.load(std::memory_order_relaxed);
+        snapshot.contiguous_alloc_failures += stats->contiguous_alloc_failures.load(std::memory_order_relaxed);
+        snapshot.miss_waits += stats->miss_waits.load(std::memory_order_relaxed);
+        snapshot.invalidations += stats->invalidations.load(std::memory_order_relaxed);
+
+        CollectHistogram(snapshot.fetch_latency, stats->fetch_latency, stats->fetch_latency_sum);
+        CollectHistogram(snapshot.io_latency, stats->io_latency, stats->io_latency_sum);
+        CollectHistogram(snapshot.evict_latency, stats->evict_latency, stats->evict_latency_sum);
+
+        for (size_t i = 0; i < NUM_LISTS; i++) {
+            snapshot.list_hits[i] += stats->list_hits[i].load(std::memory_order_relaxed);
+            snapshot.list_misses[i] += stats->list_misses[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+}
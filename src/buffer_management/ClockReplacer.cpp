@@ -72,6 +72,10 @@ bool ClockReplacer::EvictNonFirstFrame() {
 }
 
 bool ClockReplacer::EvictFrame(frame_id_t *frame_id) {
+    return EvictFrame(frame_id, nullptr);
+}
+
+bool ClockReplacer::EvictFrame(frame_id_t *frame_id, const std::function<bool(frame_id_t)> &filter) {
     // std::scoped_lock<std::mutex> lock(latch_);
     if (num_pinned_pages_ == num_pages_) {
         std::cout << "All pages are pinned" << std::endl;
@@ -97,7 +101,8 @@ bool ClockReplacer::EvictFrame(frame_id_t *frame_id) {
             // std::cout << "used: " << used_frame_[clock_pointer_] << std::endl;
             // std::cout << "pinned: " << pinned_[clock_pointer_] << std::endl;
         }
-        if (first_frame_[clock_pointer_] && used_frame_[clock_pointer_] && !pinned_[clock_pointer_]) {
+        if (first_frame_[clock_pointer_] && used_frame_[clock_pointer_] && !pinned_[clock_pointer_]
+            && (filter == nullptr || filter(clock_pointer_))) {
             if (ref_flag_[clock_pointer_]) {
                 ref_flag_[clock_pointer_] = false;
             } else {
@@ -141,4 +146,34 @@ void ClockReplacer::Unpin(frame_id_t frame_id) {
     }
     
 }
+
+void ClockReplacer::RemoveFrame(frame_id_t frame_id) {
+    if (frame_id < 0 || frame_id >= num_pages_) {
+        return;
+    }
+
+    if (pinned_[frame_id]) {
+        num_pinned_pages_--;
+        pinned_[frame_id] = false;
+    }
+    used_frame_[frame_id] = false;
+    ref_flag_[frame_id] = false;
+    SetFirstFrame(frame_id, true);
+}
+
+void ClockReplacer::Resize(int num_pages) {
+    for (int i = num_pages; i < num_pages_; i++) {
+        assert(!used_frame_[i] || !"Shrink the replacer with a frame in use!");
+    }
+
+    used_frame_.resize(num_pages, false);
+    pinned_.resize(num_pages, false);
+    ref_flag_.resize(num_pages, false);
+    first_frame_.resize(num_pages, true);
+
+    num_pages_ = num_pages;
+    if (clock_pointer_ >= num_pages_) {
+        clock_pointer_ = 0;
+    }
+}
 }
\ No newline at end of file
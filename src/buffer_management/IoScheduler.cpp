@@ -0,0 +1,120 @@
+#include "buffer_management/IoScheduler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <unistd.h>
+
+namespace ann_dkvs {
+IoScheduler::IoScheduler(int fd, size_t max_read_bytes, size_t max_gap_bytes, size_t max_batches, BufferPoolStats* stats)
+    : fd_(fd), max_read_bytes_(max_read_bytes), max_gap_bytes_(max_gap_bytes), max_batches_(std::max(max_batches, (size_t) 1)), stats_(stats) {}
+
+void IoScheduler::Read(std::vector<IoSegment>& segments) {
+    IoRequest request{&segments, false};
+    std::unique_lock<std::mutex> lock(latch_);
+    pending_.push_back(&request);
+
+    while (!request.done) {
+        /** Our request is in a batch of another thread, or too many batches are in flight. */
+        if (pending_.empty() || dispatched_batches_ >= max_batches_) {
+            cv_.wait(lock);
+            continue;
+        }
+        /** Take all queued requests, which contain at least our own, and read them next to the other batches. */
+        dispatched_batches_++;
+        std::vector<IoRequest*> batch;
+        batch.swap(pending_);
+        size_t head_offset = head_offset_;
+
+        lock.unlock();
+        size_t end_offset = Dispatch(batch, head_offset);
+        lock.lock();
+
+        for (IoRequest* done_request : batch) {
+            done_request->done = true;
+        }
+        head_offset_ = end_offset;
+        dispatched_batches_--;
+        /** Wake the owners of the batch, and a waiting thread to dispatch the requests queued meanwhile. */
+        cv_.notify_all();
+    }
+}
+
+size_t IoScheduler::Dispatch(const std::vector<IoRequest*>& batch, size_t head_offset) {
+    std::vector<IoSegment*> segments;
+    for (IoRequest* request : batch) {
+        for (IoSegment& segment : *request->segments) {
+            if (segment.Size() != 0) {
+                segments.push_back(&segment);
+            }
+        }
+    }
+    if (segments.empty()) {
+        return head_offset;
+    }
+
+    /** Circular scan: serve the segments behind the previous position first, then wrap around. */
+    std::sort(segments.begin(), segments.end(), [](const IoSegment* a, const IoSegment* b) { return a->offset < b->offset; });
+    auto head = std::lower_bound(segments.begin(), segments.end(), head_offset,
+                                 [](const IoSegment* segment, size_t offset) { return segment->offset < offset; });
+    std::rotate(segments.begin(), head, segments.end());
+
+    /** Destination of the gaps between merged segments, their bytes are dropped. */
+    std::vector<char> gap_buffer;
+    std::vector<iovec> buffers;
+    size_t range_start = 0;
+    size_t range_end = 0;
+    for (IoSegment* segment : segments) {
+        size_t segment_end = segment->offset + segment->Size();
+        if (!buffers.empty()) {
+            bool mergeable = segment->offset >= range_end
+                && segment->offset - range_end <= max_gap_bytes_
+                && segment_end - range_start <= max_read_bytes_;
+            if (mergeable) {
+                if (segment->offset > range_end) {
+                    gap_buffer.resize(max_gap_bytes_);
+                    buffers.push_back(iovec{gap_buffer.data(), segment->offset - range_end});
+                }
+                buffers.insert(buffers.end(), segment->buffers.begin(), segment->buffers.end());
+                range_end = segment_end;
+                continue;
+            }
+            ReadRange(range_start, buffers);
+            buffers.clear();
+        }
+        buffers = segment->buffers;
+        range_start = segment->offset;
+        range_end = segment_end;
+    }
+    ReadRange(range_start, buffers);
+    return range_end;
+}
+
+void IoScheduler::ReadRange(size_t offset, std::vector<iovec>& buffers) {
+    ThreadStats* stats = stats_->Local();
+    size_t index = 0;
+    while (index < buffers.size()) {
+        int count = std::min(buffers.size() - index, (size_t) IOV_MAX);
+        ssize_t read_bytes = preadv(fd_, &buffers[index], count, offset);
+        assert(read_bytes != -1 || !"I/O error when reading the lists file!");
+        ThreadStats::Add(stats->read_syscalls, 1);
+        if (read_bytes <= 0) {
+            /** End of file, the rest of the buffers keeps its reset content. */
+            break;
+        }
+        ThreadStats::Add(stats->bytes_read, read_bytes);
+        offset += read_bytes;
+
+        /** Skip the filled buffers. A short read continues in the middle of a buffer. */
+        size_t remaining = read_bytes;
+        while (index < buffers.size() && remaining >= buffers[index].iov_len) {
+            remaining -= buffers[index].iov_len;
+            index++;
+        }
+        if (remaining > 0) {
+            buffers[index].iov_base = (char*) buffers[index].iov_base + remaining;
+            buffers[index].iov_len -= remaining;
+        }
+    }
+}
+
+}
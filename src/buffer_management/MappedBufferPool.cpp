@@ -0,0 +1,295 @@
+#include "buffer_management/MappedBufferPool.hpp"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ann_dkvs {
+MappedBufferPool::MappedBufferPool(size_t budget_bytes, const StorageLists* lists, std::string filename, bool lock_lists)
+    : budget_bytes_(budget_bytes), lock_lists_(lock_lists) {
+
+    db_io_ = open(filename.c_str(), O_RDONLY);
+    assert(db_io_ != -1 || !"Cannot open the lists file on disk!");
+    struct stat file_stat;
+    fstat(db_io_, &file_stat);
+    mapped_size_ = file_stat.st_size;
+    /** No MAP_POPULATE: only the lists which are fetched are read. */
+    base_ = (uint8_t*) mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, db_io_, 0);
+    assert(base_ != MAP_FAILED || !"Cannot map the lists file!");
+    madvise(base_, mapped_size_, MADV_RANDOM);
+
+    lists_.resize(NUM_LISTS);
+    for (size_t i = 0; i < NUM_LISTS; i++) {
+        StorageLists::InvertedList list;
+        uint64_t version;
+        bool list_found = lists->get_list_snapshot(i, list, version);
+        assert(list_found || !"Cannot find the list id from the disk file!");
+        assert(list.offset + lists->get_vector_size() * list.allocated_entries <= mapped_size_ || !"The list is not in the lists file!");
+
+        lists_[i].vectors_offset = list.offset;
+        lists_[i].ids_offset = list.offset + lists->get_vector_size() * list.allocated_entries;
+        lists_[i].norms_offset = lists->has_norms() ? lists_[i].ids_offset + sizeof(vector_id_t) * list.allocated_entries : 0;
+        lists_[i].length = list.used_entries;
+        lists_[i].list_size = ceil(list.used_entries / (double) FRAME_DATA_NUM);
+        assert(lists_[i].list_size < (1L << MAPPED_FRAME_SHIFT) || !"The list has too many frames!");
+    }
+}
+
+std::vector<std::pair<size_t, size_t> > MappedBufferPool::ListRanges(list_id_t list_id) {
+    const MappedList& list = lists_[list_id];
+    std::vector<std::pair<size_t, size_t> > ranges;
+    ranges.push_back(std::make_pair(list.vectors_offset, list.vectors_offset + list.length * DATA_DIMENSION * sizeof(vector_el_t)));
+    ranges.push_back(std::make_pair(list.ids_offset, list.ids_offset + list.length * sizeof(vector_id_t)));
+    if (list.norms_offset != 0) {
+        ranges.push_back(std::make_pair(list.norms_offset, list.norms_offset + list.length * sizeof(distance_t)));
+    }
+    return ranges;
+}
+
+std::pair<size_t, size_t> MappedBufferPool::PageRange(const std::pair<size_t, size_t>& range) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return std::make_pair(range.first / page_size * page_size,
+                          std::min((range.second + page_size - 1) / page_size * page_size, mapped_size_));
+}
+
+void MappedBufferPool::ReferenceBoundaryPages(list_id_t list_id) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    for (auto& range : ListRanges(list_id)) {
+        if (range.first == range.second) {
+            continue;
+        }
+        size_t first_page = range.first / page_size;
+        size_t last_page = (range.second - 1) / page_size;
+        boundary_page_refs_[first_page]++;
+        if (last_page != first_page) {
+            boundary_page_refs_[last_page]++;
+        }
+    }
+}
+
+size_t MappedBufferPool::ListBytes(list_id_t list_id) {
+    size_t bytes = 0;
+    for (auto& range : ListRanges(list_id)) {
+        bytes += range.second - range.first;
+    }
+    return bytes;
+}
+
+size_t MappedBufferPool::PopulateList(list_id_t list_id) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t bytes = 0;
+    for (auto& byte_range : ListRanges(list_id)) {
+        auto range = PageRange(byte_range);
+        uint8_t* start = base_ + range.first;
+        size_t length = range.second - range.first;
+        bytes += length;
+        bool populated = false;
+#ifdef MADV_POPULATE_READ
+        populated = madvise(start, length, MADV_POPULATE_READ) == 0;
+#endif
+        if (!populated) {
+            /** Older kernels: start the read-ahead of the whole range, then fault every page in. */
+            madvise(start, length, MADV_WILLNEED);
+            volatile uint8_t sink = 0;
+            for (size_t offset = 0; offset < length; offset += page_size) {
+                sink += start[offset];
+            }
+        }
+        if (lock_lists_ && mlock(start, length) != 0) {
+            std::cout << "WARNING: Cannot lock the lists in memory, check RLIMIT_MEMLOCK. Locking is disabled." << std::endl;
+            lock_lists_ = false;
+        }
+    }
+    return bytes;
+}
+
+void MappedBufferPool::DropList(list_id_t list_id) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    auto release_page = [this](size_t page) {
+        auto refs = boundary_page_refs_.find(page);
+        if (--refs->second != 0) {
+            return false;
+        }
+        boundary_page_refs_.erase(refs);
+        return true;
+    };
+    for (auto& range : ListRanges(list_id)) {
+        if (range.first == range.second) {
+            continue;
+        }
+        /** The pages in between belong to this list only, the first and the last one may be shared with a neighbour. */
+        size_t first_page = range.first / page_size;
+        size_t last_page = (range.second - 1) / page_size;
+        bool drop_first = release_page(first_page);
+        bool drop_last = last_page == first_page ? drop_first : release_page(last_page);
+        size_t start_page = drop_first ? first_page : first_page + 1;
+        size_t end_page = drop_last ? last_page + 1 : last_page;
+        if (start_page >= end_page) {
+            continue;
+        }
+        size_t offset = start_page * page_size;
+        size_t length = std::min(end_page * page_size, mapped_size_) - offset;
+        munlock(base_ + offset, length);
+        /** Unmap the pages from this process and drop them from the page cache, so the memory is really given back. */
+        madvise(base_ + offset, length, MADV_DONTNEED);
+        posix_fadvise(db_io_, offset, length, POSIX_FADV_DONTNEED);
+    }
+}
+
+void MappedBufferPool::EnforceBudget() {
+    auto iter = lru_list_.end();
+    while (resident_bytes_ > budget_bytes_ && iter != lru_list_.begin()) {
+        iter--;
+        list_id_t list_id = *iter;
+        MappedList& list = lists_[list_id];
+        if (list.pin_count != 0) {
+            continue;
+        }
+        DropList(list_id);
+        iter = lru_list_.erase(iter);
+        list.resident = false;
+        resident_bytes_ -= ListBytes(list_id);
+        ThreadStats::Add(stats_.Local()->evictions, 1);
+    }
+}
+
+std::vector<frame_id_t> MappedBufferPool::FetchListPages(list_id_t list_id) {
+    auto start_time = std::chrono::steady_clock::now();
+    ThreadStats* stats = stats_.Local();
+    std::vector<frame_id_t> found_pages;
+    bool resident;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        MappedList& list = lists_[list_id];
+        list.pin_count++;
+        resident = list.resident;
+        if (resident) {
+            lru_list_.splice(lru_list_.begin(), lru_list_, list.lru_position);
+        } else {
+            list.resident = true;
+            lru_list_.push_front(list_id);
+            list.lru_position = lru_list_.begin();
+            resident_bytes_ += ListBytes(list_id);
+            ReferenceBoundaryPages(list_id);
+            /** The new list is pinned, so the budget is kept by dropping other lists only. */
+            EnforceBudget();
+        }
+        for (int i = 0; i < list.list_size; i++) {
+            found_pages.push_back((list_id << MAPPED_FRAME_SHIFT) | i);
+        }
+    }
+
+    if (resident) {
+        ThreadStats::Add(stats->hits, 1);
+        stats->AddListHit(list_id);
+    } else {
+        /** Concurrent fetches of the list meanwhile fault the pages in by themselves. */
+        ThreadStats::Add(stats->misses, 1);
+        stats->AddListMiss(list_id);
+        auto io_start_time = std::chrono::steady_clock::now();
+        ThreadStats::Add(stats->bytes_read, PopulateList(list_id));
+        ThreadStats::AddLatency(stats->io_latency, stats->io_latency_sum, BufferPoolStats::ElapsedNs(io_start_time));
+    }
+    ThreadStats::AddLatency(stats->fetch_latency, stats->fetch_latency_sum, BufferPoolStats::ElapsedNs(start_time));
+    return found_pages;
+}
+
+ListView MappedBufferPool::FetchListView(list_id_t list_id) {
+    return MakeListView(list_id, FetchListPages(list_id));
+}
+
+ListView MappedBufferPool::MakeListView(list_id_t list_id, const std::vector<frame_id_t>& frame_ids) {
+    ListView view;
+    for (frame_id_t frame_id : frame_ids) {
+        view.frame_vectors.push_back(GetPageVectors(frame_id));
+        view.frame_ids.push_back(GetPageIDs(frame_id));
+    }
+    view.vectors = (const vector_el_t*) (base_ + lists_[list_id].vectors_offset);
+    view.ids = (const vector_id_t*) (base_ + lists_[list_id].ids_offset);
+    if (lists_[list_id].norms_offset != 0) {
+        view.norms = (const distance_t*) (base_ + lists_[list_id].norms_offset);
+    }
+    view.length = lists_[list_id].length;
+    return view;
+}
+
+bool MappedBufferPool::FetchResidentListView(list_id_t list_id, ListView* view) {
+    ThreadStats* stats = stats_.Local();
+    std::vector<frame_id_t> found_pages;
+    {
+        std::scoped_lock<std::mutex> lock(latch_);
+        MappedList& list = lists_[list_id];
+        if (!list.resident) {
+            return false;
+        }
+        list.pin_count++;
+        lru_list_.splice(lru_list_.begin(), lru_list_, list.lru_position);
+        for (int i = 0; i < list.list_size; i++) {
+            found_pages.push_back((list_id << MAPPED_FRAME_SHIFT) | i);
+        }
+    }
+    ThreadStats::Add(stats->hits, 1);
+    stats->AddListHit(list_id);
+    *view = MakeListView(list_id, found_pages);
+    return true;
+}
+
+bool MappedBufferPool::ReadEntry(list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) {
+    const MappedList& list = lists_[list_id];
+    if (offset >= list.length) {
+        return false;
+    }
+    /** pread() instead of the mapping, so that the pages of the list are not mapped into this process. */
+    ThreadStats* stats = stats_.Local();
+    size_t vector_size = sizeof(vector_el_t) * DATA_DIMENSION;
+    ssize_t read_vector = pread(db_io_, (char*) vector, vector_size, list.vectors_offset + offset * vector_size);
+    assert(read_vector != -1 || !"I/O error when reading file for vectors_!");
+    ssize_t read_id = pread(db_io_, (char*) id, sizeof(vector_id_t), list.ids_offset + offset * sizeof(vector_id_t));
+    assert(read_id != -1 || !"I/O error when reading file for ids_!");
+    ThreadStats::Add(stats->read_syscalls, 2);
+    ThreadStats::Add(stats->bytes_read, std::max(read_vector, (ssize_t) 0) + std::max(read_id, (ssize_t) 0));
+    return read_vector == (ssize_t) vector_size && read_id == (ssize_t) sizeof(vector_id_t);
+}
+
+bool MappedBufferPool::UnPinListPages(list_id_t list_id) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    MappedList& list = lists_[list_id];
+    assert(list.pin_count != 0 || !"Unpin a non-pin list!");
+    list.pin_count--;
+    /** Lists fetched while all others were pinned may have exceeded the budget. */
+    if (list.pin_count == 0 && resident_bytes_ > budget_bytes_) {
+        EnforceBudget();
+    }
+    return true;
+}
+
+void MappedBufferPool::SetMemoryBudget(size_t budget_bytes) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    budget_bytes_ = budget_bytes;
+    EnforceBudget();
+}
+
+size_t MappedBufferPool::GetResidentBytes() {
+    std::scoped_lock<std::mutex> lock(latch_);
+    return resident_bytes_;
+}
+
+BufferPoolStatsSnapshot MappedBufferPool::GetStats() {
+    BufferPoolStatsSnapshot snapshot = stats_.Collect();
+    std::scoped_lock<std::mutex> lock(latch_);
+    for (const MappedList& list : lists_) {
+        if (list.pin_count != 0) {
+            snapshot.pinned_frames += list.list_size;
+        }
+    }
+    return snapshot;
+}
+
+MappedBufferPool::~MappedBufferPool() {
+    munmap(base_, mapped_size_);
+    close(db_io_);
+}
+
+}
@@ -0,0 +1,134 @@
+#include "buffer_management/MissRatioCurve.hpp"
+#include <algorithm>
+#include <cassert>
+#include <math.h>
+
+namespace ann_dkvs {
+MissRatioCurve::MissRatioCurve(double sampling_rate, size_t bucket_size)
+    : bucket_size_(bucket_size) {
+
+    assert((sampling_rate > 0 && sampling_rate <= 1) || !"Sampling rate should be in (0, 1]!");
+    assert(bucket_size_ > 0 || !"Bucket size should be positive!");
+
+    threshold_ = std::max((size_t) 1, (size_t) (sampling_rate * SAMPLING_MODULUS));
+    sampling_rate_ = threshold_ / (double) SAMPLING_MODULUS;
+    Reset();
+}
+
+void MissRatioCurve::Reset() {
+    std::scoped_lock<std::mutex> lock(latch_);
+
+    histogram_.clear();
+    sampled_num_ = 0;
+    hash_to_last_time_.clear();
+    hash_to_list_size_.clear();
+    tree_.assign(1024, 0);
+    current_time_ = 0;
+}
+
+bool MissRatioCurve::IsSampled(list_id_t list_id) {
+    /** splitmix64 finalizer, so that neighbouring list ids are sampled independently. */
+    uint64_t x = (uint64_t) list_id + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x = x ^ (x >> 31);
+    return (x & (SAMPLING_MODULUS - 1)) < threshold_;
+}
+
+void MissRatioCurve::TreeAdd(size_t time, int64_t delta) {
+    for (size_t i = time + 1; i <= tree_.size(); i += i & (~i + 1)) {
+        tree_[i - 1] += delta;
+    }
+}
+
+int64_t MissRatioCurve::TreeSum(size_t time) {
+    int64_t sum = 0;
+    for (size_t i = time + 1; i > 0; i -= i & (~i + 1)) {
+        sum += tree_[i - 1];
+    }
+    return sum;
+}
+
+void MissRatioCurve::Compact() {
+    std::vector<std::pair<size_t, list_id_t> > last_times;
+    for (auto& item : hash_to_last_time_) {
+        last_times.push_back(std::make_pair(item.second, item.first));
+    }
+    std::sort(last_times.begin(), last_times.end());
+
+    /** Keep at least half of the tree free, so compactions stay rare. */
+    tree_.assign(std::max((size_t) 1024, 2 * last_times.size()), 0);
+    for (size_t i = 0; i < last_times.size(); i++) {
+        list_id_t list_id = last_times[i].second;
+        hash_to_last_time_[list_id] = i;
+        TreeAdd(i, hash_to_list_size_[list_id]);
+    }
+    current_time_ = last_times.size();
+}
+
+void MissRatioCurve::AccessList(list_id_t list_id, int list_size) {
+    /** Empty lists take no frames, they neither miss nor push other lists out. */
+    if (list_size == 0 || !IsSampled(list_id)) {
+        return;
+    }
+    std::scoped_lock<std::mutex> lock(latch_);
+
+    if (current_time_ == tree_.size()) {
+        Compact();
+    }
+
+    sampled_num_++;
+    auto iter = hash_to_last_time_.find(list_id);
+    if (iter != hash_to_last_time_.end()) {
+        size_t last_time = iter->second;
+        /** Frames of the distinct sampled lists accessed after the previous access. */
+        int64_t distance = TreeSum(current_time_ - 1) - TreeSum(last_time);
+        size_t scaled_distance = (size_t) ceil(distance / sampling_rate_) + list_size;
+
+        size_t bucket = (scaled_distance - 1) / bucket_size_;
+        if (bucket >= histogram_.size()) {
+            histogram_.resize(bucket + 1, 0);
+        }
+        histogram_[bucket]++;
+
+        TreeAdd(last_time, -hash_to_list_size_[list_id]);
+    }
+
+    hash_to_last_time_[list_id] = current_time_;
+    hash_to_list_size_[list_id] = list_size;
+    TreeAdd(current_time_, list_size);
+    current_time_++;
+}
+
+double MissRatioCurve::GetHitRatio(size_t pool_size) {
+    std::scoped_lock<std::mutex> lock(latch_);
+
+    if (sampled_num_ == 0) {
+        return 0;
+    }
+    /** Buckets which lie entirely within the pool size. */
+    size_t hit_num = 0;
+    size_t bucket_num = std::min(pool_size / bucket_size_, histogram_.size());
+    for (size_t i = 0; i < bucket_num; i++) {
+        hit_num += histogram_[i];
+    }
+    return hit_num / (double) sampled_num_;
+}
+
+size_t MissRatioCurve::GetPoolSizeForHitRatio(double hit_ratio) {
+    std::scoped_lock<std::mutex> lock(latch_);
+
+    if (sampled_num_ == 0) {
+        return 0;
+    }
+    size_t hit_num = 0;
+    for (size_t i = 0; i < histogram_.size(); i++) {
+        hit_num += histogram_[i];
+        if (hit_num / (double) sampled_num_ >= hit_ratio) {
+            return (i + 1) * bucket_size_;
+        }
+    }
+    return 0;
+}
+
+}
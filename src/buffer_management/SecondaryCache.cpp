@@ -0,0 +1,160 @@
+#include "buffer_management/SecondaryCache.hpp"
+#include <cassert>
+#include <cstring>
+#include <sys/uio.h>
+#include <iostream>
+
+namespace ann_dkvs {
+SecondaryCache::SecondaryCache(const std::string& directory, size_t capacity)
+    : capacity_(capacity) {
+
+    filename_ = directory + "/" + SECONDARY_CACHE_FILENAME;
+    /** The cache is only valid during the lifetime of the object, so always start from an empty file. */
+    cache_io_ = open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(cache_io_ != -1 || !"Cannot create the secondary cache file!");
+    if (ftruncate(cache_io_, capacity_ * SLOT_BYTES) == -1) {
+        std::cout << "WARNING: Cannot reserve space for the secondary cache file!" << std::endl;
+    }
+
+    /** Hand out the slots from the beginning of the file first. */
+    for (size_t i = capacity_; i > 0; i--) {
+        free_slots_.push_back(i - 1);
+    }
+}
+
+bool SecondaryCache::Contains(list_id_t list_id) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    return hash_to_slots_.find(list_id) != hash_to_slots_.end();
+}
+
+bool SecondaryCache::EvictList() {
+    if (lru_list_.empty()) {
+        return false;
+    }
+    EraseInternal(lru_list_.back());
+    return true;
+}
+
+void SecondaryCache::EraseInternal(list_id_t list_id) {
+    auto iter = hash_to_slots_.find(list_id);
+    if (iter == hash_to_slots_.end()) {
+        return;
+    }
+    for (size_t slot : iter->second) {
+        free_slots_.push_back(slot);
+    }
+    hash_to_slots_.erase(iter);
+
+    lru_list_.erase(hash_to_lru_[list_id]);
+    hash_to_lru_.erase(list_id);
+}
+
+void SecondaryCache::Erase(list_id_t list_id) {
+    std::scoped_lock<std::mutex> lock(latch_);
+    /** A list being written is discarded once its write is done, its slots are still in use until then. */
+    auto pending = pending_lists_.find(list_id);
+    if (pending != pending_lists_.end()) {
+        pending->second = false;
+    }
+    EraseInternal(list_id);
+}
+
+bool SecondaryCache::Reserve(list_id_t list_id, size_t page_num, std::vector<size_t>& slots) {
+    std::scoped_lock<std::mutex> lock(latch_);
+
+    if (page_num > capacity_ || pending_lists_.find(list_id) != pending_lists_.end()) {
+        return false;
+    }
+
+    /** Already cached, just move it to the front. */
+    auto lru_iter = hash_to_lru_.find(list_id);
+    if (lru_iter != hash_to_lru_.end()) {
+        lru_list_.splice(lru_list_.begin(), lru_list_, lru_iter->second);
+        return false;
+    }
+
+    /** The slots of lists being written cannot be taken, so there may not be enough of them. */
+    while (free_slots_.size() < page_num) {
+        if (!EvictList()) {
+            return false;
+        }
+    }
+
+    slots.clear();
+    for (size_t i = 0; i < page_num; i++) {
+        slots.push_back(free_slots_.back());
+        free_slots_.pop_back();
+    }
+    pending_lists_[list_id] = true;
+    return true;
+}
+
+bool SecondaryCache::Write(list_id_t list_id, const std::vector<size_t>& slots, const char* frames) {
+    bool written = true;
+    for (size_t i = 0; i < slots.size() && written; i++) {
+        ssize_t write_bytes = pwrite(cache_io_, frames + i * SLOT_BYTES, SLOT_BYTES, slots[i] * SLOT_BYTES);
+        written = write_bytes == (ssize_t) SLOT_BYTES;
+    }
+
+    std::scoped_lock<std::mutex> lock(latch_);
+    auto pending = pending_lists_.find(list_id);
+    assert(pending != pending_lists_.end() || !"Write a list whose slots are not reserved!");
+    bool valid = pending->second;
+    pending_lists_.erase(pending);
+    if (!written || !valid) {
+        /** Give back the slots and do not cache a partially written or outdated list. */
+        for (size_t slot : slots) {
+            free_slots_.push_back(slot);
+        }
+        return false;
+    }
+
+    hash_to_slots_[list_id] = slots;
+    lru_list_.push_front(list_id);
+    hash_to_lru_[list_id] = lru_list_.begin();
+    return true;
+}
+
+void SecondaryCache::CopyFrame(Page* page, char* slot) {
+    /** Vectors, ids and norms of a frame are stored back-to-back in a slot, written with one syscall. */
+    memcpy(slot, page->GetVectors(), sizeof(vector_el_t) * FRAME_DATA_SIZE);
+    slot += sizeof(vector_el_t) * FRAME_DATA_SIZE;
+    memcpy(slot, page->GetIDs(), sizeof(vector_id_t) * FRAME_DATA_NUM);
+    slot += sizeof(vector_id_t) * FRAME_DATA_NUM;
+    memcpy(slot, page->GetNorms(), sizeof(distance_t) * FRAME_DATA_NUM);
+}
+
+bool SecondaryCache::ReadFrame(list_id_t list_id, size_t idx, Page* page) {
+    /** Hold the latch during the read, so that the slot cannot be reused by a concurrent Reserve(). */
+    std::scoped_lock<std::mutex> lock(latch_);
+    auto iter = hash_to_slots_.find(list_id);
+    if (iter == hash_to_slots_.end() || idx >= iter->second.size()) {
+        return false;
+    }
+    size_t slot = iter->second[idx];
+
+    /** Reading the first frame counts as one access of the list. */
+    if (idx == 0) {
+        lru_list_.splice(lru_list_.begin(), lru_list_, hash_to_lru_[list_id]);
+    }
+
+    struct iovec iov[3];
+    iov[0].iov_base = page->GetVectors();
+    iov[0].iov_len = sizeof(vector_el_t) * FRAME_DATA_SIZE;
+    iov[1].iov_base = page->GetIDs();
+    iov[1].iov_len = sizeof(vector_id_t) * FRAME_DATA_NUM;
+    iov[2].iov_base = page->GetNorms();
+    iov[2].iov_len = sizeof(distance_t) * FRAME_DATA_NUM;
+
+    ssize_t read_bytes = preadv(cache_io_, iov, 3, slot * SLOT_BYTES);
+    return read_bytes == (ssize_t) SLOT_BYTES;
+}
+
+SecondaryCache::~SecondaryCache() {
+    if (close(cache_io_) < 0) {
+        assert("Failed to close the secondary cache file!");
+    }
+    unlink(filename_.c_str());
+}
+
+}
@@ -0,0 +1,420 @@
+#include "buffer_management/SharedBufferPool.hpp"
+#include <cassert>
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <math.h>
+#include <new>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** How long a waiting process sleeps before it checks for dead loaders. */
+#define SHARED_POOL_WAIT_NS (50 * 1000 * 1000)
+/** How long a process waits for the creator to initialize the segment. */
+#define SHARED_POOL_ATTACH_MS 10000
+
+namespace ann_dkvs {
+SharedBufferPool::SharedBufferPool(const std::string& name, size_t pool_size, const StorageLists* lists, std::string filename)
+    : name_(name) {
+
+    db_io_ = open(filename.c_str(), O_RDONLY);
+    assert(db_io_ != -1 || !"Cannot open the lists file on disk!");
+
+    /** The locations are the same in every process, only the segment is shared. */
+    uint64_t lists_signature = 14695981039346656037UL;
+    for (size_t i = 0; i < NUM_LISTS; i++) {
+        StorageLists::InvertedList list;
+        uint64_t version;
+        bool list_found = lists->get_list_snapshot(i, list, version);
+        assert(list_found || !"Cannot find the list id from the disk file!");
+
+        list_offsets_.push_back(std::make_pair(list.offset, list.offset + lists->get_vector_size() * list.allocated_entries));
+        list_lengths_.push_back(list.used_entries);
+        list_norms_offsets_.push_back(lists->has_norms() ? list_offsets_.back().second + sizeof(vector_id_t) * list.allocated_entries : 0);
+        lists_signature = (lists_signature ^ list.used_entries) * 1099511628211UL;
+        lists_signature = (lists_signature ^ list.offset) * 1099511628211UL;
+    }
+
+    shm_fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shm_fd_ != -1) {
+        creator_ = true;
+        segment_size_ = SegmentSize(pool_size);
+        int truncated = ftruncate(shm_fd_, segment_size_);
+        assert(truncated == 0 || !"Cannot size the shared memory segment!");
+    } else {
+        assert(errno == EEXIST || !"Cannot create the shared memory segment!");
+        shm_fd_ = shm_open(name.c_str(), O_RDWR, 0600);
+        assert(shm_fd_ != -1 || !"Cannot open the shared memory segment!");
+        /** The creator sizes the segment right after creating it. */
+        struct stat segment_stat;
+        for (int i = 0; i < SHARED_POOL_ATTACH_MS && fstat(shm_fd_, &segment_stat) == 0 && segment_stat.st_size == 0; i++) {
+            usleep(1000);
+        }
+        segment_size_ = segment_stat.st_size;
+        assert(segment_size_ > sizeof(SharedHeader) || !"The shared memory segment has not been created!");
+    }
+
+    void* memory = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd_, 0);
+    assert(memory != MAP_FAILED || !"Cannot map the shared memory segment!");
+    header_ = (SharedHeader*) memory;
+    if (creator_) {
+        InitSegment(pool_size, lists_signature);
+    } else {
+        for (int i = 0; i < SHARED_POOL_ATTACH_MS && header_->magic.load(std::memory_order_acquire) != SHARED_POOL_MAGIC; i++) {
+            usleep(1000);
+        }
+        assert(header_->magic.load(std::memory_order_acquire) == SHARED_POOL_MAGIC || !"The shared memory segment has not been initialized!");
+        assert(header_->frame_bytes == sizeof(Page) || !"The shared buffer pool has been created with another frame size!");
+        assert(header_->list_num == NUM_LISTS || !"The shared buffer pool has been created with another number of lists!");
+        if (header_->lists_signature != lists_signature) {
+            std::cout << "WARNING: The shared buffer pool " << name << " has been created for different lists." << std::endl;
+        }
+    }
+    directory_ = (SharedListEntry*) ((char*) memory + header_->directory_offset);
+    flags_ = (uint8_t*) memory + header_->flags_offset;
+    pages_ = (Page*) ((char*) memory + header_->pages_offset);
+
+    Lock();
+    header_->attached++;
+    Unlock();
+}
+
+size_t SharedBufferPool::SegmentSize(size_t pool_size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = sizeof(SharedHeader) + NUM_LISTS * sizeof(SharedListEntry) + pool_size;
+    /** The frames start at a page boundary. */
+    return (size + page_size - 1) / page_size * page_size + pool_size * sizeof(Page);
+}
+
+void SharedBufferPool::InitSegment(size_t pool_size, uint64_t lists_signature) {
+    new (header_) SharedHeader();
+    header_->pool_size = pool_size;
+    header_->list_num = NUM_LISTS;
+    header_->frame_bytes = sizeof(Page);
+    header_->lists_signature = lists_signature;
+    header_->directory_offset = sizeof(SharedHeader);
+    header_->flags_offset = header_->directory_offset + NUM_LISTS * sizeof(SharedListEntry);
+    header_->pages_offset = SegmentSize(pool_size) - pool_size * sizeof(Page);
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header_->latch, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&header_->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    char* memory = (char*) header_;
+    SharedListEntry* directory = (SharedListEntry*) (memory + header_->directory_offset);
+    for (size_t i = 0; i < NUM_LISTS; i++) {
+        directory[i].first_frame = -1;
+        directory[i].loader_pid = 0;
+    }
+    Page* pages = (Page*) (memory + header_->pages_offset);
+    for (size_t i = 0; i < pool_size; i++) {
+        memory[header_->flags_offset + i] = 0;
+        new (&pages[i]) Page();
+    }
+
+    /** Publish the segment to the processes waiting for it. */
+    header_->magic.store(SHARED_POOL_MAGIC, std::memory_order_release);
+}
+
+void SharedBufferPool::Lock() {
+    int result = pthread_mutex_lock(&header_->latch);
+    if (result == EOWNERDEAD) {
+        /** The owner died. Nothing is read from the file while holding the latch, so only its loads are left over. */
+        pthread_mutex_consistent(&header_->latch);
+        DropDeadLoads();
+        return;
+    }
+    assert(result == 0 || !"Cannot lock the shared buffer pool!");
+}
+
+void SharedBufferPool::Unlock() {
+    pthread_mutex_unlock(&header_->latch);
+}
+
+void SharedBufferPool::Wait() {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SHARED_POOL_WAIT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    int result = pthread_cond_timedwait(&header_->cond, &header_->latch, &deadline);
+    if (result == EOWNERDEAD) {
+        pthread_mutex_consistent(&header_->latch);
+    }
+    if (result == EOWNERDEAD || result == ETIMEDOUT) {
+        DropDeadLoads();
+    }
+}
+
+void SharedBufferPool::DropDeadLoads() {
+    bool dropped = false;
+    for (size_t i = 0; i < NUM_LISTS; i++) {
+        pid_t loader_pid = directory_[i].loader_pid;
+        if (loader_pid != 0 && kill(loader_pid, 0) == -1 && errno == ESRCH) {
+            std::cout << "WARNING: Process " << loader_pid << " died while loading list " << i << ", the load is dropped." << std::endl;
+            ReleaseFrames(i);
+            directory_[i].loader_pid = 0;
+            dropped = true;
+        }
+    }
+    if (dropped) {
+        pthread_cond_broadcast(&header_->cond);
+    }
+}
+
+int SharedBufferPool::ListPageSize(list_id_t list_id) {
+    return ceil(list_lengths_[list_id] / (double) FRAME_DATA_NUM);
+}
+
+frame_id_t SharedBufferPool::LookUpFreeList(int size) {
+    int continuous_free_size = 0;
+    for (size_t i = 0; i < header_->pool_size; i++) {
+        continuous_free_size = pages_[i].list_id_ == INVALID_LIST_ID ? continuous_free_size + 1 : 0;
+        if (continuous_free_size >= size) {
+            return i + 1 - size;
+        }
+    }
+    return -1;
+}
+
+bool SharedBufferPool::EvictList() {
+    /** Two rounds: the first one may only clear the reference flags. */
+    for (size_t step = 0; step < 2 * header_->pool_size; step++) {
+        size_t frame_id = header_->clock_pointer;
+        header_->clock_pointer = (frame_id + 1) % header_->pool_size;
+        if (!(flags_[frame_id] & FRAME_FIRST) || pages_[frame_id].pin_count_ != 0) {
+            continue;
+        }
+        if (flags_[frame_id] & FRAME_REFERENCED) {
+            flags_[frame_id] &= ~FRAME_REFERENCED;
+            continue;
+        }
+        ReleaseFrames(pages_[frame_id].list_id_);
+        header_->evictions++;
+        return true;
+    }
+    return false;
+}
+
+void SharedBufferPool::ReleaseFrames(list_id_t list_id) {
+    frame_id_t frame_id = directory_[list_id].first_frame;
+    if (frame_id == -1) {
+        return;
+    }
+    int list_size = pages_[frame_id].list_size_;
+    for (int i = 0; i < list_size; i++) {
+        Page& page = pages_[frame_id + i];
+        page.list_id_ = INVALID_LIST_ID;
+        page.list_size_ = 0;
+        page.pin_count_ = 0;
+        flags_[frame_id + i] = 0;
+    }
+    directory_[list_id].first_frame = -1;
+}
+
+size_t SharedBufferPool::LoadFrames(list_id_t list_id, frame_id_t first_frame, int list_size) {
+    size_t list_length = list_lengths_[list_id];
+    size_t bytes_read = 0;
+    for (int i = 0; i < list_size; i++) {
+        Page& page = pages_[first_frame + i];
+        size_t item_num = FRAME_DATA_NUM;
+        if (i == list_size - 1 && list_length % FRAME_DATA_NUM != 0) {
+            item_num = list_length % FRAME_DATA_NUM;
+        }
+        size_t vectors_offset = list_offsets_[list_id].first + i * FRAME_DATA_SIZE * sizeof(vector_el_t);
+        size_t ids_offset = list_offsets_[list_id].second + i * FRAME_DATA_NUM * sizeof(vector_id_t);
+
+        ssize_t read_vectors = pread(db_io_, (char*) page.GetVectors(), item_num * sizeof(vector_el_t) * DATA_DIMENSION, vectors_offset);
+        assert(read_vectors != -1 || !"I/O error when reading file for vectors_!");
+        ssize_t read_ids = pread(db_io_, (char*) page.GetIDs(), item_num * sizeof(vector_id_t), ids_offset);
+        assert(read_ids != -1 || !"I/O error when reading file for ids_!");
+        bytes_read += std::max(read_vectors, (ssize_t) 0) + std::max(read_ids, (ssize_t) 0);
+        if (list_norms_offsets_[list_id] != 0) {
+            size_t norms_offset = list_norms_offsets_[list_id] + i * FRAME_DATA_NUM * sizeof(distance_t);
+            ssize_t read_norms = pread(db_io_, (char*) page.GetNorms(), item_num * sizeof(distance_t), norms_offset);
+            assert(read_norms != -1 || !"I/O error when reading file for norms_!");
+            bytes_read += std::max(read_norms, (ssize_t) 0);
+        }
+    }
+    return bytes_read;
+}
+
+std::vector<frame_id_t> SharedBufferPool::FetchListPages(list_id_t list_id) {
+    std::vector<frame_id_t> found_pages;
+    int fetch_size = ListPageSize(list_id);
+    assert((size_t) fetch_size <= header_->pool_size || !"The list is larger than the shared buffer pool!");
+
+    Lock();
+    SharedListEntry& entry = directory_[list_id];
+    /** Another thread or process is loading the list. */
+    while (entry.loader_pid != 0) {
+        Wait();
+    }
+
+    if (entry.first_frame != -1) {
+        header_->hits++;
+        frame_id_t frame_id = entry.first_frame;
+        for (int i = 0; i < fetch_size; i++) {
+            pages_[frame_id + i].pin_count_++;
+            found_pages.push_back(frame_id + i);
+        }
+        flags_[frame_id] |= FRAME_REFERENCED;
+        Unlock();
+        return found_pages;
+    }
+
+    /** Publish the load first, the latch is released while waiting for frames. */
+    header_->misses++;
+    entry.loader_pid = getpid();
+    frame_id_t frame_id = LookUpFreeList(fetch_size);
+    while (frame_id == -1) {
+        if (!EvictList()) {
+            /** Every list is pinned, wait until one is unpinned. */
+            Wait();
+        }
+        frame_id = LookUpFreeList(fetch_size);
+    }
+
+    /** Pinned by the caller, so the frames are not evicted during the load. */
+    for (int i = 0; i < fetch_size; i++) {
+        Page& page = pages_[frame_id + i];
+        page.list_id_ = list_id;
+        page.list_size_ = fetch_size;
+        page.pin_count_ = 1;
+        flags_[frame_id + i] = i == 0 ? FRAME_FIRST | FRAME_REFERENCED : 0;
+        found_pages.push_back(frame_id + i);
+    }
+    entry.first_frame = frame_id;
+    Unlock();
+
+    size_t bytes_read = LoadFrames(list_id, frame_id, fetch_size);
+
+    Lock();
+    entry.loader_pid = 0;
+    header_->bytes_read += bytes_read;
+    header_->read_syscalls += (list_norms_offsets_[list_id] != 0 ? 3 : 2) * fetch_size;
+    pthread_cond_broadcast(&header_->cond);
+    Unlock();
+    return found_pages;
+}
+
+ListView SharedBufferPool::FetchListView(list_id_t list_id) {
+    return MakeListView(list_id, FetchListPages(list_id));
+}
+
+ListView SharedBufferPool::MakeListView(list_id_t list_id, const std::vector<frame_id_t>& frame_ids) {
+    ListView view;
+    for (frame_id_t frame_id : frame_ids) {
+        view.frame_vectors.push_back(GetPageVectors(frame_id));
+        view.frame_ids.push_back(GetPageIDs(frame_id));
+        if (list_norms_offsets_[list_id] != 0) {
+            view.frame_norms.push_back(pages_[frame_id].GetNorms());
+        }
+    }
+    if (view.frame_vectors.size() == 1) {
+        view.vectors = view.frame_vectors[0];
+        view.ids = view.frame_ids[0];
+        if (!view.frame_norms.empty()) {
+            view.norms = view.frame_norms[0];
+        }
+    }
+    view.length = list_lengths_[list_id];
+    return view;
+}
+
+bool SharedBufferPool::FetchResidentListView(list_id_t list_id, ListView* view) {
+    std::vector<frame_id_t> found_pages;
+    Lock();
+    SharedListEntry& entry = directory_[list_id];
+    if (entry.loader_pid != 0 || entry.first_frame == -1) {
+        Unlock();
+        return false;
+    }
+    header_->hits++;
+    frame_id_t frame_id = entry.first_frame;
+    int fetch_size = ListPageSize(list_id);
+    for (int i = 0; i < fetch_size; i++) {
+        pages_[frame_id + i].pin_count_++;
+        found_pages.push_back(frame_id + i);
+    }
+    flags_[frame_id] |= FRAME_REFERENCED;
+    Unlock();
+    *view = MakeListView(list_id, found_pages);
+    return true;
+}
+
+bool SharedBufferPool::ReadEntry(list_id_t list_id, len_t offset, vector_el_t* vector, vector_id_t* id) {
+    if (offset >= list_lengths_[list_id]) {
+        return false;
+    }
+    size_t vector_size = sizeof(vector_el_t) * DATA_DIMENSION;
+    ssize_t read_vector = pread(db_io_, (char*) vector, vector_size, list_offsets_[list_id].first + offset * vector_size);
+    assert(read_vector != -1 || !"I/O error when reading file for vectors_!");
+    ssize_t read_id = pread(db_io_, (char*) id, sizeof(vector_id_t), list_offsets_[list_id].second + offset * sizeof(vector_id_t));
+    assert(read_id != -1 || !"I/O error when reading file for ids_!");
+
+    Lock();
+    header_->bytes_read += std::max(read_vector, (ssize_t) 0) + std::max(read_id, (ssize_t) 0);
+    header_->read_syscalls += 2;
+    Unlock();
+    return read_vector == (ssize_t) vector_size && read_id == (ssize_t) sizeof(vector_id_t);
+}
+
+bool SharedBufferPool::UnPinListPages(list_id_t list_id) {
+    Lock();
+    frame_id_t frame_id = directory_[list_id].first_frame;
+    assert(frame_id != -1 || !"Try to unpin a list not in the buffer pool!");
+
+    int list_size = pages_[frame_id].list_size_;
+    for (int i = 0; i < list_size; i++) {
+        assert(pages_[frame_id + i].pin_count_ != 0 || !"Unpin a non-pin list!");
+        pages_[frame_id + i].pin_count_--;
+    }
+    if (pages_[frame_id].pin_count_ == 0) {
+        pthread_cond_broadcast(&header_->cond);
+    }
+    Unlock();
+    return true;
+}
+
+BufferPoolStatsSnapshot SharedBufferPool::GetStats() {
+    BufferPoolStatsSnapshot snapshot;
+    Lock();
+    snapshot.hits = header_->hits;
+    snapshot.misses = header_->misses;
+    snapshot.evictions = header_->evictions;
+    snapshot.bytes_read = header_->bytes_read;
+    snapshot.read_syscalls = header_->read_syscalls;
+    for (size_t i = 0; i < header_->pool_size; i++) {
+        snapshot.pinned_frames += pages_[i].pin_count_ != 0;
+    }
+    Unlock();
+    return snapshot;
+}
+
+void SharedBufferPool::Remove(const std::string& name) {
+    shm_unlink(name.c_str());
+}
+
+SharedBufferPool::~SharedBufferPool() {
+    Lock();
+    header_->attached--;
+    Unlock();
+    munmap(header_, segment_size_);
+    close(shm_fd_);
+    close(db_io_);
+}
+
+}
@@ -40,19 +40,26 @@ namespace ann_dkvs
       size_t insertion_index = query->get_n_probe() - query_id - 1;
       list_id_t list_id = nearest_centroids->top().list_id;
       query->set_list_to_probe(insertion_index, list_id);
+      query->set_probe_distance(insertion_index, nearest_centroids->top().distance);
       nearest_centroids->pop();
     }
   }
 
   void RootIndex::preassign_query(Query *query)
+  {
+    dispatch_l2(vector_dim, [&](auto distance)
+                { preassign_query(query, distance); });
+  }
+
+  template <class Distance>
+  void RootIndex::preassign_query(Query *query, Distance)
   {
     centroids_heap_t candidates;
-    distance_func_t distance_func = L2Space(vector_dim).get_distance_func();
 
     for (list_id_t list_id = 0; list_id < (list_id_t)n_centroids; list_id++)
     {
       vector_el_t *centroid = &centroids[list_id * vector_dim];
-      float distance = distance_func(centroid, query->get_query_vector(), &vector_dim);
+      float distance = Distance::compute(centroid, query->get_query_vector(), vector_dim);
       const CentroidsResult result = {.distance = distance, .list_id = list_id};
       add_candidate(query, result, candidates);
     }
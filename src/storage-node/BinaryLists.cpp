@@ -0,0 +1,150 @@
+#include <stdexcept>
+
+#include "storage-node/BinaryLists.hpp"
+#include "L2Space.hpp"
+
+namespace ann_dkvs
+{
+  BinaryLists::BinaryLists(size_t vector_dim)
+      : vector_dim(vector_dim), n_words((vector_dim + 63) / 64)
+  {
+    if (vector_dim == 0 || n_words > HAMMING_MAX_WORDS)
+    {
+      throw std::out_of_range("Vector dimension must be between 1 and 64 * HAMMING_MAX_WORDS");
+    }
+  }
+
+  void BinaryLists::encode(const float *centroid, const vector_el_t *vector, uint64_t *code) const
+  {
+    for (size_t w = 0; w < n_words; w++)
+    {
+      code[w] = 0;
+    }
+    for (size_t j = 0; j < vector_dim; j++)
+    {
+      if ((float)vector[j] > centroid[j])
+      {
+        code[j / 64] |= (uint64_t)1 << (j % 64);
+      }
+    }
+  }
+
+  void BinaryLists::encode_query(const list_id_t list_id, const vector_el_t *query, uint64_t *code) const
+  {
+    encode(get_list(list_id).centroid.data(), query, code);
+  }
+
+  void BinaryLists::add_lists(const StorageLists &lists, const float *centroids)
+  {
+    /** The lists are created first, so they can be encoded in parallel without modifying the map. */
+    std::vector<std::pair<list_id_t, CodeList *>> code_lists;
+    for (const auto &list : lists.id_to_list_map)
+    {
+      code_lists.push_back({list.first, &id_to_list_map[list.first]});
+    }
+
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (size_t i = 0; i < code_lists.size(); i++)
+    {
+      list_id_t list_id = code_lists[i].first;
+      CodeList &list = *code_lists[i].second;
+      const vector_el_t *vectors = lists.get_vectors(list_id);
+      len_t length = lists.get_list_length(list_id);
+
+      list.centroid.assign(vector_dim, 0);
+      if (centroids != nullptr)
+      {
+        list.centroid.assign(centroids + list_id * vector_dim, centroids + (list_id + 1) * vector_dim);
+      }
+      else if (length > 0)
+      {
+        std::vector<double> sum(vector_dim, 0);
+        for (len_t v = 0; v < length; v++)
+        {
+          for (size_t j = 0; j < vector_dim; j++)
+          {
+            sum[j] += vectors[v * vector_dim + j];
+          }
+        }
+        for (size_t j = 0; j < vector_dim; j++)
+        {
+          list.centroid[j] = sum[j] / length;
+        }
+      }
+
+      list.codes.resize(length * n_words);
+      for (len_t v = 0; v < length; v++)
+      {
+        encode(list.centroid.data(), vectors + v * vector_dim, list.codes.data() + v * n_words);
+      }
+    }
+  }
+
+  hamming_func_t BinaryLists::get_hamming_func()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    SimdLevel level = L2Space::get_simd_level();
+    if (level == SimdLevel::AVX512 && __builtin_cpu_supports("avx512vpopcntdq"))
+    {
+      return HammingKernelAVX512;
+    }
+    if (level >= SimdLevel::AVX2)
+    {
+      return HammingKernelAVX2;
+    }
+    if (__builtin_cpu_supports("popcnt"))
+    {
+      return HammingKernelPopcnt;
+    }
+#endif
+    return HammingKernelScalar;
+  }
+
+  bool BinaryLists::has_list(const list_id_t list_id) const
+  {
+    return id_to_list_map.find(list_id) != id_to_list_map.end();
+  }
+
+  const BinaryLists::CodeList &BinaryLists::get_list(const list_id_t list_id) const
+  {
+    auto list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    return list_it->second;
+  }
+
+  len_t BinaryLists::get_list_length(const list_id_t list_id) const
+  {
+    return get_list(list_id).codes.size() / n_words;
+  }
+
+  const uint64_t *BinaryLists::get_codes(const list_id_t list_id) const
+  {
+    return get_list(list_id).codes.data();
+  }
+
+  size_t BinaryLists::get_n_words() const
+  {
+    return n_words;
+  }
+
+  size_t BinaryLists::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  size_t BinaryLists::get_total_size() const
+  {
+    size_t total_size = 0;
+    for (const auto &list : id_to_list_map)
+    {
+      total_size += list.second.centroid.size() * sizeof(float) + list.second.codes.size() * sizeof(uint64_t);
+    }
+    return total_size;
+  }
+}
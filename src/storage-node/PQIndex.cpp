@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include "storage-node/PQIndex.hpp"
+
+namespace ann_dkvs
+{
+  PQIndex::PQIndex(const PQLists *lists)
+      : lists(lists), fast_scan_func(PQLists::get_fast_scan_func())
+  {
+  }
+
+  PQCandidates PQIndex::extract_candidates(pq_heap_t &candidates) const
+  {
+    len_t n_candidates = candidates.size();
+    PQCandidates results(n_candidates);
+    for (size_t i = 0; i < n_candidates; i++)
+    {
+      results[n_candidates - i - 1] = candidates.top();
+      candidates.pop();
+    }
+    return results;
+  }
+
+  void PQIndex::add_candidate(const len_t n_results, const PQCandidate &candidate, pq_heap_t &candidates) const
+  {
+    if (candidates.size() < n_results)
+    {
+      candidates.push(candidate);
+    }
+    else if (candidate < candidates.top())
+    {
+      candidates.pop();
+      candidates.push(candidate);
+    }
+  }
+
+  void PQIndex::search_preassigned_list(const PQLookupTable &table, const list_id_t list_id,
+                                        const len_t n_results, pq_heap_t &candidates) const
+  {
+    len_t length = lists->get_list_length(list_id);
+    const uint8_t *codes = lists->get_codes(list_id);
+    const vector_id_t *ids = lists->get_ids(list_id);
+    size_t n_subquantizers = lists->get_quantizer().get_n_subquantizers();
+    size_t block_size = lists->get_block_size();
+
+    uint16_t distances[PQ_FAST_SCAN_BLOCK_SIZE];
+    for (len_t i = 0; i < length; i += PQ_FAST_SCAN_BLOCK_SIZE)
+    {
+      fast_scan_func(codes + i / PQ_FAST_SCAN_BLOCK_SIZE * block_size, table.table.data(), n_subquantizers, distances);
+      len_t n = std::min<len_t>(length - i, PQ_FAST_SCAN_BLOCK_SIZE);
+      /** The furthest candidate, in quantized units. */
+      float threshold = candidates.size() < n_results ? 65536.0f : (candidates.top().distance - table.bias) * table.scale;
+      for (len_t j = 0; j < n; j++)
+      {
+        if (distances[j] > threshold)
+        {
+          continue;
+        }
+        PQCandidate candidate = {table.get_distance(distances[j]), ids[i + j], list_id, i + j};
+        add_candidate(n_results, candidate, candidates);
+        if (candidates.size() == n_results)
+        {
+          threshold = (candidates.top().distance - table.bias) * table.scale;
+        }
+      }
+    }
+  }
+
+  QueryResults PQIndex::search_preassigned(const Query *query) const
+  {
+    PQCandidates candidates = shortlist(query, query->get_n_results());
+    QueryResults results(candidates.size());
+    for (len_t i = 0; i < candidates.size(); i++)
+    {
+      results[i] = {candidates[i].distance, candidates[i].vector_id};
+    }
+    return results;
+  }
+
+  PQCandidates PQIndex::shortlist(const Query *query, const len_t n_candidates) const
+  {
+    PQLookupTable table;
+    lists->compute_lookup_table(query->get_query_vector(), table);
+    pq_heap_t candidates;
+    for (len_t i = 0; i < query->get_n_probe(); i++)
+    {
+      search_preassigned_list(table, query->get_list_to_probe(i), n_candidates, candidates);
+    }
+    return extract_candidates(candidates);
+  }
+
+  QueryResultsBatch PQIndex::batch_search_preassigned(const QueryBatch &queries) const
+  {
+    QueryResultsBatch results(queries.size());
+
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      results[i] = search_preassigned(queries[i]);
+    }
+    return results;
+  }
+}
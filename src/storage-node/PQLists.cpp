@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+#include "storage-node/PQLists.hpp"
+#include "L2Space.hpp"
+
+namespace ann_dkvs
+{
+  PQLists::PQLists(size_t vector_dim, size_t n_subquantizers)
+      : quantizer(vector_dim, n_subquantizers, 4)
+  {
+    if (n_subquantizers % 2 != 0)
+    {
+      throw std::invalid_argument("The number of subquantizers must be even");
+    }
+  }
+
+  void PQLists::train(const vector_el_t *vectors, const len_t n_vectors, const int n_iterations, const unsigned seed)
+  {
+    quantizer.train(vectors, n_vectors, n_iterations, seed);
+  }
+
+  void PQLists::train(const StorageLists &lists, const len_t n_training_vectors, const int n_iterations, const unsigned seed)
+  {
+    /** Positions drawn uniformly among all entries, then sorted, so every list is visited once. */
+    len_t n_entries = 0;
+    std::vector<std::pair<list_id_t, len_t>> list_lengths;
+    for (const auto &list : lists.id_to_list_map)
+    {
+      list_lengths.push_back({list.first, list.second.used_entries});
+      n_entries += list.second.used_entries;
+    }
+    if (n_entries == 0)
+    {
+      throw std::out_of_range("Cannot train on empty lists");
+    }
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<len_t> random_entry(0, n_entries - 1);
+    std::vector<len_t> positions(n_training_vectors);
+    for (len_t &position : positions)
+    {
+      position = random_entry(random);
+    }
+    std::sort(positions.begin(), positions.end());
+
+    size_t vector_dim = lists.get_vector_dim();
+    std::vector<vector_el_t> training_vectors(n_training_vectors * vector_dim);
+    len_t list_start = 0;
+    size_t list_index = 0;
+    for (len_t i = 0; i < n_training_vectors; i++)
+    {
+      while (positions[i] >= list_start + list_lengths[list_index].second)
+      {
+        list_start += list_lengths[list_index].second;
+        list_index++;
+      }
+      const vector_el_t *vector = lists.get_vectors(list_lengths[list_index].first) + (positions[i] - list_start) * vector_dim;
+      std::copy(vector, vector + vector_dim, training_vectors.begin() + i * vector_dim);
+    }
+    train(training_vectors.data(), n_training_vectors, n_iterations, seed);
+  }
+
+  void PQLists::append_entries(CodeList &list, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries) const
+  {
+    size_t n_subquantizers = quantizer.get_n_subquantizers();
+    size_t vector_dim = quantizer.get_vector_dim();
+    len_t length = list.ids.size();
+    len_t n_blocks = (length + n_entries + PQ_FAST_SCAN_BLOCK_SIZE - 1) / PQ_FAST_SCAN_BLOCK_SIZE;
+    list.codes.resize(n_blocks * get_block_size(), 0);
+    list.ids.insert(list.ids.end(), ids, ids + n_entries);
+
+    std::vector<uint8_t> code(n_subquantizers);
+    for (len_t i = 0; i < n_entries; i++)
+    {
+      quantizer.encode(vectors + i * vector_dim, code.data());
+      len_t entry = length + i;
+      uint8_t *block = list.codes.data() + entry / PQ_FAST_SCAN_BLOCK_SIZE * get_block_size();
+      len_t j = entry % PQ_FAST_SCAN_BLOCK_SIZE;
+      for (size_t m = 0; m < n_subquantizers; m++)
+      {
+        block[m * 16 + j % 16] |= j < 16 ? code[m] : code[m] << 4;
+      }
+    }
+  }
+
+  void PQLists::add_entries(const list_id_t list_id, const vector_el_t *vectors, const vector_id_t *ids, const len_t n_entries)
+  {
+    if (!quantizer.is_trained())
+    {
+      throw std::runtime_error("The quantizer must be trained before adding entries");
+    }
+    append_entries(id_to_list_map[list_id], vectors, ids, n_entries);
+  }
+
+  void PQLists::add_lists(const StorageLists &lists)
+  {
+    if (!quantizer.is_trained())
+    {
+      throw std::runtime_error("The quantizer must be trained before adding entries");
+    }
+    /** The lists are created first, so they can be encoded in parallel without modifying the map. */
+    std::vector<std::pair<list_id_t, CodeList *>> code_lists;
+    for (const auto &list : lists.id_to_list_map)
+    {
+      code_lists.push_back({list.first, &id_to_list_map[list.first]});
+    }
+
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (size_t i = 0; i < code_lists.size(); i++)
+    {
+      list_id_t list_id = code_lists[i].first;
+      append_entries(*code_lists[i].second, lists.get_vectors(list_id), lists.get_ids(list_id), lists.get_list_length(list_id));
+    }
+  }
+
+  void PQLists::compute_lookup_table(const vector_el_t *query, PQLookupTable &table) const
+  {
+    size_t n_subquantizers = quantizer.get_n_subquantizers();
+    std::vector<float> distances(n_subquantizers * 16);
+    quantizer.compute_distance_table(query, distances.data());
+
+    /** One scale for all subquantizers, so the quantized entries can be summed; the minimum of every subquantizer goes into the bias. */
+    std::vector<float> minimums(n_subquantizers);
+    float max_range = 0;
+    table.bias = 0;
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      const float *entries = distances.data() + m * 16;
+      minimums[m] = *std::min_element(entries, entries + 16);
+      max_range = std::max(max_range, *std::max_element(entries, entries + 16) - minimums[m]);
+      table.bias += minimums[m];
+    }
+    table.scale = max_range > 0 ? 255 / max_range : 1;
+    table.table.resize(n_subquantizers * 16);
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      for (size_t k = 0; k < 16; k++)
+      {
+        float entry = std::round((distances[m * 16 + k] - minimums[m]) * table.scale);
+        table.table[m * 16 + k] = std::min(entry, 255.0f);
+      }
+    }
+  }
+
+  pq_fast_scan_func_t PQLists::get_fast_scan_func()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    /** The fast-scan kernels need SSSE3 and AVX2 only, the AVX-512 level uses the AVX2 kernel. */
+    switch (L2Space::get_simd_level())
+    {
+    case SimdLevel::AVX512:
+    case SimdLevel::AVX2:
+      return PQFastScanKernelAVX2;
+    case SimdLevel::SSE4:
+      return PQFastScanKernelSSSE3;
+    default:
+      break;
+    }
+#endif
+    return PQFastScanKernelScalar;
+  }
+
+  bool PQLists::has_list(const list_id_t list_id) const
+  {
+    return id_to_list_map.find(list_id) != id_to_list_map.end();
+  }
+
+  const PQLists::CodeList &PQLists::get_list(const list_id_t list_id) const
+  {
+    auto list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    return list_it->second;
+  }
+
+  len_t PQLists::get_list_length(const list_id_t list_id) const
+  {
+    return get_list(list_id).ids.size();
+  }
+
+  const uint8_t *PQLists::get_codes(const list_id_t list_id) const
+  {
+    return get_list(list_id).codes.data();
+  }
+
+  const vector_id_t *PQLists::get_ids(const list_id_t list_id) const
+  {
+    return get_list(list_id).ids.data();
+  }
+
+  size_t PQLists::get_block_size() const
+  {
+    return 16 * quantizer.get_n_subquantizers();
+  }
+
+  size_t PQLists::get_total_size() const
+  {
+    size_t total_size = 0;
+    for (const auto &list : id_to_list_map)
+    {
+      total_size += list.second.codes.size() + list.second.ids.size() * sizeof(vector_id_t);
+    }
+    return total_size;
+  }
+
+  const ProductQuantizer &PQLists::get_quantizer() const
+  {
+    return quantizer;
+  }
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string.h>
+
+#include "storage-node/ProductQuantizer.hpp"
+
+namespace ann_dkvs
+{
+  ProductQuantizer::ProductQuantizer(size_t vector_dim, size_t n_subquantizers, size_t n_bits)
+      : vector_dim(vector_dim), n_subquantizers(n_subquantizers), n_bits(n_bits)
+  {
+    if (n_subquantizers == 0 || vector_dim % n_subquantizers != 0)
+    {
+      throw std::invalid_argument("Vector dimension must be a multiple of the number of subquantizers");
+    }
+    if (n_bits == 0 || n_bits > 8)
+    {
+      throw std::out_of_range("Codes must have between 1 and 8 bits");
+    }
+    n_centroids = (size_t)1 << n_bits;
+    subquantizer_dim = vector_dim / n_subquantizers;
+  }
+
+  uint8_t ProductQuantizer::find_nearest_centroid(const float *subvector, const float *centroids) const
+  {
+    uint8_t nearest = 0;
+    float nearest_distance = std::numeric_limits<float>::max();
+    for (size_t k = 0; k < n_centroids; k++)
+    {
+      const float *centroid = centroids + k * subquantizer_dim;
+      float distance = 0;
+      for (size_t j = 0; j < subquantizer_dim; j++)
+      {
+        float t = subvector[j] - centroid[j];
+        distance += t * t;
+      }
+      if (distance < nearest_distance)
+      {
+        nearest_distance = distance;
+        nearest = k;
+      }
+    }
+    return nearest;
+  }
+
+  void ProductQuantizer::train_subquantizer(const float *subvectors, const len_t n_vectors, const int n_iterations,
+                                            const unsigned seed, float *centroids) const
+  {
+    std::mt19937 random(seed);
+    std::vector<len_t> order(n_vectors);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), random);
+    for (size_t k = 0; k < n_centroids; k++)
+    {
+      memcpy(centroids + k * subquantizer_dim, subvectors + order[k] * subquantizer_dim, subquantizer_dim * sizeof(float));
+    }
+
+    std::vector<uint8_t> assignment(n_vectors);
+    std::vector<double> sums(n_centroids * subquantizer_dim);
+    std::vector<len_t> counts(n_centroids);
+    std::uniform_int_distribution<len_t> random_vector(0, n_vectors - 1);
+    for (int iteration = 0; iteration < n_iterations; iteration++)
+    {
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        assignment[i] = find_nearest_centroid(subvectors + i * subquantizer_dim, centroids);
+      }
+
+      std::fill(sums.begin(), sums.end(), 0.0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        const float *subvector = subvectors + i * subquantizer_dim;
+        double *sum = sums.data() + assignment[i] * subquantizer_dim;
+        for (size_t j = 0; j < subquantizer_dim; j++)
+        {
+          sum[j] += subvector[j];
+        }
+        counts[assignment[i]]++;
+      }
+      for (size_t k = 0; k < n_centroids; k++)
+      {
+        float *centroid = centroids + k * subquantizer_dim;
+        if (counts[k] == 0)
+        {
+          memcpy(centroid, subvectors + random_vector(random) * subquantizer_dim, subquantizer_dim * sizeof(float));
+          continue;
+        }
+        for (size_t j = 0; j < subquantizer_dim; j++)
+        {
+          centroid[j] = sums[k * subquantizer_dim + j] / counts[k];
+        }
+      }
+    }
+  }
+
+  void ProductQuantizer::train(const vector_el_t *vectors, const len_t n_vectors, const int n_iterations, const unsigned seed)
+  {
+    if (n_vectors < n_centroids)
+    {
+      throw std::out_of_range("Not enough training vectors for the number of centroids");
+    }
+    centroids.resize(n_subquantizers * n_centroids * subquantizer_dim);
+
+#if PMODE != 0
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      /** The sub-vectors of the subspace are gathered, so k-means reads them consecutively. */
+      std::vector<float> subvectors(n_vectors * subquantizer_dim);
+      for (len_t i = 0; i < n_vectors; i++)
+      {
+        const vector_el_t *subvector = vectors + i * vector_dim + m * subquantizer_dim;
+        for (size_t j = 0; j < subquantizer_dim; j++)
+        {
+          subvectors[i * subquantizer_dim + j] = subvector[j];
+        }
+      }
+      train_subquantizer(subvectors.data(), n_vectors, n_iterations, seed + m,
+                         centroids.data() + m * n_centroids * subquantizer_dim);
+    }
+  }
+
+  bool ProductQuantizer::is_trained() const
+  {
+    return !centroids.empty();
+  }
+
+  void ProductQuantizer::encode(const vector_el_t *vector, uint8_t *code) const
+  {
+    std::vector<float> subvector(subquantizer_dim);
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      for (size_t j = 0; j < subquantizer_dim; j++)
+      {
+        subvector[j] = vector[m * subquantizer_dim + j];
+      }
+      code[m] = find_nearest_centroid(subvector.data(), centroids.data() + m * n_centroids * subquantizer_dim);
+    }
+  }
+
+  void ProductQuantizer::decode(const uint8_t *code, float *vector) const
+  {
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      const float *centroid = centroids.data() + (m * n_centroids + code[m]) * subquantizer_dim;
+      memcpy(vector + m * subquantizer_dim, centroid, subquantizer_dim * sizeof(float));
+    }
+  }
+
+  void ProductQuantizer::compute_distance_table(const vector_el_t *query, float *table) const
+  {
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      const vector_el_t *subquery = query + m * subquantizer_dim;
+      for (size_t k = 0; k < n_centroids; k++)
+      {
+        const float *centroid = centroids.data() + (m * n_centroids + k) * subquantizer_dim;
+        float distance = 0;
+        for (size_t j = 0; j < subquantizer_dim; j++)
+        {
+          float t = (float)subquery[j] - centroid[j];
+          distance += t * t;
+        }
+        table[m * n_centroids + k] = distance;
+      }
+    }
+  }
+
+  distance_t ProductQuantizer::compute_distance(const float *table, const uint8_t *code) const
+  {
+    distance_t distance = 0;
+    for (size_t m = 0; m < n_subquantizers; m++)
+    {
+      distance += table[m * n_centroids + code[m]];
+    }
+    return distance;
+  }
+
+  size_t ProductQuantizer::get_vector_dim() const
+  {
+    return vector_dim;
+  }
+
+  size_t ProductQuantizer::get_n_subquantizers() const
+  {
+    return n_subquantizers;
+  }
+
+  size_t ProductQuantizer::get_n_bits() const
+  {
+    return n_bits;
+  }
+
+  size_t ProductQuantizer::get_n_centroids() const
+  {
+    return n_centroids;
+  }
+
+  size_t ProductQuantizer::get_subquantizer_dim() const
+  {
+    return subquantizer_dim;
+  }
+}
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <unordered_map>
 
 #include "storage-node/StorageIndex.hpp"
 #include "L2Space.hpp"
@@ -31,30 +34,356 @@ namespace ann_dkvs
     }
   }
 
+  ListView StorageIndex::get_list_view(const list_id_t list_id) const
+  {
+    ListView view;
+    view.vectors = lists->get_vectors(list_id);
+    view.ids = lists->get_ids(list_id);
+    view.norms = lists->get_norms(list_id);
+    view.length = lists->get_list_length(list_id);
+    view.dimension = lists->get_vector_dim();
+    return view;
+  }
+
   void StorageIndex::search_preassigned_list(
       const Query *query,
       const list_id_t list_id,
       heap_t &candidates) const
   {
-    const vector_el_t *vectors = lists->get_vectors(list_id);
-    const vector_id_t *ids = lists->get_ids(list_id);
-    size_t list_size = lists->get_list_length(list_id);
+    CentroidBounds bounds;
+    ListView view = get_list_view(list_id);
+    if (is_prefiltered(query, list_id, view.length))
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_prefiltered<decltype(distance)>(query, list_id, view, candidates); });
+    }
+    else if (get_centroid_bounds(query, list_id, view.length, bounds))
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_pruned<decltype(distance)>(query, bounds, view, candidates); });
+    }
+    else
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list<decltype(distance)>(query, view, candidates); });
+    }
+  }
+
+  bool StorageIndex::is_prefiltered(const Query *query, const list_id_t list_id, const len_t length) const
+  {
+    return binary_lists != nullptr && prefilter_expansion > 0 &&
+           prefilter_expansion * query->get_n_results() < length &&
+           binary_lists->has_list(list_id) && binary_lists->get_list_length(list_id) == length;
+  }
+
+  template <class Distance>
+  void StorageIndex::scan_list_prefiltered(const Query *query, const list_id_t list_id, const ListView &view, heap_t &candidates) const
+  {
     size_t vector_dim = lists->get_vector_dim();
-    for (size_t j = 0; j < list_size; j++)
+    const vector_el_t *query_vector = query->get_query_vector();
+    uint64_t query_code[HAMMING_MAX_WORDS];
+    binary_lists->encode_query(list_id, query_vector, query_code);
+    std::vector<uint16_t> hamming_distances(view.length);
+    hamming_func(query_code, binary_lists->get_codes(list_id), binary_lists->get_n_words(), view.length, hamming_distances.data());
+
+    /** The distances are at most vector_dim: the threshold is found in a histogram instead of sorting them. */
+    len_t n_kept = prefilter_expansion * query->get_n_results();
+    std::vector<len_t> histogram(vector_dim + 1, 0);
+    for (len_t i = 0; i < view.length; i++)
     {
-      const vector_el_t *vector = &vectors[j * vector_dim];
-      float distance = distance_func(vector, query->get_query_vector(), &vector_dim);
-      const vector_id_t vector_id = ids[j];
-      QueryResult result = {distance, vector_id};
+      histogram[hamming_distances[i]]++;
+    }
+    uint16_t threshold = 0;
+    len_t n_below = 0;
+    while (n_below + histogram[threshold] < n_kept)
+    {
+      n_below += histogram[threshold];
+      threshold++;
+    }
+    /** All vectors below the threshold are kept, and the first ones at the threshold. */
+    len_t n_at_threshold = n_kept - n_below;
+    for (len_t i = 0; i < view.length; i++)
+    {
+      if (hamming_distances[i] > threshold)
+      {
+        continue;
+      }
+      if (hamming_distances[i] == threshold)
+      {
+        if (n_at_threshold == 0)
+        {
+          continue;
+        }
+        n_at_threshold--;
+      }
+      QueryResult result = {Distance::compute(view.GetVector(i), query_vector, vector_dim), view.GetID(i)};
       add_candidate(query, result, candidates);
     }
   }
 
+  bool StorageIndex::get_centroid_bounds(const Query *query, const list_id_t list_id, const len_t length, CentroidBounds &bounds) const
+  {
+    distance_t query_distance = -1;
+    for (len_t i = 0; i < query->get_n_probe(); i++)
+    {
+      if (query->get_list_to_probe(i) == list_id)
+      {
+        query_distance = query->get_probe_distance(i);
+        break;
+      }
+    }
+    if (query_distance < 0)
+    {
+      return false;
+    }
+    bounds.distances = lists->get_centroid_distances(list_id, length, bounds.sorted);
+    bounds.query_distance = std::sqrt(query_distance);
+    return bounds.distances != nullptr;
+  }
+
+  template <class Distance>
+  void StorageIndex::scan_list_pruned(const Query *query, const CentroidBounds &bounds, const ListView &view, heap_t &candidates) const
+  {
+    size_t vector_dim = lists->get_vector_dim();
+    const vector_el_t *query_vector = query->get_query_vector();
+    auto lower_bound = [&](len_t i)
+    {
+      return std::fabs(bounds.query_distance - bounds.distances[i]) -
+             CENTROID_PRUNING_TOLERANCE * (bounds.query_distance + bounds.distances[i]);
+    };
+    auto is_pruned = [&](distance_t bound)
+    {
+      return bound > 0 && candidates.size() == query->get_n_results() && bound * bound > candidates.top().distance;
+    };
+    auto add_vector = [&](len_t i)
+    {
+      QueryResult result = {Distance::compute(view.GetVector(i), query_vector, vector_dim), view.GetID(i)};
+      add_candidate(query, result, candidates);
+    };
+
+    if (!bounds.sorted)
+    {
+      for (len_t i = 0; i < view.length; i++)
+      {
+        if (!is_pruned(lower_bound(i)))
+        {
+          add_vector(i);
+        }
+      }
+      return;
+    }
+
+    /** The entries [left, right) have been scanned, the next one is the one with the lower bound on either side. */
+    len_t right = std::lower_bound(bounds.distances, bounds.distances + view.length, bounds.query_distance) - bounds.distances;
+    len_t left = right;
+    while (left > 0 || right < view.length)
+    {
+      bool go_left = right == view.length || (left > 0 && lower_bound(left - 1) < lower_bound(right));
+      len_t i = go_left ? left - 1 : right;
+      if (is_pruned(lower_bound(i)))
+      {
+        /** The bounds of all remaining entries are at least as large. */
+        break;
+      }
+      add_vector(i);
+      if (go_left)
+      {
+        left--;
+      }
+      else
+      {
+        right++;
+      }
+    }
+  }
+
+  template <class Distance>
+  void StorageIndex::scan_list(const Query *query, const ListView &view, heap_t &candidates) const
+  {
+    size_t vector_dim = lists->get_vector_dim();
+    const vector_el_t *query_vector = query->get_query_vector();
+    if (view.HasNorms())
+    {
+      /** Distances of a block of vectors at once, from their stored norms. */
+      distance_t query_norm;
+      L2SqrNorms(query_vector, 1, vector_dim, &query_norm);
+      distance_t distances[SCAN_BLOCK_SIZE];
+      for (len_t i = 0; i < view.length;)
+      {
+        len_t n = std::min<len_t>(view.BlockLength(i), SCAN_BLOCK_SIZE);
+        Distance::compute_block(query_vector, query_norm, view.GetVector(i), view.GetNorms(i), n, vector_dim, distances);
+        for (len_t j = 0; j < n; j++)
+        {
+          QueryResult result = {distances[j], view.GetID(i + j)};
+          add_candidate(query, result, candidates);
+        }
+        i += n;
+      }
+      return;
+    }
+    for (len_t i = 0; i < view.length; i++)
+    {
+      float distance = Distance::compute(view.GetVector(i), query_vector, vector_dim);
+      QueryResult result = {distance, view.GetID(i)};
+      add_candidate(query, result, candidates);
+    }
+  }
+
+  template <class Distance>
+  void StorageIndex::scan_list_queries(const QueryBatch &queries, const ListQueries &work_item,
+                                       const ListView &view, std::vector<heap_t> &candidates) const
+  {
+    /** The list is streamed once, every block of vectors is applied to all queries while it is in cache. */
+    const std::vector<len_t> &query_indices = work_item.second;
+    size_t vector_dim = lists->get_vector_dim();
+    len_t n_queries = query_indices.size();
+    if (!view.HasNorms())
+    {
+      for (len_t i = 0; i < view.length; i += SCAN_BLOCK_SIZE)
+      {
+        len_t n = std::min<len_t>(view.length - i, SCAN_BLOCK_SIZE);
+        for (len_t r = 0; r < n_queries; r++)
+        {
+          const Query *query = queries[query_indices[r]];
+          const vector_el_t *query_vector = query->get_query_vector();
+          for (len_t j = i; j < i + n; j++)
+          {
+            QueryResult result = {Distance::compute(view.GetVector(j), query_vector, vector_dim), view.GetID(j)};
+            add_candidate(query, result, candidates[r]);
+          }
+        }
+      }
+      return;
+    }
+
+    std::vector<const vector_el_t *> query_vectors(n_queries);
+    std::vector<distance_t> query_norms(n_queries);
+    for (len_t r = 0; r < n_queries; r++)
+    {
+      query_vectors[r] = queries[query_indices[r]]->get_query_vector();
+      L2SqrNorms(query_vectors[r], 1, vector_dim, &query_norms[r]);
+    }
+    std::vector<distance_t> distances(n_queries * SCAN_BLOCK_SIZE);
+    for (len_t i = 0; i < view.length;)
+    {
+      len_t n = std::min<len_t>(view.BlockLength(i), SCAN_BLOCK_SIZE);
+      Distance::compute_matrix(query_vectors.data(), query_norms.data(), n_queries,
+                               view.GetVector(i), view.GetNorms(i), n, vector_dim, distances.data());
+      for (len_t r = 0; r < n_queries; r++)
+      {
+        const Query *query = queries[query_indices[r]];
+        for (len_t j = 0; j < n; j++)
+        {
+          QueryResult result = {distances[r * n + j], view.GetID(i + j)};
+          add_candidate(query, result, candidates[r]);
+        }
+      }
+      i += n;
+    }
+  }
+
+  void StorageIndex::merge_list_candidates(const QueryBatch &queries, const ListQueries &work_item,
+                                           std::vector<heap_t> &local_candidates, std::vector<heap_t> &candidate_lists) const
+  {
+    for (len_t r = 0; r < work_item.second.size(); r++)
+    {
+      len_t query_index = work_item.second[r];
+      while (local_candidates[r].size() > 0)
+      {
+        QueryResult result = local_candidates[r].top();
+        local_candidates[r].pop();
+        add_candidate(queries[query_index], result, candidate_lists[query_index]);
+      }
+    }
+  }
+
+  template <class Distance>
+  void StorageIndex::rerank_list(const Query *query, const ListView &view, const PQCandidate *candidates,
+                                 const len_t n_candidates, heap_t &results) const
+  {
+    size_t vector_dim = lists->get_vector_dim();
+    const vector_el_t *query_vector = query->get_query_vector();
+    for (len_t i = 0; i < n_candidates; i++)
+    {
+      len_t offset = candidates[i].offset;
+      if (offset >= view.length || view.GetID(offset) != candidates[i].vector_id)
+      {
+        continue;
+      }
+      QueryResult result = {Distance::compute(view.GetVector(offset), query_vector, vector_dim), candidates[i].vector_id};
+      add_candidate(query, result, results);
+    }
+  }
+
+  template <class RerankList>
+  QueryResults StorageIndex::rerank_shortlist(PQCandidates &shortlist, RerankList &&rerank_list) const
+  {
+    /** Sorted by location, so every list is read once and its vectors are read in order. */
+    std::sort(shortlist.begin(), shortlist.end(), [](const PQCandidate &a, const PQCandidate &b)
+              { return a.list_id < b.list_id || (a.list_id == b.list_id && a.offset < b.offset); });
+    heap_t results;
+    for (len_t i = 0; i < shortlist.size();)
+    {
+      list_id_t list_id = shortlist[i].list_id;
+      len_t n = 1;
+      while (i + n < shortlist.size() && shortlist[i + n].list_id == list_id)
+      {
+        n++;
+      }
+      rerank_list(list_id, shortlist.data() + i, n, results);
+      i += n;
+    }
+    return extract_results(results);
+  }
+
+  template <class BufferPool>
+  void StorageIndex::rerank_list_bpm(const Query *query, list_id_t list_id, const PQCandidate *candidates,
+                                     const len_t n_candidates, heap_t &results, BufferPool *bpm) const
+  {
+    ListView view;
+    if (bpm->FetchResidentListView(list_id, &view))
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { rerank_list<decltype(distance)>(query, view, candidates, n_candidates, results); });
+      bpm->UnPinListPages(list_id);
+      return;
+    }
+
+    /** Read the candidates into a contiguous view, their offsets become their positions in it. */
+    size_t vector_dim = lists->get_vector_dim();
+    std::vector<vector_el_t> vectors(n_candidates * vector_dim);
+    std::vector<vector_id_t> ids(n_candidates);
+    PQCandidates read_candidates;
+    read_candidates.reserve(n_candidates);
+    for (len_t i = 0; i < n_candidates; i++)
+    {
+      len_t position = read_candidates.size();
+      if (bpm->ReadEntry(list_id, candidates[i].offset, vectors.data() + position * vector_dim, ids.data() + position))
+      {
+        read_candidates.push_back(candidates[i]);
+        read_candidates.back().offset = position;
+      }
+    }
+    view.vectors = vectors.data();
+    view.ids = ids.data();
+    view.length = read_candidates.size();
+    view.dimension = vector_dim;
+    dispatch_l2(vector_dim, [&](auto distance)
+                { rerank_list<decltype(distance)>(query, view, read_candidates.data(), read_candidates.size(), results); });
+  }
+
   StorageIndex::StorageIndex(const StorageLists *lists)
-      : lists(lists), distance_func(L2Space(lists->get_vector_dim()).get_distance_func())
+      : lists(lists)
   {
   }
 
+  void StorageIndex::set_binary_prefilter(const BinaryLists *binary_lists, const len_t expansion_factor)
+  {
+    this->binary_lists = binary_lists;
+    prefilter_expansion = expansion_factor;
+    hamming_func = BinaryLists::get_hamming_func();
+  }
+
   QueryResults StorageIndex::search_preassigned(const Query *query) const
   {
     heap_t candidates;
@@ -80,6 +409,30 @@ namespace ann_dkvs
     return work_items;
   }
 
+  ListQueriesBatch StorageIndex::get_list_work_items(const QueryBatch &queries) const
+  {
+    ListQueriesBatch work_items;
+    std::unordered_map<list_id_t, len_t> list_positions;
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      for (len_t j = 0; j < queries[i]->get_n_probe(); j++)
+      {
+        list_id_t list_id = queries[i]->get_list_to_probe(j);
+        auto position = list_positions.find(list_id);
+        if (position == list_positions.end())
+        {
+          list_positions[list_id] = work_items.size();
+          work_items.push_back({list_id, {i}});
+        }
+        else
+        {
+          work_items[position->second].second.push_back(i);
+        }
+      }
+    }
+    return work_items;
+  }
+
   QueryResultsBatch StorageIndex::batch_search_preassigned(const QueryBatch &queries) const
   {
     QueryResultsBatch results(queries.size());
@@ -124,118 +477,94 @@ namespace ann_dkvs
     return results;
   }
 
-
-  /** Adding buffer pool management. */
-
-  void StorageIndex::search_preassigned_list_bpm(
-      const Query *query,
-      const list_id_t list_id,
-      heap_t &candidates,
-      BufferPoolManager* bpm) const
+  QueryResultsBatch StorageIndex::batch_search_preassigned_by_list(const QueryBatch &queries) const
   {
-    // const vector_el_t *vectors_mm = lists->get_vectors(list_id);
-    // const vector_id_t *ids_mm = lists->get_ids(list_id);
-
+    QueryResultsBatch results(queries.size());
+    std::vector<heap_t> candidate_lists(queries.size());
 
+    ListQueriesBatch work_items = get_list_work_items(queries);
 
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < work_items.size(); i++)
+    {
+      std::vector<heap_t> local_candidates(work_items[i].second.size());
+      ListView view = get_list_view(work_items[i].first);
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_queries<decltype(distance)>(queries, work_items[i], view, local_candidates); });
+#if PMODE != 0
+#pragma omp critical
+#endif
+      merge_list_candidates(queries, work_items[i], local_candidates, candidate_lists);
+    }
+    for (len_t j = 0; j < queries.size(); j++)
+    {
+      results[j] = extract_results(candidate_lists[j]);
+    }
+    return results;
+  }
 
-    std::vector<frame_id_t> frame_lists = bpm->FetchListPages(list_id);
-    size_t frame_list_size = frame_lists.size();
+  QueryResults StorageIndex::search_two_stage(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist) const
+  {
+    PQCandidates shortlist = compressed_index->shortlist(query, n_shortlist);
+    return rerank_shortlist(
+        shortlist, [&](list_id_t list_id, const PQCandidate *candidates, len_t n, heap_t &results)
+        {
+          ListView view = get_list_view(list_id);
+          dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                      { rerank_list<decltype(distance)>(query, view, candidates, n, results); });
+        });
+  }
 
-    size_t list_size = lists->get_list_length(list_id);
-    size_t vector_dim = lists->get_vector_dim();
+  QueryResultsBatch StorageIndex::batch_search_two_stage(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist) const
+  {
+    QueryResultsBatch results(queries.size());
 
-    size_t read_size = 0;
-    int full = list_size % FRAME_DATA_NUM;
-
-    int k = 0;
-
-    for (size_t i = 0; i < frame_list_size; i++) {
-      // std::cout << "load new" << std::endl;
-      frame_id_t frame_id = frame_lists[i];
-      const vector_el_t* vectors = (vector_el_t*) bpm->GetPageVectors(frame_id);
-      const vector_id_t* ids = (vector_id_t*) bpm->GetPageIDs(frame_id);
-
-      if (i != frame_list_size - 1 || full == 0) {
-        // std::cout << "list_size: " << list_size << std::endl;
-        for (int j = 0; j < FRAME_DATA_NUM; j++) {
-          const vector_el_t *vector = &vectors[j * vector_dim];
-
-
-          // const vector_el_t *vector_mm = &vectors_mm[k * vector_dim];
-          // std::cout << "bpm: ";
-          // for (int m = 0; m < vector_dim; m++) {
-          //   vector_el_t out = vector[m];
-          //   std::cout << out << " ";
-          // }
-          // std::cout << std::endl;
-          // std::cout << "mmap: ";
-          // for (int m = 0; m < vector_dim; m++) {
-          //   vector_el_t out = vector_mm[m];
-          //   std::cout << out << " ";
-          // }
-          // std::cout << std::endl;
-          // std::cout << "bpm: " << ids[j] << std::endl;
-          // std::cout << "mmap: " << ids_mm[k] << std::endl;
-          // std::cout << "non last k: " << k << std::endl;
-          // std::cout << "non last j: " << j << std::endl;
-          // assert(ids[j] == ids_mm[k] || !"non-equal!");
-          // k++;
-
-          
-          float distance = distance_func(vector, query->get_query_vector(), &vector_dim);
-          const vector_id_t vector_id = ids[j];
-          QueryResult result = {distance, vector_id};
-          add_candidate(query, result, candidates);
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      results[i] = search_two_stage(queries[i], compressed_index, n_shortlist);
+    }
+    return results;
+  }
 
-          read_size++;
-        }
-      } else {
-        // std::cout << "list_size: " << list_size << std::endl;
-        int num_in_last_frame = list_size % FRAME_DATA_NUM;
-        for (int j = 0; j < num_in_last_frame; j++) {
-          const vector_el_t *vector = &vectors[j * vector_dim];
-
-
-          // const vector_el_t *vector_mm = &vectors_mm[k * vector_dim];
-          // std::cout << "bpm: ";
-          // for (int m = 0; m < vector_dim; m++) {
-          //   vector_el_t out = vector[m];
-          //   std::cout << out << " ";
-          // }
-          // std::cout << std::endl;
-          // std::cout << "mmap: ";
-          // for (int m = 0; m < vector_dim; m++) {
-          //   vector_el_t out = vector_mm[m];
-          //   std::cout << out << " ";
-          // }
-          // std::cout << std::endl;
-          // std::cout << "bpm: " << ids[j] << std::endl;
-          // std::cout << "mmap: " << ids_mm[k] << std::endl;
-          // std::cout << "last k: " << k << std::endl;
-          // std::cout << "last j: " << j << std::endl;
-          // assert(ids[j] == ids_mm[k] || !"non-equal!");
-          // assert("Success!");
-          // k++;
-
-
-          float distance = distance_func(vector, query->get_query_vector(), &vector_dim);
-          const vector_id_t vector_id = ids[j];
-          QueryResult result = {distance, vector_id};
-          add_candidate(query, result, candidates);
 
-          read_size++;
-        }
-      }
+  /** Adding buffer pool management. */
 
+  template <class BufferPool>
+  void StorageIndex::search_preassigned_list_bpm(
+      const Query *query,
+      const list_id_t list_id,
+      heap_t &candidates,
+      BufferPool* bpm) const
+  {
+    /** The list is scanned as one sequence of vectors, whether or not its frames are contiguous. */
+    CentroidBounds bounds;
+    ListView view = bpm->FetchListView(list_id);
+    if (is_prefiltered(query, list_id, view.length))
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_prefiltered<decltype(distance)>(query, list_id, view, candidates); });
+    }
+    else if (get_centroid_bounds(query, list_id, view.length, bounds))
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_pruned<decltype(distance)>(query, bounds, view, candidates); });
+    }
+    else
+    {
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list<decltype(distance)>(query, view, candidates); });
     }
-    
-    assert(read_size == list_size || !"Error size read from function search_preassigned_list_bpm()!");
 
     bpm->UnPinListPages(list_id);
   }
 
-  QueryResults StorageIndex::search_preassigned_bpm(const Query *query, BufferPoolManager* bpm) const
+  template <class BufferPool>
+  QueryResults StorageIndex::search_preassigned_bpm(const Query *query, BufferPool* bpm) const
   {
     heap_t candidates;
     for (len_t i = 0; i < query->get_n_probe(); i++)
@@ -246,7 +575,8 @@ namespace ann_dkvs
     return extract_results(candidates);
   }
 
-  QueryResultsBatch StorageIndex::batch_search_preassigned_bpm(const QueryBatch &queries, BufferPoolManager* bpm) const
+  template <class BufferPool>
+  QueryResultsBatch StorageIndex::batch_search_preassigned_bpm(const QueryBatch &queries, BufferPool* bpm) const
   {
     QueryResultsBatch results(queries.size());
 
@@ -290,5 +620,76 @@ namespace ann_dkvs
     return results;
   }
 
+  template <class BufferPool>
+  QueryResultsBatch StorageIndex::batch_search_preassigned_by_list_bpm(const QueryBatch &queries, BufferPool* bpm) const
+  {
+    QueryResultsBatch results(queries.size());
+    std::vector<heap_t> candidate_lists(queries.size());
+
+    ListQueriesBatch work_items = get_list_work_items(queries);
+
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < work_items.size(); i++)
+    {
+      std::vector<heap_t> local_candidates(work_items[i].second.size());
+      /** One fetch of the list for all queries which probe it. */
+      ListView view = bpm->FetchListView(work_items[i].first);
+      dispatch_l2(lists->get_vector_dim(), [&](auto distance)
+                  { scan_list_queries<decltype(distance)>(queries, work_items[i], view, local_candidates); });
+      bpm->UnPinListPages(work_items[i].first);
+#if PMODE != 0
+#pragma omp critical
+#endif
+      merge_list_candidates(queries, work_items[i], local_candidates, candidate_lists);
+    }
+    for (len_t j = 0; j < queries.size(); j++)
+    {
+      results[j] = extract_results(candidate_lists[j]);
+    }
+    return results;
+  }
+
+  template <class BufferPool>
+  QueryResults StorageIndex::search_two_stage_bpm(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist, BufferPool *bpm) const
+  {
+    PQCandidates shortlist = compressed_index->shortlist(query, n_shortlist);
+    return rerank_shortlist(
+        shortlist, [&](list_id_t list_id, const PQCandidate *candidates, len_t n, heap_t &results)
+        { rerank_list_bpm(query, list_id, candidates, n, results, bpm); });
+  }
+
+  template <class BufferPool>
+  QueryResultsBatch StorageIndex::batch_search_two_stage_bpm(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist, BufferPool *bpm) const
+  {
+    QueryResultsBatch results(queries.size());
+
+#if PMODE != 0
+#pragma omp parallel for schedule(runtime)
+#endif
+    for (len_t i = 0; i < queries.size(); i++)
+    {
+      results[i] = search_two_stage_bpm(queries[i], compressed_index, n_shortlist, bpm);
+    }
+    return results;
+  }
+
 
-}
\ No newline at end of file
+  template QueryResults StorageIndex::search_preassigned_bpm(const Query *query, BufferPoolManager* bpm) const;
+  template QueryResults StorageIndex::search_preassigned_bpm(const Query *query, SharedBufferPool* bpm) const;
+  template QueryResults StorageIndex::search_preassigned_bpm(const Query *query, MappedBufferPool* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_bpm(const QueryBatch &queries, BufferPoolManager* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_bpm(const QueryBatch &queries, SharedBufferPool* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_bpm(const QueryBatch &queries, MappedBufferPool* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_by_list_bpm(const QueryBatch &queries, BufferPoolManager* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_by_list_bpm(const QueryBatch &queries, SharedBufferPool* bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_preassigned_by_list_bpm(const QueryBatch &queries, MappedBufferPool* bpm) const;
+  template QueryResults StorageIndex::search_two_stage_bpm(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist, BufferPoolManager *bpm) const;
+  template QueryResults StorageIndex::search_two_stage_bpm(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist, SharedBufferPool *bpm) const;
+  template QueryResults StorageIndex::search_two_stage_bpm(const Query *query, const PQIndex *compressed_index, const len_t n_shortlist, MappedBufferPool *bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_two_stage_bpm(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist, BufferPoolManager *bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_two_stage_bpm(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist, SharedBufferPool *bpm) const;
+  template QueryResultsBatch StorageIndex::batch_search_two_stage_bpm(const QueryBatch &queries, const PQIndex *compressed_index, const len_t n_shortlist, MappedBufferPool *bpm) const;
+
+}
@@ -4,8 +4,13 @@
 #include <iostream>
 #include <unistd.h>
 #include <fstream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
 
 #include "storage-node/StorageLists.hpp"
+#include "L2Space.hpp"
 
 namespace ann_dkvs
 {
@@ -42,6 +47,16 @@ namespace ann_dkvs
     return id_ptr;
   }
 
+  distance_t *StorageLists::get_norms_by_list(const InvertedList *list) const
+  {
+    if (!store_norms)
+    {
+      return nullptr;
+    }
+    vector_id_t *id_ptr = get_ids_by_list(list);
+    return (distance_t *)((size_t)id_ptr + get_ids_size(list->allocated_entries));
+  }
+
   size_t StorageLists::get_vectors_size(const len_t n_entries) const
   {
     return n_entries * vector_size;
@@ -52,6 +67,11 @@ namespace ann_dkvs
     return n_entries * sizeof(vector_id_t);
   }
 
+  size_t StorageLists::get_norms_size(const len_t n_entries) const
+  {
+    return store_norms ? n_entries * sizeof(distance_t) : 0;
+  }
+
   size_t StorageLists::get_list_ids_size(const len_t n_entries) const
   {
     return n_entries * sizeof(list_id_t);
@@ -60,7 +80,7 @@ namespace ann_dkvs
   size_t StorageLists::get_total_list_size(const InvertedList *list) const
   {
     len_t n_entries = list->allocated_entries;
-    return get_vectors_size(n_entries) + get_ids_size(n_entries);
+    return get_vectors_size(n_entries) + get_ids_size(n_entries) + get_norms_size(n_entries);
   }
 
   size_t StorageLists::get_free_space() const
@@ -212,6 +232,10 @@ namespace ann_dkvs
     }
     memcpy(get_vectors_by_list(dst), get_vectors_by_list(src), get_vectors_size(n_entries_to_copy));
     memcpy(get_ids_by_list(dst), get_ids_by_list(src), get_ids_size(n_entries_to_copy));
+    if (store_norms)
+    {
+      memcpy(get_norms_by_list(dst), get_norms_by_list(src), get_norms_size(n_entries_to_copy));
+    }
   }
 
   StorageLists::Slot StorageLists::list_to_slot(const InvertedList *list)
@@ -236,7 +260,9 @@ namespace ann_dkvs
     InvertedList *list = &list_it->second;
     if (!does_list_need_reallocation(list, n_entries))
     {
-      list->used_entries = n_entries;
+      InvertedList resized_list = *list;
+      resized_list.used_entries = n_entries;
+      commit_list(list_id, resized_list);
       return;
     }
     Slot slot = list_to_slot(list);
@@ -245,13 +271,66 @@ namespace ann_dkvs
     new_list = alloc_list(n_entries);
     if (new_list.offset == list->offset)
     {
-      memmove(get_ids_by_list(&new_list), get_ids_by_list(list), get_ids_size(list->used_entries));
+      /**
+       * The ids and the norms follow the vectors, so they move with the number of allocated entries.
+       * They are moved in an order which does not overwrite the ones not moved yet.
+       */
+      len_t n_entries_to_move = std::min(list->used_entries, new_list.used_entries);
+      bool grown = new_list.allocated_entries > list->allocated_entries;
+      if (store_norms && grown)
+      {
+        memmove(get_norms_by_list(&new_list), get_norms_by_list(list), get_norms_size(n_entries_to_move));
+      }
+      memmove(get_ids_by_list(&new_list), get_ids_by_list(list), get_ids_size(n_entries_to_move));
+      if (store_norms && !grown)
+      {
+        memmove(get_norms_by_list(&new_list), get_norms_by_list(list), get_norms_size(n_entries_to_move));
+      }
     }
     else
     {
       copy_shared_data(&new_list, list);
     }
-    id_to_list_map[list_id] = new_list;
+    commit_list(list_id, new_list);
+  }
+
+  void StorageLists::commit_list(const list_id_t list_id, const InvertedList &list)
+  {
+    std::unique_lock<std::shared_mutex> lock(directory->latch);
+    id_to_list_map[list_id] = list;
+    directory->list_versions[list_id] = directory->version.fetch_add(1) + 1;
+  }
+
+  void StorageLists::bump_list_version(const list_id_t list_id) const
+  {
+    std::unique_lock<std::shared_mutex> lock(directory->latch);
+    directory->list_versions[list_id] = directory->version.fetch_add(1) + 1;
+  }
+
+  uint64_t StorageLists::get_list_version(const list_id_t list_id) const
+  {
+    std::shared_lock<std::shared_mutex> lock(directory->latch);
+    auto version_it = directory->list_versions.find(list_id);
+    return version_it == directory->list_versions.end() ? 0 : version_it->second;
+  }
+
+  uint64_t StorageLists::get_version() const
+  {
+    return directory->version.load();
+  }
+
+  bool StorageLists::get_list_snapshot(const list_id_t list_id, InvertedList &list, uint64_t &version) const
+  {
+    std::shared_lock<std::shared_mutex> lock(directory->latch);
+    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      return false;
+    }
+    list = list_it->second;
+    auto version_it = directory->list_versions.find(list_id);
+    version = version_it == directory->list_versions.end() ? 0 : version_it->second;
+    return true;
   }
 
   StorageLists::InvertedList StorageLists::alloc_list(const len_t n_entries)
@@ -403,6 +482,103 @@ namespace ann_dkvs
     return get_ids_by_list(&list_it->second);
   }
 
+  bool StorageLists::has_norms() const
+  {
+    return store_norms;
+  }
+
+  const std::string &StorageLists::get_vector_el_name() const
+  {
+    return vector_el_name;
+  }
+
+  const distance_t *StorageLists::get_norms(const list_id_t list_id) const
+  {
+    list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
+    if (list_it == id_to_list_map.end())
+    {
+      throw std::invalid_argument("List not found");
+    }
+    return get_norms_by_list(&list_it->second);
+  }
+
+  void StorageLists::set_centroid_distances(const vector_el_t *centroids, const bool sort_lists)
+  {
+    centroid_distances.clear();
+    for (const auto &list_it : id_to_list_map)
+    {
+      list_id_t list_id = list_it.first;
+      const InvertedList *list = &list_it.second;
+      const vector_el_t *vectors = get_vectors_by_list(list);
+      const vector_el_t *centroid = centroids + list_id * vector_dim;
+      CentroidDistances &list_distances = centroid_distances[list_id];
+      list_distances.distances.resize(list->used_entries);
+      /** The same kernel as the RootIndex, so both distances are rounded alike. */
+      dispatch_l2(vector_dim, [&](auto distance)
+                  {
+                    for (len_t i = 0; i < list->used_entries; i++)
+                    {
+                      list_distances.distances[i] = std::sqrt(decltype(distance)::compute(vectors + i * vector_dim, centroid, vector_dim));
+                    } });
+      list_distances.sorted = sort_lists;
+      std::vector<distance_t> &distances = list_distances.distances;
+      if (sort_lists && !std::is_sorted(distances.begin(), distances.end()))
+      {
+        std::vector<len_t> order(list->used_entries);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](len_t a, len_t b)
+                         { return distances[a] < distances[b]; });
+        const vector_id_t *ids = get_ids_by_list(list);
+        std::vector<vector_el_t> sorted_vectors(list->used_entries * vector_dim);
+        std::vector<vector_id_t> sorted_ids(list->used_entries);
+        std::vector<distance_t> sorted_distances(list->used_entries);
+        for (len_t i = 0; i < list->used_entries; i++)
+        {
+          memcpy(sorted_vectors.data() + i * vector_dim, vectors + order[i] * vector_dim, vector_size);
+          sorted_ids[i] = ids[order[i]];
+          sorted_distances[i] = distances[order[i]];
+        }
+        update_entries(list_id, sorted_vectors.data(), sorted_ids.data(), list->used_entries, 0);
+        distances.swap(sorted_distances);
+      }
+      list_distances.list_version = get_list_version(list_id);
+    }
+  }
+
+  const distance_t *StorageLists::get_centroid_distances(const list_id_t list_id, const len_t length, bool &sorted) const
+  {
+    auto distances_it = centroid_distances.find(list_id);
+    if (distances_it == centroid_distances.end())
+    {
+      return nullptr;
+    }
+    const CentroidDistances &list_distances = distances_it->second;
+    if (list_distances.distances.size() != length || list_distances.list_version != get_list_version(list_id))
+    {
+      return nullptr;
+    }
+    sorted = list_distances.sorted;
+    return list_distances.distances.data();
+  }
+
+  void StorageLists::discard_outdated_centroid_distances()
+  {
+    for (auto distances_it = centroid_distances.begin(); distances_it != centroid_distances.end();)
+    {
+      list_id_list_map_t::const_iterator list_it = id_to_list_map.find(distances_it->first);
+      if (list_it == id_to_list_map.end() ||
+          distances_it->second.distances.size() != list_it->second.used_entries ||
+          distances_it->second.list_version != get_list_version(distances_it->first))
+      {
+        distances_it = centroid_distances.erase(distances_it);
+      }
+      else
+      {
+        distances_it++;
+      }
+    }
+  }
+
   len_t StorageLists::get_list_length(const list_id_t list_id) const
   {
     list_id_list_map_t::const_iterator list_it = id_to_list_map.find(list_id);
@@ -440,7 +616,7 @@ namespace ann_dkvs
       throw std::out_of_range("List must have at least one entry");
     }
     InvertedList list = alloc_list(n_entries);
-    id_to_list_map[list_id] = list;
+    commit_list(list_id, list);
   }
 
   void StorageLists::update_entries(
@@ -464,6 +640,11 @@ namespace ann_dkvs
     vector_id_t *list_ids = get_ids_by_list(list);
     memcpy(list_vectors + offset * vector_dim, vectors, get_vectors_size(n_entries));
     memcpy(list_ids + offset, ids, get_ids_size(n_entries));
+    if (store_norms)
+    {
+      L2SqrNorms(vectors, n_entries, vector_dim, get_norms_by_list(list) + offset);
+    }
+    bump_list_version(list_id);
   }
 
   void StorageLists::insert_entries(
@@ -493,7 +674,7 @@ namespace ann_dkvs
     {
       throw std::runtime_error("Cannot reserve 0 entries");
     }
-    size_t size_to_reserve = get_vectors_size(n_entries) + get_ids_size(n_entries);
+    size_t size_to_reserve = get_vectors_size(n_entries) + get_ids_size(n_entries) + get_norms_size(n_entries);
     grow_region_until_enough_space(size_to_reserve);
   }
 
@@ -561,6 +742,13 @@ namespace ann_dkvs
     const len_t max_buffer_size = (len_t)(MAX_BUFFER_SIZE);
     const len_t buffer_size = std::min(n_entries, max_buffer_size);
 
+    /** A file of floats is narrowed to the components on the fly. */
+    vectors_file.seekg(0, std::ios::end);
+    const bool narrow_floats = sizeof(vector_el_t) != sizeof(float) &&
+                               (len_t)vectors_file.tellg() == n_entries * vector_dim * sizeof(float);
+    vectors_file.seekg(0, std::ios::beg);
+    float *float_vectors = narrow_floats ? (float *)malloc(buffer_size * vector_dim * sizeof(float)) : nullptr;
+
     vector_el_t *vectors = (vector_el_t *)malloc(get_vectors_size(buffer_size));
     vector_id_t *vector_ids = (vector_id_t *)malloc(get_ids_size(buffer_size));
     list_id_t *list_ids = (list_id_t *)malloc(get_list_ids_size(buffer_size));
@@ -573,7 +761,18 @@ namespace ann_dkvs
       
       len_t n_entries_to_read = std::min(buffer_size, n_entries - n_entries_read);
 
-      if (!vectors_file.read((char *)vectors, get_vectors_size(n_entries_to_read)))
+      if (narrow_floats)
+      {
+        if (!vectors_file.read((char *)float_vectors, n_entries_to_read * vector_dim * sizeof(float)))
+        {
+          throw std::runtime_error("Error reading vectors file");
+        }
+        for (len_t i = 0; i < n_entries_to_read * vector_dim; i++)
+        {
+          vectors[i] = to_vector_el(float_vectors[i]);
+        }
+      }
+      else if (!vectors_file.read((char *)vectors, get_vectors_size(n_entries_to_read)))
       {
         throw std::runtime_error("Error reading vectors file");
       }
@@ -605,6 +804,7 @@ namespace ann_dkvs
       n_entries_read += n_entries_to_read;
     }
 
+    free(float_vectors);
     free(vectors);
     free(vector_ids);
     free(list_ids);
@@ -618,4 +818,20 @@ namespace ann_dkvs
     ids_file.close();
     list_ids_file.close();
   }
-}
\ No newline at end of file
+
+  vector_el_t StorageLists::to_vector_el(const float value)
+  {
+    if constexpr (std::is_integral<vector_el_t>::value)
+    {
+      float rounded = std::round(value);
+      rounded = std::max<float>(rounded, std::numeric_limits<vector_el_t>::min());
+      rounded = std::min<float>(rounded, std::numeric_limits<vector_el_t>::max());
+      return rounded;
+    }
+    else
+    {
+      /** Half precision formats round to nearest even. */
+      return value;
+    }
+  }
+}